@@ -0,0 +1,733 @@
+/* pshs -- microbenchmarks for the per-request hot functions
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+#include <event2/buffer.h>
+#include <event2/event.h>
+#include <event2/http.h>
+
+#include "archive.h"
+#include "conn.h"
+#include "content-type.h"
+#include "escape.h"
+#include "filelist.h"
+#include "handlers.h"
+#include "index.h"
+#include "network.h"
+#include "opener.h"
+#include "request.h"
+
+/* Count heap allocations by interposing malloc() and friends. This catches
+ * operator new as well as allocations made by libevent and libmagic. */
+#ifdef __GLIBC__
+static std::atomic<unsigned long long> alloc_count{0};
+static bool have_alloc_count = true;
+
+extern "C" {
+	extern void* __libc_malloc(size_t size);
+	extern void* __libc_calloc(size_t nmemb, size_t size);
+	extern void* __libc_realloc(void* ptr, size_t size);
+	extern void* __libc_memalign(size_t alignment, size_t size);
+
+	void* malloc(size_t size)
+	{
+		alloc_count.fetch_add(1, std::memory_order_relaxed);
+		return __libc_malloc(size);
+	}
+
+	void* calloc(size_t nmemb, size_t size)
+	{
+		alloc_count.fetch_add(1, std::memory_order_relaxed);
+		return __libc_calloc(nmemb, size);
+	}
+
+	void* realloc(void* ptr, size_t size)
+	{
+		alloc_count.fetch_add(1, std::memory_order_relaxed);
+		return __libc_realloc(ptr, size);
+	}
+
+	int posix_memalign(void** memptr, size_t alignment, size_t size)
+	{
+		alloc_count.fetch_add(1, std::memory_order_relaxed);
+		*memptr = __libc_memalign(alignment, size);
+		return *memptr ? 0 : ENOMEM;
+	}
+
+	void* aligned_alloc(size_t alignment, size_t size)
+	{
+		alloc_count.fetch_add(1, std::memory_order_relaxed);
+		return __libc_memalign(alignment, size);
+	}
+}
+#else
+static unsigned long long alloc_count = 0;
+static bool have_alloc_count = false;
+#endif
+
+/* keep the compiler from optimizing benchmarked calls away */
+static volatile uintptr_t sink;
+
+struct BenchResult
+{
+	std::string name;
+	double ns_per_op;
+	double allocs_per_op;
+	/* input bytes processed per second, 0 if not applicable */
+	double mb_per_s;
+};
+
+static std::vector<BenchResult> results;
+static const char* filter = NULL;
+static double min_time = 0.5;
+
+/**
+ * run
+ * @name: benchmark name
+ * @fn: function to benchmark, called once per operation
+ * @bytes: input bytes processed per call, to report throughput
+ *
+ * Run @fn repeatedly, doubling the iteration count until the run takes
+ * at least min_time, and record time and allocations per call.
+ */
+template <typename F>
+static void run(const std::string& name, F fn, size_t bytes = 0)
+{
+	if (filter && name.compare(0, strlen(filter), filter))
+		return;
+
+	/* warm up caches and lazy initialization */
+	fn();
+
+	for (unsigned long long iters = 1; ; iters *= 2)
+	{
+		unsigned long long allocs_before = alloc_count;
+		auto start = std::chrono::steady_clock::now();
+
+		for (unsigned long long i = 0; i < iters; ++i)
+			fn();
+
+		std::chrono::duration<double> elapsed{
+			std::chrono::steady_clock::now() - start};
+		unsigned long long allocs = alloc_count - allocs_before;
+
+		if (elapsed.count() >= min_time || iters >= (1ULL << 40))
+		{
+			results.push_back({name, elapsed.count() * 1e9 / iters,
+					static_cast<double>(allocs) / iters,
+					bytes * iters / elapsed.count() / 1e6});
+			std::cerr << std::left << std::setw(32) << name << std::right
+				<< std::fixed << std::setprecision(1) << std::setw(14)
+				<< results.back().ns_per_op << " ns/op"
+				<< std::setprecision(2) << std::setw(12)
+				<< results.back().allocs_per_op << " allocs/op";
+			if (bytes)
+				std::cerr << std::setprecision(0) << std::setw(10)
+					<< results.back().mb_per_s << " MB/s";
+			std::cerr << std::defaultfloat << std::endl;
+			break;
+		}
+	}
+}
+
+/**
+ * make_files
+ * @count: number of names
+ * @storage: storage for the names
+ *
+ * Returns: a null-terminated served file list of @count names
+ */
+static std::vector<char*> make_files(size_t count,
+		std::vector<std::string>& storage)
+{
+	std::vector<char*> files;
+
+	storage.clear();
+	storage.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+		storage.push_back("photos/holiday 2024/IMG_" + std::to_string(100000 + i)
+				+ " (copy).jpg");
+	for (std::string& s : storage)
+		files.push_back(&s[0]);
+	files.push_back(NULL);
+	return files;
+}
+
+static void bench_find_file()
+{
+	for (size_t count : {10, 10000, 1000000})
+	{
+		std::vector<std::string> storage;
+		std::vector<char*> files = make_files(count, storage);
+		FileList list;
+		for (char* const* it = files.data(); *it; ++it)
+			list.add(*it);
+		list.finish();
+		std::string last = storage.back();
+		std::string miss = last + ".missing";
+		std::string suffix = '/' + std::to_string(count);
+
+		run("find_file/last" + suffix, [&] {
+			sink = list.find(last.c_str());
+		});
+		run("find_file/miss" + suffix, [&] {
+			sink = list.find(miss.c_str());
+		});
+	}
+}
+
+/**
+ * make_tar_file
+ * @names: member names, under 100 characters
+ *
+ * Returns: path of a temporary tar archive of empty members called
+ * @names, or an empty string on error
+ */
+static std::string make_tar_file(const std::vector<std::string>& names)
+{
+	char path[] = "/tmp/pshs-microbench.XXXXXX";
+	int fd = mkstemp(path);
+	if (fd == -1)
+	{
+		perror("mkstemp()");
+		return "";
+	}
+
+	/* the members, and two zero blocks ending the archive */
+	std::vector<char> data((names.size() + 2) * 512);
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		char* h = &data[i * 512];
+		unsigned sum = 0;
+
+		memcpy(h, names[i].c_str(), names[i].size());
+		memcpy(h + 100, "0000644", 8);
+		memcpy(h + 124, "00000000000", 12);
+		memcpy(h + 136, "14000000000", 12);
+		h[156] = '0';
+		memcpy(h + 257, "ustar\0" "00", 8);
+		memset(h + 148, ' ', 8);
+		for (int j = 0; j < 512; ++j)
+			sum += static_cast<unsigned char>(h[j]);
+		snprintf(h + 148, 8, "%06o", sum);
+	}
+
+	bool ok = write(fd, data.data(), data.size())
+		== static_cast<ssize_t>(data.size());
+	if (!ok)
+	{
+		perror("write()");
+		unlink(path);
+	}
+	close(fd);
+	return ok ? path : "";
+}
+
+static void bench_archive()
+{
+	const size_t count = 10000;
+	std::vector<std::string> names;
+	make_files(count, names);
+	std::string path = make_tar_file(names);
+	if (path.empty())
+		return;
+
+	run("archive/index/" + std::to_string(count), [&] {
+		ArchiveIndex archives;
+		archives.add(path.c_str());
+		archives.finish();
+		sink = archives.size();
+	});
+
+	ArchiveIndex archives;
+	if (archives.add(path.c_str()))
+	{
+		archives.finish();
+		run("archive/find/" + std::to_string(count), [&] {
+			sink = reinterpret_cast<uintptr_t>(
+					archives.find(names[count / 3].c_str()));
+		});
+	}
+	unlink(path.c_str());
+}
+
+static void bench_parse_range()
+{
+	intmax_t first, last;
+	const off_t size = 1LL << 32;
+
+	run("parse_range/none", [&] {
+		sink = parse_range(NULL, size, first, last);
+	});
+	run("parse_range/bytes", [&] {
+		sink = parse_range("bytes=1048576-2097151", size, first, last);
+	});
+	run("parse_range/open", [&] {
+		sink = parse_range("bytes=1048576-", size, first, last);
+	});
+	run("parse_range/suffix", [&] {
+		sink = parse_range("bytes=-500", size, first, last);
+	});
+}
+
+static void bench_decode_uri()
+{
+	std::vector<char> buf;
+
+	run("resolve_path/plain", [&] {
+		sink = reinterpret_cast<uintptr_t>(resolve_path(
+				"photos/holiday/IMG_100000.jpg", NULL, 0, buf));
+	});
+	run("resolve_path/escaped", [&] {
+		sink = reinterpret_cast<uintptr_t>(resolve_path(
+				"photos/holiday%202024/IMG_100000%20%28copy%29.jpg",
+				NULL, 0, buf));
+	});
+	run("decode_uri/plain", [&] {
+		char* out = evhttp_decode_uri("photos/holiday/IMG_100000.jpg");
+		sink = reinterpret_cast<uintptr_t>(out);
+		free(out);
+	});
+	run("decode_uri/escaped", [&] {
+		char* out = evhttp_decode_uri(
+				"photos/holiday%202024/IMG_100000%20%28copy%29.jpg");
+		sink = reinterpret_cast<uintptr_t>(out);
+		free(out);
+	});
+}
+
+/* long names in a few scripts, and one with HTML special characters */
+static const char* const escape_samples[] =
+{
+	"Zdjęcia z wakacji 2024 — Kraków, Gdańsk i Zakopane (kopia zapasowa).jpg",
+	"Фотографии с отпуска 2024 года — Москва и Санкт-Петербург.jpg",
+	"東京への旅行の写真とビデオのバックアップ（コピー）二〇二四年.mp4",
+	"release-notes_v2.4.1~final.tar.gz",
+	"Tom & Jerry's \"<best>\" episodes.mkv",
+};
+
+/**
+ * check_escape
+ *
+ * Compare the output of all escaping kernels with libevent, for all
+ * byte values at every block offset and for the sample names.
+ *
+ * Returns: true if all outputs match
+ */
+static bool check_escape()
+{
+	std::vector<std::string> inputs{std::begin(escape_samples),
+		std::end(escape_samples)};
+	std::string all_bytes;
+	for (int c = 1; c < 256; ++c)
+		all_bytes += static_cast<char>(c);
+	for (size_t off = 0; off < 64; ++off)
+	{
+		inputs.push_back(std::string(off, 'a') + all_bytes);
+		inputs.push_back(all_bytes.substr(off));
+	}
+	inputs.push_back("");
+
+	size_t count;
+	const EscapeKernel* kernels = escape_kernels(count);
+	bool ok = true;
+
+	for (const std::string& in : inputs)
+	{
+		std::unique_ptr<char, void(*)(void*)>
+			urlenc{evhttp_encode_uri(in.c_str()), free},
+			htmlenc{evhttp_htmlescape(in.c_str()), free};
+		std::vector<char> out(in.size() * html_escape_ratio + 1);
+
+		for (size_t k = 0; k < count; ++k)
+		{
+			size_t len = kernels[k].uri_encode(out.data(), in.data(),
+					in.size());
+			if (std::string(out.data(), len) != urlenc.get())
+			{
+				std::cerr << kernels[k].name << " URI encoding mismatch for: "
+					<< in << '\n';
+				ok = false;
+			}
+
+			len = kernels[k].html_escape(out.data(), in.data(), in.size());
+			if (std::string(out.data(), len) != htmlenc.get())
+			{
+				std::cerr << kernels[k].name << " HTML escaping mismatch for: "
+					<< in << '\n';
+				ok = false;
+			}
+		}
+	}
+
+	return ok;
+}
+
+static void bench_escape()
+{
+	size_t count;
+	const EscapeKernel* kernels = escape_kernels(count);
+
+	for (size_t s = 0; s < 3; ++s)
+	{
+		/* a long path, repeating the name */
+		std::string in;
+		while (in.size() < 4096)
+			in += escape_samples[s] + std::string("/");
+		std::vector<char> out(in.size() * html_escape_ratio);
+		std::string suffix = '/' + std::to_string(s);
+
+		run("uri_encode/libevent" + suffix, [&] {
+			char* ret = evhttp_encode_uri(in.c_str());
+			sink = reinterpret_cast<uintptr_t>(ret);
+			free(ret);
+		}, in.size());
+		for (size_t k = 0; k < count; ++k)
+		{
+			run(std::string("uri_encode/") + kernels[k].name + suffix, [&] {
+				sink = kernels[k].uri_encode(out.data(), in.data(), in.size());
+			}, in.size());
+		}
+		/* the kernel choice made per input */
+		run("uri_encode/dispatch" + suffix, [&] {
+			sink = uri_encode(out.data(), in.data(), in.size());
+		}, in.size());
+
+		run("html_escape/libevent" + suffix, [&] {
+			char* ret = evhttp_htmlescape(in.c_str());
+			sink = reinterpret_cast<uintptr_t>(ret);
+			free(ret);
+		}, in.size());
+		for (size_t k = 0; k < count; ++k)
+		{
+			run(std::string("html_escape/") + kernels[k].name + suffix, [&] {
+				sink = kernels[k].html_escape(out.data(), in.data(), in.size());
+			}, in.size());
+		}
+	}
+}
+
+static void bench_generate_index()
+{
+	struct evbuffer* buf = evbuffer_new();
+
+	for (size_t count : {10, 1000, 100000})
+	{
+		std::vector<std::string> storage;
+		std::vector<char*> files = make_files(count, storage);
+
+		run("generate_index/" + std::to_string(count), [&] {
+			generate_index(buf, files.data(), NULL, NULL, NULL);
+			sink = evbuffer_get_length(buf);
+			evbuffer_drain(buf, evbuffer_get_length(buf));
+		});
+	}
+
+	evbuffer_free(buf);
+}
+
+/**
+ * make_html_file
+ *
+ * Returns: descriptor of an unlinked temporary HTML file, or -1 on error
+ */
+static int make_html_file()
+{
+	char path[] = "/tmp/pshs-microbench.XXXXXX";
+	int fd = mkstemp(path);
+	if (fd == -1)
+	{
+		perror("mkstemp()");
+		return -1;
+	}
+	unlink(path);
+
+	const char html[] = "<!DOCTYPE html>\n<html><head><title>test</title>"
+		"</head><body><p>Hello, world!</p></body></html>\n";
+	if (write(fd, html, sizeof(html) - 1) != sizeof(html) - 1)
+	{
+		perror("write()");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void bench_content_type()
+{
+	int fd = make_html_file();
+	if (fd == -1)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st))
+	{
+		perror("fstat()");
+		close(fd);
+		return;
+	}
+
+#ifdef HAVE_LIBMAGIC
+	{
+		ContentType ct;
+		run("content_type/libmagic", [&] {
+			sink = reinterpret_cast<uintptr_t>(ct.guess(fd));
+		});
+		run("content_type/cached", [&] {
+			sink = reinterpret_cast<uintptr_t>(
+					ct.guess("index.html", fd, 0, st));
+		});
+	}
+#endif
+	{
+		ContentType ct{false};
+		run("content_type/fallback", [&] {
+			sink = reinterpret_cast<uintptr_t>(ct.guess(fd));
+		});
+	}
+	run("content_type/extension", [&] {
+		sink = reinterpret_cast<uintptr_t>(
+				ContentType::by_extension("holiday 2024/IMG_100009.JPG"));
+	});
+
+	close(fd);
+}
+
+/* handle_file() and handle_file_opened() up to passing headers to
+ * libevent, with the file opened in the event loop thread (inline) and in
+ * a worker thread */
+static const char request_bench[] = "request/cached-file";
+
+struct RequestBench
+{
+	const struct callback_data* cb_data;
+	bool done;
+};
+
+static void bench_request_opened(OpenJob* job, void* data)
+{
+	RequestBench* b = static_cast<RequestBench*>(data);
+	FileReply r;
+
+	b->done = true;
+	if (job->fd == -1)
+		return;
+
+	plan_reply(r, b->cb_data, job->req, job->st, job->file_idx, job->member);
+	sink = reinterpret_cast<uintptr_t>(job->type) + r.content_range[6];
+	close(job->fd);
+}
+
+static void bench_request()
+{
+	char dir[] = "/tmp/pshs-microbench.XXXXXX";
+	if (!mkdtemp(dir))
+	{
+		perror("mkdtemp()");
+		return;
+	}
+
+	/* the served names are relative, as given on the command line */
+	int cwd = open(".", O_RDONLY | O_DIRECTORY);
+	if (cwd == -1 || chdir(dir))
+	{
+		perror("chdir()");
+		if (cwd != -1)
+			close(cwd);
+		rmdir(dir);
+		return;
+	}
+
+	std::vector<std::string> storage;
+	std::vector<char*> files = make_files(10, storage);
+	FileList list;
+	for (char* const* it = files.data(); *it; ++it)
+		list.add(*it);
+	list.finish();
+	const std::string uri = "share/photos/holiday%202024/IMG_100009%20%28copy%29.jpg";
+	const char html[] = "<!DOCTYPE html>\n<html><head><title>test</title>"
+		"</head><body><p>Hello, world!</p></body></html>\n";
+	int fd = -1;
+
+	if (!mkdir("photos", 0700) && !mkdir("photos/holiday 2024", 0700))
+		fd = open(storage.back().c_str(), O_WRONLY | O_CREAT, 0600);
+	if (fd == -1 || write(fd, html, sizeof(html) - 1) != sizeof(html) - 1)
+		perror("write()");
+	else
+	{
+		struct event_base* evb = event_base_new();
+		struct evhttp* http = evhttp_new(evb);
+		struct evhttp_request* req = evhttp_request_new(NULL, NULL);
+
+		evhttp_add_header(evhttp_request_get_input_headers(req), "Range",
+				"bytes=0-99");
+		{
+			ConnTracker conns{evb, http, ConnLimits{}};
+			ContentType ct;
+			struct callback_data cb_data{};
+			RequestBench b{&cb_data, false};
+
+			cb_data.prefix = "share";
+			cb_data.prefix_len = 5;
+			cb_data.files = files.data();
+			cb_data.file_list = &list;
+			cb_data.ct = &ct;
+			cb_data.conns = &conns;
+
+			for (unsigned int threads : {0, 1})
+			{
+				FileOpener opener{evb, conns, ct, files.data(), NULL, threads,
+					bench_request_opened, &b};
+
+				cb_data.opener = &opener;
+				run(std::string(request_bench)
+						+ (threads ? "/thread" : "/inline"), [&] {
+					ssize_t idx;
+					ArchiveMember* member;
+
+					b.done = false;
+					if (route_file(&cb_data, uri.c_str(), idx, member)
+							&& opener.open(req, idx, member))
+					{
+						while (!b.done)
+							event_base_loop(evb, EVLOOP_ONCE);
+					}
+				});
+			}
+		}
+
+		evhttp_request_free(req);
+		evhttp_free(http);
+		event_base_free(evb);
+	}
+
+	if (fd != -1)
+		close(fd);
+	unlink(storage.back().c_str());
+	rmdir("photos/holiday 2024");
+	rmdir("photos");
+	if (fchdir(cwd))
+		perror("fchdir()");
+	close(cwd);
+	rmdir(dir);
+}
+
+static void bench_ip_addr_printer()
+{
+	std::ostringstream os;
+
+	run("ip_addr_printer/ipv4", [&] {
+		os.seekp(0);
+		os << IPAddrPrinter("192.168.100.200", 54321);
+		sink = os.tellp();
+	});
+	run("ip_addr_printer/ipv6", [&] {
+		os.seekp(0);
+		os << IPAddrPrinter("2001:db8:1234:5678::abcd", 54321);
+		sink = os.tellp();
+	});
+}
+
+const struct option opts[] =
+{
+	{ "help", no_argument, NULL, 'h' },
+	{ "filter", required_argument, NULL, 'f' },
+	{ "time", required_argument, NULL, 't' },
+	{ "json", no_argument, NULL, 'j' },
+
+	{ 0, 0, 0, 0 }
+};
+
+const char opt_help[] =
+"Options:\n"
+"    --filter PFX, -f PFX   run only benchmarks with names starting with PFX\n"
+"    --time S, -t S         minimum run time per benchmark (default: 0.5)\n"
+"    --json, -j             print results as JSON to stdout\n";
+
+int main(int argc, char* argv[])
+{
+	int opt;
+	bool json = false;
+
+	while ((opt = getopt_long(argc, argv, "hf:t:j", opts, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 'f': filter = optarg; break;
+			case 't': min_time = atof(optarg); break;
+			case 'j': json = true; break;
+			default:
+				std::cerr << "Usage: " << argv[0] << " [options]\n\n"
+					<< opt_help;
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!have_alloc_count)
+		std::cerr << "Allocation counting not supported on this libc.\n";
+	if (!check_escape())
+		return 1;
+
+	bench_find_file();
+	bench_archive();
+	bench_parse_range();
+	bench_decode_uri();
+	bench_escape();
+	bench_generate_index();
+	bench_content_type();
+	bench_request();
+	bench_ip_addr_printer();
+
+	if (json)
+	{
+		std::cout << "{\"version\": \"" PACKAGE_VERSION "\", \"benchmarks\": [\n"
+			<< std::fixed << std::setprecision(2);
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			std::cout << "  {\"name\": \"" << results[i].name << "\""
+				<< ", \"ns_per_op\": " << results[i].ns_per_op
+				<< ", \"allocs_per_op\": " << results[i].allocs_per_op;
+			if (results[i].mb_per_s)
+				std::cout << ", \"mb_per_s\": " << results[i].mb_per_s;
+			std::cout << '}' << (i + 1 < results.size() ? "," : "") << '\n';
+		}
+		std::cout << "]}\n";
+	}
+
+	/* serving a file whose type is known must not allocate */
+	for (const BenchResult& r : results)
+	{
+		if (have_alloc_count
+				&& !r.name.compare(0, strlen(request_bench), request_bench)
+				&& r.allocs_per_op > 0)
+		{
+			std::cerr << r.name << ": " << r.allocs_per_op
+				<< " allocations per request, expected none\n";
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,845 @@
+/* pshs -- HTTP benchmark suite and load generator
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ftw.h>
+#include <getopt.h>
+
+#ifdef HAVE_LIBSSL
+#	include <openssl/ssl.h>
+#endif
+
+typedef std::chrono::steady_clock bench_clock;
+
+/**
+ * Connection
+ *
+ * A blocking keep-alive HTTP/1.1 client connection, optionally over TLS.
+ */
+class Connection
+{
+	int _fd;
+#ifdef HAVE_LIBSSL
+	std::unique_ptr<SSL, std::function<void(SSL*)>> _ssl;
+#endif
+	char _buf[64 * 1024];
+	size_t _pos, _len;
+
+	ssize_t raw_read(char* buf, size_t len);
+	bool raw_write(const char* buf, size_t len);
+	bool fill();
+
+public:
+	Connection(unsigned int port, void* ssl_ctx);
+	~Connection();
+
+	bool request(const std::string& req, unsigned long long& body_len,
+			bench_clock::time_point* first_byte);
+};
+
+Connection::Connection(unsigned int port, void* ssl_ctx)
+	: _pos(0), _len(0)
+{
+	struct sockaddr_in sin;
+	int one = 1;
+
+	_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (_fd == -1)
+		throw std::runtime_error("socket() failed");
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(_fd, reinterpret_cast<struct sockaddr*>(&sin), sizeof(sin)))
+	{
+		close(_fd);
+		throw std::runtime_error(std::string("connect() failed: ")
+				+ strerror(errno));
+	}
+	setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+#ifdef HAVE_LIBSSL
+	if (ssl_ctx)
+	{
+		_ssl = {SSL_new(static_cast<SSL_CTX*>(ssl_ctx)), SSL_free};
+		if (!_ssl)
+			throw std::bad_alloc();
+		SSL_set_fd(_ssl.get(), _fd);
+		if (SSL_connect(_ssl.get()) != 1)
+		{
+			close(_fd);
+			throw std::runtime_error("SSL_connect() failed");
+		}
+	}
+#endif
+}
+
+Connection::~Connection()
+{
+#ifdef HAVE_LIBSSL
+	_ssl.reset(nullptr);
+#endif
+	close(_fd);
+}
+
+ssize_t Connection::raw_read(char* buf, size_t len)
+{
+#ifdef HAVE_LIBSSL
+	if (_ssl)
+	{
+		int ret = SSL_read(_ssl.get(), buf, len);
+		return ret > 0 ? ret : -1;
+	}
+#endif
+	ssize_t ret;
+	do
+		ret = read(_fd, buf, len);
+	while (ret == -1 && errno == EINTR);
+	return ret;
+}
+
+bool Connection::raw_write(const char* buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t ret;
+#ifdef HAVE_LIBSSL
+		if (_ssl)
+			ret = SSL_write(_ssl.get(), buf, len);
+		else
+#endif
+			ret = write(_fd, buf, len);
+		if (ret <= 0)
+		{
+			if (ret == -1 && errno == EINTR)
+				continue;
+			return false;
+		}
+		buf += ret;
+		len -= ret;
+	}
+	return true;
+}
+
+bool Connection::fill()
+{
+	if (_pos == _len)
+		_pos = _len = 0;
+	if (_len == sizeof(_buf))
+		return false;
+
+	ssize_t rd = raw_read(_buf + _len, sizeof(_buf) - _len);
+	if (rd <= 0)
+		return false;
+	_len += rd;
+	return true;
+}
+
+/**
+ * Connection::request
+ * @req: full request text
+ * @body_len: location to store the received body length
+ * @first_byte: location to store the time first response byte arrived,
+ * or %NULL
+ *
+ * Send a request and read the whole response.
+ *
+ * Returns: true if a 2xx response was received in full
+ */
+bool Connection::request(const std::string& req, unsigned long long& body_len,
+		bench_clock::time_point* first_byte)
+{
+	if (!raw_write(req.data(), req.size()))
+		return false;
+
+	/* read headers */
+	char* end;
+	bool got_first = false;
+	for (;;)
+	{
+		end = static_cast<char*>(memmem(_buf + _pos, _len - _pos, "\r\n\r\n", 4));
+		if (end)
+			break;
+		if (_pos > 0)
+		{
+			memmove(_buf, _buf + _pos, _len - _pos);
+			_len -= _pos;
+			_pos = 0;
+		}
+		if (!fill())
+			return false;
+		if (!got_first && first_byte)
+		{
+			*first_byte = bench_clock::now();
+			got_first = true;
+		}
+	}
+
+	std::string headers{_buf + _pos, end};
+	_pos = end + 4 - _buf;
+
+	int status = 0;
+	if (sscanf(headers.c_str(), "HTTP/1.%*d %d", &status) != 1)
+		return false;
+
+	size_t cl = headers.find("Content-Length:");
+	if (cl == std::string::npos)
+		return false;
+	body_len = strtoull(&headers[cl + 15], NULL, 10);
+
+	/* discard body */
+	unsigned long long left = body_len;
+	while (left > 0)
+	{
+		if (_pos == _len)
+		{
+			if (first_byte && !got_first)
+			{
+				*first_byte = bench_clock::now();
+				got_first = true;
+			}
+			if (!fill())
+				return false;
+		}
+		size_t chunk = std::min<unsigned long long>(left, _len - _pos);
+		_pos += chunk;
+		left -= chunk;
+	}
+
+	return status >= 200 && status < 300;
+}
+
+struct Result
+{
+	std::string name;
+	unsigned long long requests;
+	unsigned long long errors;
+	unsigned long long bytes;
+	double seconds;
+	double p50_us;
+	double p99_us;
+	double ttfb_p50_us;
+
+	double rps() const { return requests / seconds; }
+	double mib_s() const { return bytes / seconds / (1024 * 1024); }
+};
+
+struct Scenario
+{
+	std::string name;
+	/* extra pshs arguments */
+	std::vector<std::string> args;
+	/* request paths, picked round-robin */
+	std::vector<std::string> paths;
+	/* whether to request random 1 MiB ranges */
+	bool ranges;
+	bool ssl;
+	unsigned int connections;
+};
+
+/**
+ * percentile
+ * @sorted: sorted samples
+ * @p: percentile, 0..1
+ *
+ * Returns: the value at percentile @p
+ */
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+	return sorted[std::min(sorted.size() - 1,
+			static_cast<size_t>(p * sorted.size()))];
+}
+
+/**
+ * run_load
+ * @sc: scenario
+ * @port: server port
+ * @duration: run time in seconds
+ * @file_size: size of the range target file
+ *
+ * Run the load generator against the server for @duration seconds.
+ *
+ * Returns: collected results
+ */
+static Result run_load(const Scenario& sc, unsigned int port,
+		double duration, unsigned long long file_size)
+{
+	void* ssl_ctx = NULL;
+#ifdef HAVE_LIBSSL
+	std::unique_ptr<SSL_CTX, std::function<void(SSL_CTX*)>> ctx;
+	if (sc.ssl)
+	{
+		ctx = {SSL_CTX_new(TLS_client_method()), SSL_CTX_free};
+		if (!ctx)
+			throw std::bad_alloc();
+		SSL_CTX_set_verify(ctx.get(), SSL_VERIFY_NONE, NULL);
+		ssl_ctx = ctx.get();
+	}
+#endif
+
+	std::vector<std::thread> threads;
+	std::vector<std::vector<double>> latencies(sc.connections);
+	std::vector<std::vector<double>> ttfbs(sc.connections);
+	std::atomic<unsigned long long> requests{0}, errors{0}, bytes{0};
+	auto start = bench_clock::now();
+	auto deadline = start + std::chrono::duration_cast<bench_clock::duration>(
+			std::chrono::duration<double>(duration));
+
+	for (unsigned int t = 0; t < sc.connections; ++t)
+	{
+		threads.emplace_back([&, t]() {
+			std::mt19937_64 rng{t};
+			std::unique_ptr<Connection> conn;
+			size_t path_idx = t;
+
+			while (bench_clock::now() < deadline)
+			{
+				if (!conn)
+				{
+					try
+					{
+						conn.reset(new Connection(port, ssl_ctx));
+					}
+					catch (std::exception& e)
+					{
+						++errors;
+						continue;
+					}
+				}
+
+				std::stringstream req;
+				req << "GET /" << sc.paths[path_idx++ % sc.paths.size()]
+					<< " HTTP/1.1\r\nHost: 127.0.0.1\r\n";
+				if (sc.ranges)
+				{
+					const unsigned long long len = 1024 * 1024;
+					unsigned long long first = rng() % (file_size - len);
+					req << "Range: bytes=" << first << '-'
+						<< first + len - 1 << "\r\n";
+				}
+				req << "\r\n";
+
+				unsigned long long body_len;
+				bench_clock::time_point first_byte;
+				auto t0 = bench_clock::now();
+				if (!conn->request(req.str(), body_len, &first_byte))
+				{
+					++errors;
+					conn.reset(nullptr);
+					continue;
+				}
+				auto t1 = bench_clock::now();
+
+				++requests;
+				bytes += body_len;
+				latencies[t].push_back(
+						std::chrono::duration<double, std::micro>(t1 - t0).count());
+				ttfbs[t].push_back(std::chrono::duration<double, std::micro>(
+							first_byte - t0).count());
+			}
+		});
+	}
+
+	for (std::thread& t : threads)
+		t.join();
+
+	std::vector<double> all, all_ttfb;
+	for (unsigned int t = 0; t < sc.connections; ++t)
+	{
+		all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+		all_ttfb.insert(all_ttfb.end(), ttfbs[t].begin(), ttfbs[t].end());
+	}
+	std::sort(all.begin(), all.end());
+	std::sort(all_ttfb.begin(), all_ttfb.end());
+
+	Result r;
+	r.name = sc.name;
+	r.requests = requests;
+	r.errors = errors;
+	r.bytes = bytes;
+	r.seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+	r.p50_us = percentile(all, 0.50);
+	r.p99_us = percentile(all, 0.99);
+	r.ttfb_p50_us = percentile(all_ttfb, 0.50);
+	return r;
+}
+
+/**
+ * ServerProcess
+ *
+ * A pshs instance started for the duration of a scenario.
+ */
+class ServerProcess
+{
+	pid_t _pid;
+	std::thread _drain;
+
+public:
+	ServerProcess(const char* pshs, const std::string& workdir,
+			unsigned int port, const std::vector<std::string>& args);
+	~ServerProcess();
+};
+
+ServerProcess::ServerProcess(const char* pshs, const std::string& workdir,
+		unsigned int port, const std::vector<std::string>& args)
+{
+	int pipefd[2];
+
+	if (pipe2(pipefd, O_CLOEXEC))
+		throw std::runtime_error("pipe() failed");
+
+	std::vector<std::string> argv_s{pshs, "--no-upnp", "--bind", "127.0.0.1",
+		"--port", std::to_string(port)};
+	argv_s.insert(argv_s.end(), args.begin(), args.end());
+	std::vector<char*> argv;
+	for (std::string& s : argv_s)
+		argv.push_back(&s[0]);
+	argv.push_back(NULL);
+
+	_pid = fork();
+	if (_pid == -1)
+		throw std::runtime_error("fork() failed");
+	if (_pid == 0)
+	{
+		int devnull = open("/dev/null", O_WRONLY);
+		if (chdir(workdir.c_str()))
+			_exit(127);
+		dup2(devnull, 1);
+		dup2(pipefd[1], 2);
+		execv(pshs, argv.data());
+		_exit(127);
+	}
+	close(pipefd[1]);
+
+	/* wait for the server to bind */
+	std::string line;
+	FILE* err = fdopen(pipefd[0], "r");
+	char buf[4096];
+	bool ready = false;
+	while (fgets(buf, sizeof(buf), err))
+	{
+		if (!strncmp(buf, "Bound to", 8))
+		{
+			ready = true;
+			break;
+		}
+	}
+	if (!ready)
+	{
+		fclose(err);
+		throw std::runtime_error("pshs failed to start");
+	}
+
+	/* keep reading stderr so that the server never blocks on it */
+	_drain = std::thread([err]() {
+		char buf[4096];
+		while (fgets(buf, sizeof(buf), err))
+			;
+		fclose(err);
+	});
+}
+
+ServerProcess::~ServerProcess()
+{
+	kill(_pid, SIGTERM);
+	waitpid(_pid, NULL, 0);
+	_drain.join();
+}
+
+/**
+ * free_port
+ *
+ * Returns: a currently unused local TCP port
+ */
+static unsigned int free_port()
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (fd == -1 || bind(fd, reinterpret_cast<struct sockaddr*>(&sin), sizeof(sin))
+			|| getsockname(fd, reinterpret_cast<struct sockaddr*>(&sin), &len))
+		throw std::runtime_error("unable to find a free port");
+	close(fd);
+	return ntohs(sin.sin_port);
+}
+
+/**
+ * write_file
+ * @path: file path
+ * @size: file size
+ *
+ * Create a file with pseudo-random contents.
+ */
+static void write_file(const std::string& path, unsigned long long size)
+{
+	std::ofstream f{path, std::ios::binary | std::ios::trunc};
+	std::mt19937_64 rng{size};
+	std::vector<unsigned long long> block(8192);
+
+	while (size > 0)
+	{
+		for (unsigned long long& v : block)
+			v = rng();
+		size_t len = std::min<unsigned long long>(size,
+				block.size() * sizeof(block[0]));
+		f.write(reinterpret_cast<const char*>(block.data()), len);
+		size -= len;
+	}
+	if (!f)
+		throw std::runtime_error("unable to write " + path);
+}
+
+/**
+ * write_list
+ * @workdir: directory to create files in
+ * @count: number of files
+ *
+ * Create @count empty files and a --files-from list for them.
+ *
+ * Returns: name of the list file
+ */
+static std::string write_list(const std::string& workdir, unsigned int count)
+{
+	std::string list_name = "list-" + std::to_string(count);
+	std::ofstream list{workdir + '/' + list_name};
+
+	mkdir((workdir + "/idx").c_str(), 0700);
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		std::string name = "idx/file-" + std::to_string(i);
+		int fd = open((workdir + '/' + name).c_str(),
+				O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+		if (fd == -1)
+			throw std::runtime_error("unable to create " + name);
+		close(fd);
+		list << name << '\n';
+	}
+	return list_name;
+}
+
+static int remove_cb(const char* path, const struct stat* st, int flag,
+		struct FTW* ftw)
+{
+	return remove(path);
+}
+
+/**
+ * print_json
+ * @os: output stream
+ * @results: scenario results
+ *
+ * Write results as JSON, one scenario per line so that baselines can be
+ * read back without a full JSON parser.
+ */
+static void print_json(std::ostream& os, const std::vector<Result>& results)
+{
+	os << "{\"version\": \"" PACKAGE_VERSION "\", \"scenarios\": [\n"
+		<< std::fixed << std::setprecision(2);
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const Result& r = results[i];
+		os << "  {\"name\": \"" << r.name << "\""
+			<< ", \"requests\": " << r.requests
+			<< ", \"errors\": " << r.errors
+			<< ", \"seconds\": " << r.seconds
+			<< ", \"rps\": " << r.rps()
+			<< ", \"throughput_mib_s\": " << r.mib_s()
+			<< ", \"latency_p50_us\": " << r.p50_us
+			<< ", \"latency_p99_us\": " << r.p99_us
+			<< ", \"ttfb_p50_us\": " << r.ttfb_p50_us
+			<< '}' << (i + 1 < results.size() ? "," : "") << '\n';
+	}
+	os << "]}\n";
+}
+
+/**
+ * json_number
+ * @line: JSON text
+ * @key: key to find
+ *
+ * Returns: numeric value of @key in @line, or -1 if not found
+ */
+static double json_number(const std::string& line, const char* key)
+{
+	std::string pat = std::string("\"") + key + "\": ";
+	size_t pos = line.find(pat);
+	if (pos == std::string::npos)
+		return -1;
+	return strtod(&line[pos + pat.size()], NULL);
+}
+
+/**
+ * compare
+ * @baseline_path: path to a baseline JSON written by this program
+ * @results: current results
+ * @threshold: allowed regression, in percent
+ *
+ * Compare results against the baseline and report regressions.
+ *
+ * Returns: number of regressions found
+ */
+static int compare(const char* baseline_path, const std::vector<Result>& results,
+		double threshold)
+{
+	std::ifstream f{baseline_path};
+	std::string line;
+	int regressions = 0;
+
+	if (!f)
+		throw std::runtime_error(std::string("unable to read ") + baseline_path);
+
+	while (std::getline(f, line))
+	{
+		size_t pos = line.find("\"name\": \"");
+		if (pos == std::string::npos)
+			continue;
+		pos += 9;
+		std::string name = line.substr(pos, line.find('"', pos) - pos);
+
+		for (const Result& r : results)
+		{
+			if (r.name != name)
+				continue;
+
+			struct
+			{
+				const char* key;
+				double now;
+				bool higher_is_better;
+			} metrics[] = {
+				{ "rps", r.rps(), true },
+				{ "throughput_mib_s", r.mib_s(), true },
+				{ "latency_p50_us", r.p50_us, false },
+				{ "latency_p99_us", r.p99_us, false },
+			};
+
+			for (const auto& m : metrics)
+			{
+				double base = json_number(line, m.key);
+				if (base <= 0)
+					continue;
+
+				double change = (m.now - base) / base * 100;
+				bool regressed = m.higher_is_better
+					? change < -threshold : change > threshold;
+				std::cerr << std::left << std::setw(16) << name << ' '
+					<< std::setw(18) << m.key << std::right << std::fixed
+					<< std::setprecision(2) << std::setw(12) << base << " -> "
+					<< std::setw(12) << m.now << " (" << std::showpos
+					<< change << std::noshowpos << "%)"
+					<< (regressed ? "  REGRESSION" : "") << '\n';
+				if (regressed)
+					++regressions;
+			}
+		}
+	}
+
+	return regressions;
+}
+
+const struct option opts[] =
+{
+	{ "help", no_argument, NULL, 'h' },
+	{ "pshs", required_argument, NULL, 'x' },
+	{ "duration", required_argument, NULL, 'd' },
+	{ "connections", required_argument, NULL, 'c' },
+	{ "scenario", required_argument, NULL, 's' },
+	{ "output", required_argument, NULL, 'o' },
+	{ "compare", required_argument, NULL, 'C' },
+	{ "threshold", required_argument, NULL, 't' },
+	{ "workdir", required_argument, NULL, 'w' },
+
+	{ 0, 0, 0, 0 }
+};
+
+const char opt_help[] =
+"Options:\n"
+"    --pshs PATH, -x PATH       pshs executable to benchmark\n"
+"    --duration S, -d S         run each scenario for S seconds (default: 5)\n"
+"    --connections N, -c N      concurrent keep-alive connections\n"
+"                               (default: 8)\n"
+"    --scenario NAME, -s NAME   run only scenarios with NAME prefix\n"
+"    --output FILE, -o FILE     write JSON results to FILE (default: stdout)\n"
+"    --compare FILE, -C FILE    compare against baseline JSON in FILE\n"
+"    --threshold PCT, -t PCT    allowed regression in percent (default: 10)\n"
+"    --workdir DIR, -w DIR      create test files in DIR (default: temporary)\n";
+
+int main(int argc, char* argv[])
+{
+	int opt;
+	const char* pshs = NULL;
+	double duration = 5;
+	unsigned int connections = 8;
+	const char* only = NULL;
+	const char* output = NULL;
+	const char* baseline = NULL;
+	double threshold = 10;
+	std::string workdir;
+
+	while ((opt = getopt_long(argc, argv, "hx:d:c:s:o:C:t:w:", opts, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 'x': pshs = optarg; break;
+			case 'd': duration = atof(optarg); break;
+			case 'c': connections = atoi(optarg); break;
+			case 's': only = optarg; break;
+			case 'o': output = optarg; break;
+			case 'C': baseline = optarg; break;
+			case 't': threshold = atof(optarg); break;
+			case 'w': workdir = optarg; break;
+			default:
+				std::cerr << "Usage: " << argv[0] << " --pshs PATH [options]\n\n"
+					<< opt_help;
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!pshs || duration <= 0 || !connections)
+	{
+		std::cerr << "Usage: " << argv[0] << " --pshs PATH [options]\n\n"
+			<< opt_help;
+		return 1;
+	}
+
+	/* relative to the server's working directory */
+	char* pshs_abs = realpath(pshs, NULL);
+	if (!pshs_abs)
+	{
+		std::cerr << "Unable to find " << pshs << ": " << strerror(errno) << '\n';
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	bool own_workdir = workdir.empty();
+	if (own_workdir)
+	{
+		char tmpl[] = "/tmp/pshs-bench.XXXXXX";
+		if (!mkdtemp(tmpl))
+		{
+			std::cerr << "mkdtemp() failed: " << strerror(errno) << '\n';
+			return 1;
+		}
+		workdir = tmpl;
+	}
+
+	const unsigned long long large_size = 64 * 1024 * 1024;
+	std::vector<Scenario> scenarios{
+		{ "small-file", {"small"}, {"small"}, false, false, connections },
+		{ "large-file", {"large"}, {"large"}, false, false, 2 },
+		{ "range", {"large"}, {"large"}, true, false, connections },
+		{ "index-10", {}, {""}, false, false, connections },
+		{ "index-10k", {}, {""}, false, false, connections },
+		{ "index-100k", {}, {""}, false, false, 2 },
+#ifdef HAVE_LIBSSL
+		{ "ssl-small-file", {"--ssl", "small"}, {"small"}, false, true,
+			connections },
+		{ "ssl-large-file", {"--ssl", "large"}, {"large"}, false, true, 2 },
+		/* fixed full-size records, for comparison with dynamic sizing */
+		{ "ssl-small-file-16k", {"--ssl", "--ssl-record-size", "16384", "small"},
+			{"small"}, false, true, connections },
+		{ "ssl-large-file-16k", {"--ssl", "--ssl-record-size", "16384", "large"},
+			{"large"}, false, true, 2 },
+#endif
+	};
+	const std::map<std::string, unsigned int> index_sizes{
+		{ "index-10", 10 }, { "index-10k", 10000 }, { "index-100k", 100000 },
+	};
+
+	std::vector<Result> results;
+	try
+	{
+		write_file(workdir + "/small", 4096);
+		write_file(workdir + "/large", large_size);
+
+		for (Scenario& sc : scenarios)
+		{
+			if (only && sc.name.compare(0, strlen(only), only))
+				continue;
+
+			auto idx = index_sizes.find(sc.name);
+			if (idx != index_sizes.end())
+			{
+				sc.args.push_back("--files-from");
+				sc.args.push_back(write_list(workdir, idx->second));
+			}
+
+			std::cerr << "Running " << sc.name << "..." << std::endl;
+			unsigned int port = free_port();
+			ServerProcess server{pshs_abs, workdir, port, sc.args};
+			results.push_back(run_load(sc, port, duration, large_size));
+		}
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << "Benchmark failed: " << e.what() << '\n';
+		return 1;
+	}
+
+	if (own_workdir && nftw(workdir.c_str(), remove_cb, 16, FTW_DEPTH | FTW_PHYS))
+		std::cerr << "Unable to remove " << workdir << '\n';
+	free(pshs_abs);
+
+	if (output)
+	{
+		std::ofstream f{output};
+		print_json(f, results);
+	}
+	else
+		print_json(std::cout, results);
+
+	if (baseline)
+	{
+		int regressions = compare(baseline, results, threshold);
+		if (regressions)
+		{
+			std::cerr << regressions << " regression(s) above " << threshold
+				<< "%.\n";
+			return 2;
+		}
+	}
+
+	return 0;
+}
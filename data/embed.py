@@ -0,0 +1,35 @@
+#!/usr/bin/env python3
+# pshs -- embed a file in the program as a byte array
+# (c) 2026 pshs contributors
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# usage: embed.py INPUT OUTPUT NAME
+#
+# Write a C++ source defining NAME (the contents of INPUT, writable and
+# 8-byte aligned as libmagic needs it) and NAME_size.
+
+import os.path
+import sys
+
+
+def main(argv):
+    src, out, name = argv[1:]
+    with open(src, 'rb') as f:
+        data = f.read()
+
+    with open(out, 'w') as f:
+        f.write('/* generated by embed.py from %s */\n\n'
+                % os.path.basename(src))
+        f.write('#include <stddef.h>\n\n')
+        f.write('extern unsigned char %s[];\n' % name)
+        f.write('extern const size_t %s_size;\n\n' % name)
+        f.write('alignas(8) unsigned char %s[] = {\n' % name)
+        for i in range(0, len(data), 12):
+            f.write('\t%s,\n' % ', '.join('0x%02x' % b
+                                         for b in data[i:i + 12]))
+        f.write('};\n')
+        f.write('const size_t %s_size = sizeof(%s);\n' % (name, name))
+
+
+if __name__ == '__main__':
+    main(sys.argv)
@@ -0,0 +1,803 @@
+/* pshs -- serving members of tar and zip archives
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "archive.h"
+
+/* member names are stored in arena chunks of this size */
+static const size_t name_chunk_size = 1024 * 1024;
+
+/* headers are read in blocks of this size, so that the index of an
+ * archive of small members is loaded with few reads */
+static const size_t read_block_size = 64 * 1024;
+
+/* pax extended headers larger than that are not believed */
+static const size_t max_pax_size = 1024 * 1024;
+
+/**
+ * BlockReader
+ *
+ * Reads small parts of a file at increasing offsets, through a buffer.
+ */
+class BlockReader
+{
+	int _fd;
+	off_t _size;
+	std::vector<char> _buf;
+	/* part of the file in the buffer */
+	off_t _start;
+	size_t _len;
+
+public:
+	/* errno of the last failed read, 0 if it hit the end of file */
+	int error;
+
+	BlockReader(int fd, off_t size)
+		: _fd(fd), _size(size), _buf(read_block_size), _start(0), _len(0),
+		error(0)
+	{
+	}
+
+	const char* at(off_t offset, size_t len);
+};
+
+/**
+ * BlockReader::at
+ * @offset: offset in the file
+ * @len: number of bytes needed
+ *
+ * Returns: pointer to @len bytes at @offset, valid till the next call,
+ * or %NULL if they can not be read
+ */
+const char* BlockReader::at(off_t offset, size_t len)
+{
+	if (offset < 0 || offset > _size
+			|| len > static_cast<size_t>(_size - offset))
+	{
+		error = 0;
+		return NULL;
+	}
+	if (offset >= _start && offset + static_cast<off_t>(len)
+			<= _start + static_cast<off_t>(_len))
+		return &_buf[offset - _start];
+
+	if (len > _buf.size())
+		_buf.resize(len);
+
+	size_t want = std::min(static_cast<off_t>(_buf.size()), _size - offset);
+	size_t got = 0;
+	while (got < want)
+	{
+		ssize_t rd = pread(_fd, &_buf[got], want - got, offset + got);
+		if (rd == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			error = errno;
+			_len = 0;
+			return NULL;
+		}
+		if (rd == 0)
+			break;
+		got += rd;
+	}
+
+	_start = offset;
+	_len = got;
+	if (got < len)
+	{
+		error = 0;
+		return NULL;
+	}
+	return _buf.data();
+}
+
+static uint16_t le16(const char* p)
+{
+	const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+	return u[0] | u[1] << 8;
+}
+
+static uint32_t le32(const char* p)
+{
+	return le16(p) | static_cast<uint32_t>(le16(p + 2)) << 16;
+}
+
+static uint64_t le64(const char* p)
+{
+	return le32(p) | static_cast<uint64_t>(le32(p + 4)) << 32;
+}
+
+/**
+ * read_error
+ * @path: archive path
+ * @reader: the reader that failed
+ * @offset: offset of the failed read
+ *
+ * Report a failure to read the archive.
+ *
+ * Returns: false
+ */
+static bool read_error(const char* path, const BlockReader& reader,
+		off_t offset)
+{
+	std::cerr << "Unable to read archive " << path << " at offset "
+		<< offset << ": " << (reader.error ? strerror(reader.error)
+				: "unexpected end of file") << std::endl;
+	return false;
+}
+
+/**
+ * corrupt
+ * @path: archive path
+ * @offset: offset of the bad header
+ * @what: what is wrong with it
+ *
+ * Report a broken archive.
+ *
+ * Returns: false
+ */
+static bool corrupt(const char* path, off_t offset, const char* what)
+{
+	std::cerr << "Unable to index archive " << path << ": " << what
+		<< " at offset " << offset << std::endl;
+	return false;
+}
+
+ArchiveIndex::ArchiveIndex()
+	: _chunk_used(0), _chunk_size(0)
+{
+}
+
+/**
+ * ArchiveIndex::~ArchiveIndex
+ *
+ * Close the archives.
+ */
+ArchiveIndex::~ArchiveIndex()
+{
+	for (Archive& a : _archives)
+		close(a.fd);
+}
+
+/**
+ * ArchiveIndex::store
+ * @name: the name, not necessarily null-terminated
+ * @len: its length
+ *
+ * Copy @name into the arena.
+ *
+ * Returns: the null-terminated copy
+ */
+const char* ArchiveIndex::store(const char* name, size_t len)
+{
+	if (_chunk_size - _chunk_used < len + 1)
+	{
+		_chunk_size = std::max(name_chunk_size, len + 1);
+		_chunks.emplace_back(new char[_chunk_size]);
+		_chunk_used = 0;
+	}
+
+	char* copy = _chunks.back().get() + _chunk_used;
+	memcpy(copy, name, len);
+	copy[len] = '\0';
+	_chunk_used += len + 1;
+	return copy;
+}
+
+/**
+ * ArchiveIndex::add_member
+ * @name: member path in the archive, not necessarily null-terminated
+ * @len: length of @name
+ * @offset: offset of the contents in the archive
+ * @size: size of the contents
+ * @mtime: modification time
+ *
+ * Add a member of the archive being loaded. Leading / and ./ are removed
+ * from the name, like tar does when extracting, and names of directories
+ * are skipped.
+ */
+void ArchiveIndex::add_member(const char* name, size_t len, off_t offset,
+		off_t size, time_t mtime)
+{
+	for (;;)
+	{
+		if (len >= 1 && name[0] == '/')
+			++name, --len;
+		else if (len >= 2 && name[0] == '.' && name[1] == '/')
+			name += 2, len -= 2;
+		else
+			break;
+	}
+	if (!len || name[len - 1] == '/')
+		return;
+
+	_members.push_back(ArchiveMember{store(name, len), offset, size, mtime,
+			NULL, static_cast<uint32_t>(_archives.size())});
+}
+
+/**
+ * tar_number
+ * @field: numeric header field
+ * @len: field length
+ * @out: location to store the value
+ *
+ * Parse a numeric tar header field, either octal or base-256 (used by
+ * GNU tar for sizes over 8 GiB).
+ *
+ * Returns: true on success, false if the field is malformed or negative
+ */
+static bool tar_number(const char* field, size_t len, uint64_t& out)
+{
+	const unsigned char* p = reinterpret_cast<const unsigned char*>(field);
+	size_t i = 0;
+
+	out = 0;
+	if (p[0] & 0x80)
+	{
+		if (p[0] & 0x40)
+			return false;
+		out = p[0] & 0x3f;
+		for (i = 1; i < len; ++i)
+		{
+			if (out >> 56)
+				return false;
+			out = out << 8 | p[i];
+		}
+		return true;
+	}
+
+	while (i < len && p[i] == ' ')
+		++i;
+	for (; i < len && p[i] >= '0' && p[i] <= '7'; ++i)
+	{
+		if (out >> 60)
+			return false;
+		out = out << 3 | (p[i] - '0');
+	}
+	return i == len || p[i] == ' ' || p[i] == '\0';
+}
+
+/**
+ * tar_checksum_ok
+ * @h: 512-byte header
+ *
+ * Returns: true if the header checksum matches, either the standard one
+ * or the one of old tars summing signed chars
+ */
+static bool tar_checksum_ok(const char* h)
+{
+	uint64_t expected;
+	long sum = 0;
+	long signed_sum = 0;
+
+	if (!tar_number(h + 148, 8, expected))
+		return false;
+	for (int i = 0; i < 512; ++i)
+	{
+		char c = i >= 148 && i < 156 ? ' ' : h[i];
+		sum += static_cast<unsigned char>(c);
+		signed_sum += static_cast<signed char>(c);
+	}
+	return expected == static_cast<uint64_t>(sum)
+		|| expected == static_cast<uint64_t>(signed_sum);
+}
+
+/* overrides set by GNU long name and pax extended headers, applying to
+ * the next member */
+struct TarOverrides
+{
+	std::string name;
+	bool have_name;
+	uint64_t size;
+	bool have_size;
+	int64_t mtime;
+	bool have_mtime;
+
+	TarOverrides() { clear(); }
+
+	void clear()
+	{
+		have_name = have_size = have_mtime = false;
+	}
+};
+
+/**
+ * parse_pax
+ * @data: extended header contents
+ * @len: its length
+ * @ov: overrides to update
+ *
+ * Parse pax extended header records ("LEN KEY=VALUE\n"), taking the path,
+ * size and mtime.
+ *
+ * Returns: true on success, false if the records are malformed
+ */
+static bool parse_pax(const char* data, size_t len, TarOverrides& ov)
+{
+	while (len)
+	{
+		char* end;
+		unsigned long rec_len = strtoul(data, &end, 10);
+
+		if (end == data || *end != ' ' || rec_len > len
+				|| rec_len <= static_cast<size_t>(end - data) + 1
+				|| data[rec_len - 1] != '\n')
+			return false;
+
+		const char* key = end + 1;
+		const char* rec_end = data + rec_len - 1;
+		const char* eq = static_cast<const char*>(
+				memchr(key, '=', rec_end - key));
+		if (!eq)
+			return false;
+
+		std::string value{eq + 1, rec_end};
+		size_t key_len = eq - key;
+		if (key_len == 4 && !memcmp(key, "path", 4))
+		{
+			ov.name = value;
+			ov.have_name = true;
+		}
+		else if (key_len == 4 && !memcmp(key, "size", 4))
+		{
+			ov.size = strtoull(value.c_str(), &end, 10);
+			if (*end || value.empty())
+				return false;
+			ov.have_size = true;
+		}
+		else if (key_len == 5 && !memcmp(key, "mtime", 5))
+		{
+			/* may have a fractional part */
+			ov.mtime = strtoll(value.c_str(), NULL, 10);
+			ov.have_mtime = true;
+		}
+
+		data += rec_len;
+		len -= rec_len;
+	}
+
+	return true;
+}
+
+/**
+ * ArchiveIndex::load_tar
+ * @fd: open archive
+ * @archive_size: its size
+ * @path: its path, for messages
+ *
+ * Index the members of a tar archive, in one pass over its headers.
+ * Regular files are indexed, including names and sizes from GNU and pax
+ * extended headers; links, directories and other special files are
+ * skipped.
+ *
+ * Returns: true on success, false on error (reported to stderr)
+ */
+bool ArchiveIndex::load_tar(int fd, off_t archive_size, const char* path)
+{
+	static const char zero_block[512] = {};
+	BlockReader reader{fd, archive_size};
+	TarOverrides ov;
+	off_t pos = 0;
+
+	for (;;)
+	{
+		/* some writers omit the end-of-archive blocks */
+		if (pos == archive_size)
+			break;
+
+		const char* h = reader.at(pos, 512);
+		if (!h)
+			return read_error(path, reader, pos);
+		if (!memcmp(h, zero_block, 512))
+			break;
+		if (!tar_checksum_ok(h))
+			return corrupt(path, pos, "bad header checksum");
+
+		uint64_t size;
+		if (!tar_number(h + 124, 12, size))
+			return corrupt(path, pos, "bad size");
+
+		char type = h[156];
+		off_t data = pos + 512;
+		/* links, devices, directories and FIFOs have no contents */
+		if (type >= '1' && type <= '6')
+			size = 0;
+		else if (ov.have_size && type != 'L' && type != 'x' && type != 'K'
+				&& type != 'g')
+			size = ov.size;
+		if (size > static_cast<uint64_t>(archive_size - data))
+			return read_error(path, reader, data);
+		off_t next = data + ((size + 511) & ~static_cast<uint64_t>(511));
+
+		switch (type)
+		{
+			case 'L': /* GNU long name */
+			case 'x': /* pax extended header */
+			{
+				if (size > max_pax_size)
+					return corrupt(path, pos, "oversized extended header");
+				const char* ext = reader.at(data, size);
+				if (!ext)
+					return read_error(path, reader, data);
+
+				if (type == 'L')
+				{
+					ov.name.assign(ext, strnlen(ext, size));
+					ov.have_name = true;
+				}
+				else if (!parse_pax(ext, size, ov))
+					return corrupt(path, pos, "malformed pax header");
+				pos = next;
+				continue;
+			}
+			case 'K': /* GNU long link name */
+			case 'g': /* pax global header */
+				pos = next;
+				continue;
+			case '0':
+			case '\0':
+			case '7':
+			{
+				time_t mtime;
+				uint64_t value;
+				if (ov.have_mtime)
+					mtime = ov.mtime;
+				else if (tar_number(h + 136, 12, value))
+					mtime = value;
+				else
+					mtime = 0;
+
+				if (ov.have_name)
+					add_member(ov.name.data(), ov.name.size(), data, size,
+							mtime);
+				else
+				{
+					char name[256];
+					size_t len = 0;
+					/* ustar keeps long paths split in two */
+					if (!memcmp(h + 257, "ustar", 6) && h[345])
+					{
+						len = strnlen(h + 345, 155);
+						memcpy(name, h + 345, len);
+						name[len++] = '/';
+					}
+					size_t base_len = strnlen(h, 100);
+					memcpy(name + len, h, base_len);
+					add_member(name, len + base_len, data, size, mtime);
+				}
+				break;
+			}
+		}
+
+		ov.clear();
+		pos = next;
+	}
+
+	return true;
+}
+
+/**
+ * dos_time
+ * @date: MS-DOS date
+ * @time: MS-DOS time
+ *
+ * Returns: the (local) time as time_t
+ */
+static time_t dos_time(uint16_t date, uint16_t time)
+{
+	struct tm tm = {};
+
+	tm.tm_year = (date >> 9) + 80;
+	tm.tm_mon = ((date >> 5) & 0x0f) - 1;
+	tm.tm_mday = date & 0x1f;
+	tm.tm_hour = time >> 11;
+	tm.tm_min = (time >> 5) & 0x3f;
+	tm.tm_sec = (time & 0x1f) * 2;
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+/**
+ * ArchiveIndex::load_zip
+ * @fd: open archive
+ * @archive_size: its size
+ * @path: its path, for messages
+ *
+ * Index the stored (uncompressed) members of a zip archive, including
+ * zip64 ones. The central directory is read in one pass, and then local
+ * headers (to find where the contents start) in the order of offsets.
+ * Compressed and encrypted members are skipped.
+ *
+ * Returns: true on success, false on error (reported to stderr)
+ */
+bool ArchiveIndex::load_zip(int fd, off_t archive_size, const char* path)
+{
+	BlockReader reader{fd, archive_size};
+
+	/* end of central directory record, followed by up to 64 KiB
+	 * of comment */
+	size_t tail = std::min(archive_size, static_cast<off_t>(22 + 0xffff));
+	off_t tail_start = archive_size - tail;
+	const char* buf = reader.at(tail_start, tail);
+	if (!buf)
+		return read_error(path, reader, tail_start);
+
+	ssize_t eocd = -1;
+	for (ssize_t i = tail - 22; i >= 0; --i)
+	{
+		if (!memcmp(buf + i, "PK\5\6", 4)
+				&& i + 22 + le16(buf + i + 20) <= static_cast<ssize_t>(tail))
+		{
+			eocd = i;
+			break;
+		}
+	}
+	if (eocd == -1)
+		return corrupt(path, archive_size, "no end of central directory");
+
+	const char* e = buf + eocd;
+	if (le16(e + 4) != 0 && le16(e + 4) != 0xffff)
+		return corrupt(path, tail_start + eocd, "multi-volume archive");
+	uint64_t entries = le16(e + 10);
+	uint64_t cd_size = le32(e + 12);
+	uint64_t cd_offset = le32(e + 16);
+
+	if (entries == 0xffff || cd_size == 0xffffffff || cd_offset == 0xffffffff)
+	{
+		off_t locator = tail_start + eocd - 20;
+		const char* l = reader.at(locator, 20);
+		if (!l || memcmp(l, "PK\6\7", 4))
+			return corrupt(path, locator, "no zip64 end of central directory");
+
+		off_t z64 = le64(l + 8);
+		const char* z = reader.at(z64, 56);
+		if (!z || memcmp(z, "PK\6\6", 4))
+			return corrupt(path, z64, "bad zip64 end of central directory");
+		entries = le64(z + 32);
+		cd_size = le64(z + 40);
+		cd_offset = le64(z + 48);
+	}
+	if (cd_offset > static_cast<uint64_t>(archive_size)
+			|| cd_size > static_cast<uint64_t>(archive_size) - cd_offset)
+		return corrupt(path, tail_start + eocd, "bad central directory");
+
+	const size_t first = _members.size();
+	size_t skipped = 0;
+	off_t pos = cd_offset;
+	for (uint64_t n = 0; n < entries; ++n)
+	{
+		const char* c = reader.at(pos, 46);
+		if (!c)
+			return read_error(path, reader, pos);
+		if (memcmp(c, "PK\1\2", 4))
+			return corrupt(path, pos, "bad central directory entry");
+
+		uint16_t flags = le16(c + 8);
+		uint16_t method = le16(c + 10);
+		time_t mtime = dos_time(le16(c + 14), le16(c + 12));
+		uint64_t csize = le32(c + 20);
+		uint64_t usize = le32(c + 24);
+		uint16_t name_len = le16(c + 28);
+		uint16_t extra_len = le16(c + 30);
+		uint16_t comment_len = le16(c + 32);
+		uint64_t local = le32(c + 42);
+
+		const char* name = reader.at(pos + 46, name_len + extra_len);
+		if (!name)
+			return read_error(path, reader, pos + 46);
+
+		/* zip64 sizes and offset, and the Unix modification time */
+		for (const char* x = name + name_len;
+				x + 4 <= name + name_len + extra_len;
+				x += 4 + le16(x + 2))
+		{
+			uint16_t id = le16(x);
+			uint16_t len = le16(x + 2);
+			const char* v = x + 4;
+			const char* v_end = std::min(v + len, name + name_len + extra_len);
+
+			if (id == 0x0001)
+			{
+				if (usize == 0xffffffff && v + 8 <= v_end)
+					usize = le64(v), v += 8;
+				if (csize == 0xffffffff && v + 8 <= v_end)
+					csize = le64(v), v += 8;
+				if (local == 0xffffffff && v + 8 <= v_end)
+					local = le64(v);
+			}
+			else if (id == 0x5455 && v + 5 <= v_end && (v[0] & 1))
+				mtime = static_cast<int32_t>(le32(v + 1));
+		}
+
+		if (method != 0 || (flags & 1) || csize != usize)
+			++skipped;
+		else
+			/* the offset of the local header, for now */
+			add_member(name, name_len, local, usize, mtime);
+
+		pos += 46 + name_len + extra_len + comment_len;
+	}
+
+	/* find where the contents start */
+	std::sort(_members.begin() + first, _members.end(),
+			[](const ArchiveMember& a, const ArchiveMember& b) {
+				return a.offset < b.offset;
+			});
+	for (size_t i = first; i < _members.size(); ++i)
+	{
+		ArchiveMember& m = _members[i];
+		const char* h = reader.at(m.offset, 30);
+		if (!h)
+			return read_error(path, reader, m.offset);
+		if (memcmp(h, "PK\3\4", 4))
+			return corrupt(path, m.offset, "bad local header");
+
+		m.offset += 30 + le16(h + 26) + le16(h + 28);
+		/* the name and extra field may run past the end already */
+		if (m.offset > archive_size || m.size < 0
+				|| static_cast<uint64_t>(m.size)
+					> static_cast<uint64_t>(archive_size - m.offset))
+			return read_error(path, reader, m.offset);
+	}
+
+	if (skipped)
+		std::cerr << "Skipping " << skipped << " compressed or encrypted "
+			"members of " << path << '.' << std::endl;
+	return true;
+}
+
+/**
+ * ArchiveIndex::add
+ * @path: path to a tar or zip archive
+ *
+ * Index the members of the archive at @path and keep it open to serve
+ * them. Only uncompressed archives can be served: tar archives, and zip
+ * archives with stored members.
+ *
+ * Returns: true on success, false on error (reported to stderr)
+ */
+bool ArchiveIndex::add(const char* path)
+{
+	int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+
+	if (fd == -1)
+	{
+		std::cerr << "Unable to open archive " << path << ": "
+			<< strerror(errno) << std::endl;
+		return false;
+	}
+	if (fstat(fd, &st))
+	{
+		std::cerr << "fstat() failed for " << path << ": "
+			<< strerror(errno) << std::endl;
+		close(fd);
+		return false;
+	}
+	if (!S_ISREG(st.st_mode))
+	{
+		std::cerr << "Archive " << path << " is not a regular file"
+			<< std::endl;
+		close(fd);
+		return false;
+	}
+
+	char magic[512];
+	ssize_t rd = pread(fd, magic, sizeof(magic), 0);
+	const size_t first = _members.size();
+	bool ret;
+
+	if (rd >= 4 && (!memcmp(magic, "PK\3\4", 4) || !memcmp(magic, "PK\5\6", 4)))
+		ret = load_zip(fd, st.st_size, path);
+	else if (rd == sizeof(magic) && tar_checksum_ok(magic))
+		ret = load_tar(fd, st.st_size, path);
+	else
+	{
+		std::cerr << "Archive " << path << " is neither a tar nor a zip "
+			"archive (compressed tar archives can not be served)"
+			<< std::endl;
+		ret = false;
+	}
+
+	if (!ret)
+	{
+		_members.resize(first);
+		close(fd);
+		return false;
+	}
+
+	_archives.push_back(Archive{path, fd, FileKey{st}});
+	return true;
+}
+
+/**
+ * ArchiveIndex::finish
+ *
+ * Sort the members by name once all archives are added. Of members with
+ * the same name, the last one is kept, like tar does when extracting.
+ */
+void ArchiveIndex::finish()
+{
+	std::stable_sort(_members.begin(), _members.end(),
+			[](const ArchiveMember& a, const ArchiveMember& b) {
+				return strcmp(a.name, b.name) < 0;
+			});
+
+	size_t out = 0;
+	for (size_t i = 0; i < _members.size(); ++i)
+	{
+		if (out && !strcmp(_members[out - 1].name, _members[i].name))
+			--out;
+		_members[out++] = _members[i];
+	}
+	_members.resize(out);
+}
+
+/**
+ * ArchiveIndex::find
+ * @name: requested path
+ *
+ * Returns: the member called @name, or %NULL if there is none
+ */
+ArchiveMember* ArchiveIndex::find(const char* name)
+{
+	auto it = std::lower_bound(_members.begin(), _members.end(), name,
+			[](const ArchiveMember& m, const char* n) {
+				return strcmp(m.name, n) < 0;
+			});
+
+	if (it == _members.end() || strcmp(it->name, name))
+		return NULL;
+	return &*it;
+}
+
+/**
+ * ArchiveIndex::open
+ * @member: the member
+ * @st: location to store the stat of the archive
+ *
+ * Get a descriptor to send the member from. The archive is checked not
+ * to have changed since it was indexed, since the offsets would no longer
+ * be right.
+ *
+ * Returns: new descriptor of the archive, or -1 on error (reported
+ * to stderr)
+ */
+int ArchiveIndex::open(const ArchiveMember& member, struct stat& st) const
+{
+	const Archive& a = _archives[member.archive];
+
+	if (fstat(a.fd, &st))
+	{
+		std::cerr << "fstat() failed for " << a.path << ": "
+			<< strerror(errno) << std::endl;
+		return -1;
+	}
+	if (!(FileKey{st} == a.key))
+	{
+		std::cerr << "Archive " << a.path << " changed since it was "
+			"indexed, unable to serve " << member.name << std::endl;
+		return -1;
+	}
+
+	int fd = fcntl(a.fd, F_DUPFD_CLOEXEC, 0);
+	if (fd == -1)
+		std::cerr << "dup() failed for " << a.path << ": "
+			<< strerror(errno) << std::endl;
+	return fd;
+}
@@ -0,0 +1,76 @@
+/* pshs -- serving members of tar and zip archives
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+#ifndef _PSHS_ARCHIVE_H
+#define _PSHS_ARCHIVE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "digest.h"
+
+struct ArchiveMember
+{
+	const char* name;
+	/* offset of the contents in the archive */
+	off_t offset;
+	off_t size;
+	time_t mtime;
+	/* guessed Content-Type, NULL until the member is first requested */
+	const char* type;
+	/* index of the archive in ArchiveIndex */
+	uint32_t archive;
+};
+
+class ArchiveIndex
+{
+	struct Archive
+	{
+		std::string path;
+		int fd;
+		/* the archive as indexed, members are valid as long as it
+		 * does not change */
+		FileKey key;
+	};
+
+	std::vector<Archive> _archives;
+	/* sorted by name */
+	std::vector<ArchiveMember> _members;
+	/* arena holding member names */
+	std::vector<std::unique_ptr<char[]>> _chunks;
+	size_t _chunk_used;
+	size_t _chunk_size;
+
+	const char* store(const char* name, size_t len);
+	void add_member(const char* name, size_t len, off_t offset, off_t size,
+			time_t mtime);
+	bool load_tar(int fd, off_t archive_size, const char* path);
+	bool load_zip(int fd, off_t archive_size, const char* path);
+
+public:
+	ArchiveIndex();
+	~ArchiveIndex();
+
+	bool add(const char* path);
+	void finish();
+
+	ArchiveMember* find(const char* name);
+	int open(const ArchiveMember& member, struct stat& st) const;
+
+	bool empty() const { return _members.empty(); }
+	size_t size() const { return _members.size(); }
+	size_t archives() const { return _archives.size(); }
+	const std::vector<ArchiveMember>& members() const { return _members; }
+};
+
+#endif /*_PSHS_ARCHIVE_H*/
@@ -0,0 +1,526 @@
+/* pshs -- redirecting to less loaded instances
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <iostream>
+#include <stdexcept>
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <netinet/in.h>
+
+#include <event2/util.h>
+
+#include "archive.h"
+#include "cluster.h"
+
+/* seconds between load reports */
+static const int report_interval = 1;
+/* a node that missed that many reports is gone */
+static const int missed_reports = 3;
+/* the set of instances is small */
+static const size_t max_nodes = 64;
+
+static const char report_magic[] = "pshs-cluster 1";
+
+/**
+ * hash_str
+ * @str: string
+ *
+ * Returns: 64-bit FNV-1a hash of @str
+ */
+static uint64_t hash_str(const char* str)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (; *str; ++str)
+	{
+		h ^= static_cast<unsigned char>(*str);
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/**
+ * same_address
+ * @a: address
+ * @b: address
+ *
+ * Returns: true if @a and @b are the same IP address and port
+ */
+static bool same_address(const struct sockaddr_storage& a,
+		const struct sockaddr_storage& b)
+{
+	if (a.ss_family != b.ss_family)
+		return false;
+	if (a.ss_family == AF_INET)
+	{
+		const struct sockaddr_in* x =
+			reinterpret_cast<const struct sockaddr_in*>(&a);
+		const struct sockaddr_in* y =
+			reinterpret_cast<const struct sockaddr_in*>(&b);
+
+		return x->sin_port == y->sin_port
+			&& x->sin_addr.s_addr == y->sin_addr.s_addr;
+	}
+	if (a.ss_family == AF_INET6)
+	{
+		const struct sockaddr_in6* x =
+			reinterpret_cast<const struct sockaddr_in6*>(&a);
+		const struct sockaddr_in6* y =
+			reinterpret_cast<const struct sockaddr_in6*>(&b);
+
+		return x->sin6_port == y->sin6_port
+			&& !memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(x->sin6_addr));
+	}
+	return false;
+}
+
+/**
+ * valid_url
+ * @url: URL from a report
+ *
+ * Check that @url is a plain http(s) URL, safe to send in the Location
+ * header.
+ *
+ * Returns: true if it is
+ */
+static bool valid_url(const std::string& url)
+{
+	size_t host;
+
+	if (!url.compare(0, 7, "http://"))
+		host = 7;
+	else if (!url.compare(0, 8, "https://"))
+		host = 8;
+	else
+		return false;
+	if (url.size() == host || url[host] == '/')
+		return false;
+
+	/* no control characters, nor spaces */
+	for (char c : url)
+	{
+		if (static_cast<unsigned char>(c) <= ' ' || c == 0x7f)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * mix
+ * @x: value
+ *
+ * Spread the bits of @x, so that hashes combined by xor are ranked
+ * well (splitmix64 finalizer).
+ *
+ * Returns: mixed value
+ */
+static uint64_t mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+/**
+ * Cluster::Cluster
+ * @evb: the event base
+ * @conns: the connection tracker, the source of the local load
+ * @fd: bound UDP socket, owned by the cluster from now on
+ * @url: URL the files are served at by this instance
+ * @set: fingerprint of the served files
+ * @threshold: number of transfers over which requests are redirected
+ *
+ * Start exchanging the load with the peers added later. Reports from
+ * other addresses are ignored, as are instances serving another set of
+ * files.
+ */
+Cluster::Cluster(struct event_base* evb, const ConnTracker& conns, int fd,
+		const char* url, uint64_t set, unsigned int threshold)
+	: _conns(conns), _fd(fd), _url(url), _set(set), _threshold(threshold),
+	_redirects(0)
+{
+	const struct timeval interval = { report_interval, 0 };
+
+	if (_url.empty() || _url.back() != '/')
+		_url += '/';
+
+	_read_ev = event_new(evb, fd, EV_READ | EV_PERSIST, read_callback, this);
+	_timer = event_new(evb, -1, EV_PERSIST, timer_callback, this);
+	if (!_read_ev || !_timer || event_add(_read_ev, NULL)
+			|| event_add(_timer, &interval))
+		throw std::runtime_error("Unable to set up the cluster events");
+}
+
+/**
+ * Cluster::~Cluster
+ *
+ * Stop exchanging the load, and print the number of redirected requests.
+ */
+Cluster::~Cluster()
+{
+	event_free(_timer);
+	event_free(_read_ev);
+	close(_fd);
+
+	if (_redirects)
+		std::cerr << "Redirected " << _redirects
+			<< " requests to cluster peers." << std::endl;
+}
+
+/**
+ * Cluster::add_peer
+ * @addr: IP address and port of the peer's cluster socket
+ *
+ * Report the load to @addr, and accept its reports. Anyone could send
+ * a report and get requests redirected to any URL, so both sides need
+ * to know each other.
+ *
+ * Returns: true on success, false if @addr is invalid (reported to stderr)
+ */
+bool Cluster::add_peer(const char* addr)
+{
+	Address a = {};
+	struct sockaddr_storage local;
+	socklen_t local_len = sizeof(local);
+	int len = sizeof(a.addr);
+
+	if (evutil_parse_sockaddr_port(addr,
+				reinterpret_cast<struct sockaddr*>(&a.addr), &len)
+			|| !reinterpret_cast<struct sockaddr_in*>(&a.addr)->sin_port)
+	{
+		std::cerr << "Invalid peer address: " << addr << "\n";
+		return false;
+	}
+	a.len = len;
+
+	/* a dual-stack socket reaches IPv4 peers at mapped addresses */
+	if (!getsockname(_fd, reinterpret_cast<struct sockaddr*>(&local),
+				&local_len)
+			&& local.ss_family == AF_INET6 && a.addr.ss_family == AF_INET)
+	{
+		struct sockaddr_in sin;
+		struct sockaddr_in6 sin6 = {};
+
+		memcpy(&sin, &a.addr, sizeof(sin));
+		sin6.sin6_family = AF_INET6;
+		sin6.sin6_port = sin.sin_port;
+		sin6.sin6_addr.s6_addr[10] = 0xff;
+		sin6.sin6_addr.s6_addr[11] = 0xff;
+		memcpy(&sin6.sin6_addr.s6_addr[12], &sin.sin_addr, 4);
+		memcpy(&a.addr, &sin6, sizeof(sin6));
+		a.len = sizeof(sin6);
+	}
+
+	_peers.push_back(a);
+	return true;
+}
+
+/**
+ * Cluster::read_callback
+ * @fd: the socket
+ * @what: unused
+ * @data: the cluster
+ *
+ * Process the reports received.
+ */
+void Cluster::read_callback(evutil_socket_t fd, short what, void* data)
+{
+	Cluster* c = static_cast<Cluster*>(data);
+	char buf[512];
+
+	for (int i = 0; i < 16; ++i)
+	{
+		Address from;
+		from.len = sizeof(from.addr);
+
+		ssize_t rd = recvfrom(fd, buf, sizeof(buf) - 1, 0,
+				reinterpret_cast<struct sockaddr*>(&from.addr), &from.len);
+		if (rd == -1)
+		{
+			if (errno != EAGAIN && errno != EINTR && errno != ECONNREFUSED)
+				std::cerr << "recvfrom() failed on the cluster socket: "
+					<< strerror(errno) << std::endl;
+			break;
+		}
+
+		buf[rd] = 0;
+		c->receive(buf, from);
+	}
+}
+
+/**
+ * Cluster::receive
+ * @msg: the report, null-terminated
+ * @from: address it came from
+ *
+ * Update the load of the node that sent @msg. Reports from addresses
+ * that are not peers are ignored.
+ */
+void Cluster::receive(const char* msg, const Address& from)
+{
+	uint64_t set;
+	unsigned int transfers;
+	double rate;
+	int url_start = 0;
+	bool known = false;
+
+	for (const Address& a : _peers)
+	{
+		if (same_address(a.addr, from.addr))
+		{
+			known = true;
+			break;
+		}
+	}
+	if (!known)
+		return;
+
+	if (strncmp(msg, report_magic, sizeof(report_magic) - 1)
+			|| sscanf(msg + sizeof(report_magic) - 1,
+				" %" SCNx64 " %u %lf %n", &set, &transfers, &rate,
+				&url_start) != 3
+			|| !url_start)
+		return;
+
+	std::string url{msg + sizeof(report_magic) - 1 + url_start};
+	while (!url.empty() && (url.back() == '\n' || url.back() == '\r'))
+		url.pop_back();
+	if (set != _set || url == _url || !valid_url(url))
+		return;
+
+	Node* node = NULL;
+	for (Node& n : _nodes)
+	{
+		if (n.url == url)
+		{
+			node = &n;
+			break;
+		}
+	}
+	if (!node)
+	{
+		if (_nodes.size() >= max_nodes)
+			return;
+		_nodes.push_back(Node{url, hash_str(url.c_str()), 0, 0, 0, 0});
+		node = &_nodes.back();
+		if (!_conns.quiet())
+			std::cerr << "Cluster peer " << url << " joined." << std::endl;
+	}
+
+	node->transfers = transfers;
+	node->rate = rate;
+	node->redirected = 0;
+	node->seen = time(NULL);
+}
+
+/**
+ * Cluster::timer_callback
+ * @fd: unused
+ * @what: unused
+ * @data: the cluster
+ *
+ * Forget the nodes that stopped reporting, and report to the peers.
+ */
+void Cluster::timer_callback(evutil_socket_t fd, short what, void* data)
+{
+	Cluster* c = static_cast<Cluster*>(data);
+	time_t expired = time(NULL) - missed_reports * report_interval;
+
+	for (size_t i = 0; i < c->_nodes.size(); )
+	{
+		if (c->_nodes[i].seen >= expired)
+		{
+			++i;
+			continue;
+		}
+		if (!c->_conns.quiet())
+			std::cerr << "Cluster peer " << c->_nodes[i].url << " left."
+				<< std::endl;
+		c->_nodes[i] = c->_nodes.back();
+		c->_nodes.pop_back();
+	}
+
+	c->report();
+}
+
+/**
+ * Cluster::report
+ *
+ * Send the local load to the peers.
+ */
+void Cluster::report()
+{
+	unsigned int transfers;
+	double rate;
+	char msg[512];
+
+	_conns.load(transfers, rate);
+	int len = snprintf(msg, sizeof(msg), "%s %016" PRIx64 " %u %.0f %s\n",
+			report_magic, _set, transfers, rate, _url.c_str());
+	if (len < 0 || static_cast<size_t>(len) >= sizeof(msg))
+		return;
+
+	/* lost reports are made up for by the next ones */
+	for (const Address& a : _peers)
+		sendto(_fd, msg, len, 0,
+				reinterpret_cast<const struct sockaddr*>(&a.addr), a.len);
+}
+
+/**
+ * Cluster::pick
+ * @path: requested file
+ *
+ * Decide whether the request for @path should be redirected. While the
+ * local load is under the threshold, it is served locally. Otherwise,
+ * it goes to the node ranked first for @path by rendezvous hashing among
+ * the nodes under the threshold, so that each file tends to be sent by
+ * the same node; if all are over it, to the least loaded one, if it is
+ * less loaded than this one.
+ *
+ * Returns: the URL to prepend to @path, or %NULL to serve it locally
+ */
+const char* Cluster::pick(const char* path)
+{
+	unsigned int local;
+	double rate;
+
+	_conns.load(local, rate);
+	if (local < _threshold || _nodes.empty())
+		return NULL;
+
+	uint64_t h = hash_str(path);
+	Node* best = NULL;
+	uint64_t best_score = 0;
+	Node* least = NULL;
+
+	for (Node& n : _nodes)
+	{
+		/* count the requests sent its way since it reported */
+		unsigned int load = n.transfers + n.redirected;
+
+		if (load < _threshold)
+		{
+			uint64_t score = mix(n.id ^ h);
+			if (!best || score > best_score)
+			{
+				best = &n;
+				best_score = score;
+			}
+		}
+		if (!least || load < least->transfers + least->redirected)
+			least = &n;
+	}
+
+	if (!best)
+	{
+		if (least->transfers + least->redirected + 1 >= local)
+			return NULL;
+		best = least;
+	}
+
+	++best->redirected;
+	++_redirects;
+	return best->url.c_str();
+}
+
+/**
+ * cluster_socket
+ * @bindip: address to bind to, or %NULL for any
+ * @port: UDP port
+ *
+ * Create the socket the load is exchanged on.
+ *
+ * Returns: the socket, or -1 on error (reported to stderr)
+ */
+int cluster_socket(const char* bindip, unsigned int port)
+{
+	const char* addrs[] = { bindip, NULL };
+
+	/* try :: first, fall back to 0.0.0.0 */
+	if (!bindip)
+	{
+		addrs[0] = "::";
+		addrs[1] = "0.0.0.0";
+	}
+
+	for (const char* addr : addrs)
+	{
+		struct sockaddr_storage ss = {};
+		struct sockaddr_in* sin = reinterpret_cast<struct sockaddr_in*>(&ss);
+		struct sockaddr_in6* sin6 = reinterpret_cast<struct sockaddr_in6*>(&ss);
+		socklen_t len;
+
+		if (!addr)
+			break;
+		if (evutil_inet_pton(AF_INET6, addr, &sin6->sin6_addr) == 1)
+		{
+			sin6->sin6_family = AF_INET6;
+			sin6->sin6_port = htons(port);
+			len = sizeof(*sin6);
+		}
+		else if (evutil_inet_pton(AF_INET, addr, &sin->sin_addr) == 1)
+		{
+			sin->sin_family = AF_INET;
+			sin->sin_port = htons(port);
+			len = sizeof(*sin);
+		}
+		else
+		{
+			std::cerr << "Invalid cluster address: " << addr << "\n";
+			return -1;
+		}
+
+		int fd = socket(ss.ss_family, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+				0);
+		if (fd == -1)
+		{
+			if (errno == EAFNOSUPPORT && addr != addrs[1] && addrs[1])
+				continue;
+			std::cerr << "socket() failed: " << strerror(errno) << "\n";
+			return -1;
+		}
+		if (!bind(fd, reinterpret_cast<struct sockaddr*>(&ss), len))
+			return fd;
+
+		std::cerr << "Unable to bind cluster socket to " << addr << ':'
+			<< port << ": " << strerror(errno) << "\n";
+		close(fd);
+		return -1;
+	}
+
+	return -1;
+}
+
+/**
+ * cluster_fingerprint
+ * @files: null-terminated served file list
+ * @archives: served archives, or %NULL
+ *
+ * Returns: value identifying the set of served paths, whatever their order
+ */
+uint64_t cluster_fingerprint(char* const* files,
+		const ArchiveIndex* archives)
+{
+	uint64_t set = 0;
+
+	for (char* const* it = files; *it; ++it)
+		set += mix(hash_str(*it));
+	if (archives)
+	{
+		for (const ArchiveMember& m : archives->members())
+			set += mix(hash_str(m.name));
+	}
+	return set;
+}
@@ -0,0 +1,78 @@
+/* pshs -- redirecting to less loaded instances
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+#ifndef _PSHS_CLUSTER_H
+#define _PSHS_CLUSTER_H
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include <event2/event.h>
+
+#include "conn.h"
+
+// abstract
+class ArchiveIndex;
+
+class Cluster
+{
+	struct Address
+	{
+		struct sockaddr_storage addr;
+		socklen_t len;
+	};
+
+	/* another instance, as last reported by it */
+	struct Node
+	{
+		/* where it serves the files, also its identity */
+		std::string url;
+		uint64_t id;
+		unsigned int transfers;
+		double rate;
+		/* requests redirected to it since the report */
+		unsigned int redirected;
+		time_t seen;
+	};
+
+	const ConnTracker& _conns;
+	int _fd;
+	struct event* _read_ev;
+	struct event* _timer;
+	std::string _url;
+	/* fingerprint of the files served, instances serving another set
+	 * are ignored */
+	uint64_t _set;
+	unsigned int _threshold;
+
+	/* where the reports are sent */
+	std::vector<Address> _peers;
+	std::vector<Node> _nodes;
+	unsigned long _redirects;
+
+	static void read_callback(evutil_socket_t fd, short what, void* data);
+	static void timer_callback(evutil_socket_t fd, short what, void* data);
+	void receive(const char* msg, const Address& from);
+	void report();
+
+public:
+	Cluster(struct event_base* evb, const ConnTracker& conns, int fd,
+			const char* url, uint64_t set, unsigned int threshold);
+	~Cluster();
+
+	bool add_peer(const char* addr);
+	const char* pick(const char* path);
+};
+
+int cluster_socket(const char* bindip, unsigned int port);
+uint64_t cluster_fingerprint(char* const* files,
+		const ArchiveIndex* archives);
+
+#endif /*_PSHS_CLUSTER_H*/
@@ -0,0 +1,1056 @@
+/* pshs -- connection lifecycle limits
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include <event2/buffer.h>
+
+#include "conn.h"
+#include "network.h"
+#include "probes.h"
+#include "proxy.h"
+
+static const char* const reap_names[REAP_MAX] = {
+	"idle timeout",
+	"read timeout",
+	"write timeout",
+	"keep-alive limit",
+	"header size limit",
+	"stream lag",
+};
+
+ConnLimits::ConnLimits()
+	: idle_timeout(60), read_timeout(30), write_timeout(60),
+	max_requests(1000), max_headers(16 * 1024),
+	output_high(1024 * 1024), output_low(256 * 1024)
+{
+}
+
+enum conn_state
+{
+	CONN_FREE,
+	/* waiting for a request */
+	CONN_IDLE,
+	/* receiving a request */
+	CONN_READING,
+	/* sending the response */
+	CONN_WRITING,
+};
+
+/* a file body being queued in parts */
+struct Transfer
+{
+	/* %NULL if no transfer is in progress */
+	struct evhttp_request* req;
+	struct evbuffer_file_segment* seg;
+	/* instead of the segment, when a read engine is used */
+	ReadFile* file;
+	ev_off_t offset;
+	/* reads in flight or not added yet, in file order */
+	std::vector<ReadEngine::Read*> reads;
+	/* set while waiting for a free buffer */
+	struct bufferevent* waiting;
+	/* bytes added to the output, or being read */
+	ev_off_t queued;
+	ev_off_t length;
+	unsigned long split;
+};
+
+/* progress of a file response, counted as the output drains */
+struct Progress
+{
+	/* served file name, %NULL if the response is not a file */
+	const char* file;
+	ev_off_t sent;
+	ev_off_t total;
+	/* bytes of the response (the headers) to drain before the body */
+	size_t skip;
+	/* sent and time at the last rate sample */
+	ev_off_t sampled;
+	double sampled_at;
+	double rate;
+};
+
+/* notification of the connection closing before the response is done */
+struct CloseHook
+{
+	/* %NULL if none */
+	close_hook cb;
+	void* data;
+	struct evhttp_request* req;
+};
+
+/* state of the open connections, indexed by fd; an entry is rewritten
+ * when a new connection is set up, before any data on it is read */
+struct Conn
+{
+	struct evhttp_connection* evcon;
+	enum conn_state state;
+	/* when the state was entered, or (when writing) data last sent */
+	time_t since;
+	/* bytes of the request received so far */
+	size_t received;
+	unsigned int requests;
+	/* set if the connection is being closed because of a limit */
+	int reap;
+	Transfer xfer;
+	Progress progress;
+	CloseHook hook;
+};
+
+static std::vector<Conn> conns;
+static ConnTracker* tracker = NULL;
+/* set if file contents are read by the engine, not mapped by libevent */
+static ReadEngine* reader = NULL;
+
+/* bytes read ahead for a transfer when the output budget is unlimited */
+static const size_t read_ahead_budget = 1024 * 1024;
+
+/* response bytes sent over all connections, and their rate */
+static uint64_t total_sent = 0;
+static uint64_t total_sampled = 0;
+static double total_sampled_at = 0;
+static double total_rate = 0;
+
+/**
+ * now
+ * @evb: the event base
+ *
+ * Returns: current time, as cached by the event loop
+ */
+static time_t now(struct event_base* evb)
+{
+	struct timeval tv;
+
+	event_base_gettimeofday_cached(evb, &tv);
+	return tv.tv_sec;
+}
+
+/**
+ * now_precise
+ *
+ * Returns: current time in seconds, with microseconds
+ */
+static double now_precise()
+{
+	struct timeval tv;
+
+	evutil_gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/**
+ * update_rate
+ * @rate: the rate to update
+ * @bytes: bytes sent since the last sample
+ * @interval: seconds since the last sample
+ *
+ * Fold a new sample into an exponentially weighted moving average,
+ * starting from the first sample.
+ */
+static void update_rate(double& rate, uint64_t bytes, double interval)
+{
+	double sample = interval > 0 ? bytes / interval : 0;
+
+	rate = rate ? rate + (sample - rate) / 4 : sample;
+}
+
+/**
+ * print_peer
+ * @out: the stream
+ * @evcon: the connection
+ *
+ * Print the client address, or the real client behind a proxy.
+ */
+static void print_peer(std::ostream& out, struct evhttp_connection* evcon)
+{
+#if LIBEVENT_VERSION_NUMBER >= 0x02020000
+	const char* addr;
+#else
+	char* addr;
+#endif
+	ev_uint16_t port;
+
+	evhttp_connection_get_peer(evcon, &addr, &port);
+	const char* real_addr = proxy_peer(evcon, port);
+	out << IPAddrPrinter(real_addr ? real_addr : addr, port);
+}
+
+/**
+ * get_conn
+ * @bev: bufferevent of the connection
+ *
+ * Returns: the connection state, or %NULL if it is not tracked
+ */
+static Conn* get_conn(struct bufferevent* bev)
+{
+	int fd = bufferevent_getfd(bev);
+
+	if (fd < 0 || static_cast<size_t>(fd) >= conns.size()
+			|| conns[fd].state == CONN_FREE)
+		return NULL;
+	return &conns[fd];
+}
+
+/**
+ * release_transfer
+ * @xfer: the transfer
+ *
+ * Drop our reference to the file, and the reads not queued yet. Parts
+ * already queued hold their own.
+ */
+static void release_transfer(Transfer& xfer)
+{
+	if (xfer.seg)
+		evbuffer_file_segment_free(xfer.seg);
+	if (xfer.file)
+	{
+		for (ReadEngine::Read* r : xfer.reads)
+			reader->cancel(r);
+		ReadEngine::unref(xfer.file);
+	}
+	if (xfer.waiting)
+		reader->unwait(xfer.waiting);
+	xfer = Transfer{};
+}
+
+/**
+ * input_cb
+ * @buf: input buffer of the connection
+ * @info: information about the change
+ * @data: the bufferevent
+ *
+ * Note the start of a request.
+ */
+static void input_cb(struct evbuffer* buf, const struct evbuffer_cb_info* info,
+		void* data)
+{
+	struct bufferevent* bev = static_cast<struct bufferevent*>(data);
+	Conn* c = get_conn(bev);
+
+	/* the PROXY protocol header is gone by now */
+	if (!c || !info->n_added || !evbuffer_get_length(buf))
+		return;
+
+	if (c->state == CONN_IDLE)
+	{
+		c->state = CONN_READING;
+		c->since = now(bufferevent_get_base(bev));
+		c->received = 0;
+	}
+	if (c->state == CONN_READING)
+		c->received += info->n_added;
+}
+
+/**
+ * output_cb
+ * @buf: output buffer of the connection
+ * @info: information about the change
+ * @data: the bufferevent
+ *
+ * Note that the client is still reading, and count the bytes sent.
+ */
+static void output_cb(struct evbuffer* buf, const struct evbuffer_cb_info* info,
+		void* data)
+{
+	struct bufferevent* bev = static_cast<struct bufferevent*>(data);
+	Conn* c = get_conn(bev);
+	size_t n = info->n_deleted;
+
+	if (!c || !n)
+		return;
+
+	total_sent += n;
+	if (c->state != CONN_WRITING)
+		return;
+
+	c->since = now(bufferevent_get_base(bev));
+	Progress& p = c->progress;
+	if (p.skip >= n)
+		p.skip -= n;
+	else
+	{
+		p.sent += n - p.skip;
+		p.skip = 0;
+	}
+}
+
+/**
+ * close_cb
+ * @evcon: the connection
+ * @data: unused
+ *
+ * Count and log the connection being closed, and forget its state.
+ */
+static void close_cb(struct evhttp_connection* evcon, void* data)
+{
+	Conn* c = get_conn(evhttp_connection_get_bufferevent(evcon));
+
+	if (!c || c->evcon != evcon)
+		return;
+
+	int reason = c->reap;
+	/* evhttp refused it */
+	if (reason == -1 && c->state == CONN_READING && tracker
+			&& tracker->limits().max_headers
+			&& c->received > tracker->limits().max_headers)
+		reason = REAP_HEADERS;
+
+	if (reason != -1 && tracker)
+		++tracker->reaped[reason];
+	PSHS_PROBE(conn__close, bufferevent_getfd(evhttp_connection_get_bufferevent(
+				evcon)), reason, c->requests);
+
+	if ((c->requests || reason != -1) && !(tracker && tracker->quiet()))
+	{
+		std::cout << '[';
+		print_peer(std::cout, evcon);
+		std::cout << "] connection closed";
+		if (reason != -1)
+			std::cout << " (" << reap_names[reason] << ')';
+		std::cout << std::endl;
+	}
+
+	/* if the client went away, evhttp leaves the unfinished response
+	 * to us; finishing it frees it */
+	struct evhttp_request* req = c->xfer.req;
+	release_transfer(c->xfer);
+	if (c->hook.cb)
+	{
+		req = c->hook.req;
+		c->hook.cb(req, c->hook.data);
+		c->hook = CloseHook{};
+	}
+	if (req && !evhttp_request_get_connection(req))
+		evhttp_send_reply_end(req);
+	c->evcon = NULL;
+	c->state = CONN_FREE;
+}
+
+/**
+ * attach_cb
+ * @fd: unused
+ * @what: unused
+ * @data: bufferevent of the new connection
+ *
+ * Start tracking a new connection.
+ */
+static void attach_cb(evutil_socket_t fd, short what, void* data)
+{
+	struct bufferevent* bev = static_cast<struct bufferevent*>(data);
+	int sock = bufferevent_getfd(bev);
+	void* cbarg;
+
+	/* evhttp passes the connection to the bufferevent callbacks */
+	bufferevent_getcb(bev, NULL, NULL, NULL, &cbarg);
+	struct evhttp_connection* evcon
+		= static_cast<struct evhttp_connection*>(cbarg);
+	if (sock < 0 || !evcon || evhttp_connection_get_bufferevent(evcon) != bev)
+		return;
+
+	if (conns.size() <= static_cast<size_t>(sock))
+		conns.resize(sock + 1);
+	Conn& c = conns[sock];
+	release_transfer(c.xfer);
+	c = Conn{evcon, CONN_IDLE, now(bufferevent_get_base(bev)), 0, 0, -1,
+		Transfer{}, Progress{}, CloseHook{}};
+
+	PSHS_PROBE(conn__open, sock);
+	evhttp_connection_set_closecb(evcon, close_cb, NULL);
+	if (evbuffer_add_cb(bufferevent_get_input(bev), input_cb, bev)
+			&& evbuffer_add_cb(bufferevent_get_output(bev), output_cb, bev))
+		return;
+	throw std::bad_alloc();
+}
+
+/**
+ * ConnTracker::bev_callback
+ * @evb: the event base
+ * @data: the tracker
+ *
+ * Create the bufferevent for a new connection, and arrange for the
+ * connection to be tracked. evhttp sets the fd and its own callbacks only
+ * after this returns, so that is deferred to an event activated right
+ * away -- it runs before any data on the connection is processed.
+ *
+ * Returns: the new bufferevent, or %NULL on failure
+ */
+struct bufferevent* ConnTracker::bev_callback(struct event_base* evb,
+		void* data)
+{
+	ConnTracker* self = static_cast<ConnTracker*>(data);
+	struct bufferevent* bev = self->_bevcb
+		? self->_bevcb(evb, self->_bevcb_arg)
+		: bufferevent_socket_new(evb, -1, BEV_OPT_CLOSE_ON_FREE);
+
+	if (bev && event_base_once(evb, -1, EV_TIMEOUT, attach_cb, bev, NULL))
+	{
+		bufferevent_free(bev);
+		return NULL;
+	}
+
+	return bev;
+}
+
+/**
+ * complete_cb
+ * @req: the request object
+ * @data: unused
+ *
+ * Wait for the next request once the response has been sent.
+ */
+static void complete_cb(struct evhttp_request* req, void* data)
+{
+	struct bufferevent* bev = evhttp_connection_get_bufferevent(
+			evhttp_request_get_connection(req));
+	Conn* c = get_conn(bev);
+
+	PSHS_PROBE(request__done, req);
+	if (!c)
+		return;
+
+	c->hook = CloseHook{};
+	/* a pipelined request may be there already */
+	size_t pending = evbuffer_get_length(bufferevent_get_input(bev));
+	c->state = pending ? CONN_READING : CONN_IDLE;
+	c->since = now(bufferevent_get_base(bev));
+	c->received = pending;
+}
+
+/**
+ * sweep_cb
+ * @fd: unused
+ * @what: unused
+ * @data: the tracker
+ *
+ * Close the connections that exceeded their timeouts, and sample
+ * the transfer rates.
+ */
+static void sweep_cb(evutil_socket_t fd, short what, void* data)
+{
+	const ConnLimits& limits = static_cast<ConnTracker*>(data)->limits();
+	double precise = now_precise();
+	time_t t = 0;
+
+	update_rate(total_rate, total_sent - total_sampled,
+			precise - total_sampled_at);
+	total_sampled = total_sent;
+	total_sampled_at = precise;
+
+	for (Conn& c : conns)
+	{
+		int timeout;
+		enum reap_reason reason;
+		Progress& p = c.progress;
+
+		if (c.state == CONN_WRITING && p.file)
+		{
+			update_rate(p.rate, p.sent - p.sampled, precise - p.sampled_at);
+			p.sampled = p.sent;
+			p.sampled_at = precise;
+		}
+
+		/* a live stream waiting for its producer, or a file being
+		 * opened, is not stalled */
+		if (c.state == CONN_WRITING && c.hook.cb && !evbuffer_get_length(
+					bufferevent_get_output(evhttp_connection_get_bufferevent(
+							c.evcon))))
+		{
+			c.since = now(evhttp_connection_get_base(c.evcon));
+			continue;
+		}
+
+		switch (c.state)
+		{
+			case CONN_IDLE:
+				timeout = limits.idle_timeout;
+				reason = REAP_IDLE;
+				break;
+			case CONN_READING:
+				timeout = limits.read_timeout;
+				reason = REAP_READ;
+				break;
+			case CONN_WRITING:
+				timeout = limits.write_timeout;
+				reason = REAP_WRITE;
+				break;
+			default:
+				continue;
+		}
+
+		if (!t)
+			t = now(evhttp_connection_get_base(c.evcon));
+		if (timeout && t - c.since >= timeout)
+		{
+			c.reap = reason;
+			evhttp_connection_free(c.evcon);
+		}
+	}
+}
+
+/**
+ * ConnTracker::ConnTracker
+ * @evb: the event base
+ * @http: the HTTP server
+ * @limits: the limits to enforce
+ *
+ * Start tracking connections to @http. The bufferevents are created
+ * by the tracker; use set_bevcb() to override how.
+ */
+ConnTracker::ConnTracker(struct event_base* evb, struct evhttp* http,
+		const ConnLimits& limits)
+	: _limits(limits), _quiet(false), _sweep(NULL), _scratch(evbuffer_new()),
+	_bevcb(NULL), _bevcb_arg(NULL), reaped()
+{
+	const struct timeval interval = { 1, 0 };
+
+	if (!_scratch)
+		throw std::bad_alloc();
+
+	/* runs even without timeouts, to measure the rates */
+	_sweep = event_new(evb, -1, EV_PERSIST, sweep_cb, this);
+	if (!_sweep || event_add(_sweep, &interval))
+		throw std::runtime_error("Unable to set up the connection timer");
+	total_sampled_at = now_precise();
+
+	if (_limits.max_headers)
+		evhttp_set_max_headers_size(http, _limits.max_headers);
+	evhttp_set_bevcb(http, bev_callback, this);
+	tracker = this;
+}
+
+/**
+ * ConnTracker::~ConnTracker
+ *
+ * Stop the timeouts, and print the number of connections closed because
+ * of the limits.
+ */
+ConnTracker::~ConnTracker()
+{
+	unsigned long total = 0;
+
+	tracker = NULL;
+	event_free(_sweep);
+	evbuffer_free(_scratch);
+
+	for (unsigned long n : reaped)
+		total += n;
+	if (!total)
+		return;
+
+	const char* sep = "Connections closed by limits: ";
+	for (int i = 0; i < REAP_MAX; ++i)
+	{
+		if (!reaped[i])
+			continue;
+		std::cerr << sep << reap_names[i] << ' ' << reaped[i];
+		sep = ", ";
+	}
+	std::cerr << '.' << std::endl;
+}
+
+/**
+ * ConnTracker::set_bevcb
+ * @cb: function creating bufferevents for new connections
+ * @arg: argument for @cb
+ *
+ * Use @cb instead of creating plain socket bufferevents.
+ */
+void ConnTracker::set_bevcb(bev_factory cb, void* arg)
+{
+	_bevcb = cb;
+	_bevcb_arg = arg;
+}
+
+/**
+ * ConnTracker::set_reader
+ * @engine: the read engine, or %NULL to let libevent map the files
+ *
+ * Read the contents of the files sent with send_file() using @engine,
+ * ahead of the output draining. @engine has to outlive the connections.
+ */
+void ConnTracker::set_reader(ReadEngine* engine)
+{
+	reader = engine;
+}
+
+/**
+ * ConnTracker::request
+ * @req: the request object
+ *
+ * Note a request being handled. If the connection reached the request
+ * limit, it will be closed after the response.
+ */
+void ConnTracker::request(struct evhttp_request* req)
+{
+	struct evhttp_connection* evcon = evhttp_request_get_connection(req);
+	Conn* c = get_conn(evhttp_connection_get_bufferevent(evcon));
+
+	if (!c || c->evcon != evcon)
+		return;
+
+	c->state = CONN_WRITING;
+	c->since = now(evhttp_connection_get_base(evcon));
+	++c->requests;
+	c->progress = Progress{};
+	c->hook = CloseHook{};
+	evhttp_request_set_on_complete_cb(req, complete_cb, NULL);
+
+	if (_limits.max_requests && c->requests >= _limits.max_requests)
+	{
+		if (evhttp_add_header(evhttp_request_get_output_headers(req),
+					"Connection", "close"))
+			throw std::bad_alloc();
+		c->reap = REAP_KEEPALIVE;
+	}
+}
+
+/**
+ * ConnTracker::stream
+ * @req: the request object
+ * @length: length of the response body
+ *
+ * Returns: true if the body should be sent using send_file(), i.e. it
+ * does not fit in the output budget, or files are read by the engine
+ */
+bool ConnTracker::stream(struct evhttp_request* req, ev_off_t length) const
+{
+	struct evhttp_connection* evcon = evhttp_request_get_connection(req);
+	Conn* c = get_conn(evhttp_connection_get_bufferevent(evcon));
+
+	return c && c->evcon == evcon && (reader ? length > 0
+			: _limits.output_high
+				&& length > static_cast<ev_off_t>(_limits.output_high))
+		&& evhttp_request_get_command(req) != EVHTTP_REQ_HEAD;
+}
+
+/**
+ * ConnTracker::produce
+ * @bev: bufferevent of the connection
+ *
+ * Queue the next part of the file, up to the output budget, and either
+ * wait for it to drain or finish the response. With a read engine, start
+ * reading it instead.
+ *
+ * Returns: number of file bytes queued
+ */
+size_t ConnTracker::produce(struct bufferevent* bev)
+{
+	Transfer& xfer = get_conn(bev)->xfer;
+	struct evhttp_request* req = xfer.req;
+
+	if (xfer.file)
+	{
+		read_ahead(bev);
+		return 0;
+	}
+
+	size_t queued = evbuffer_get_length(bufferevent_get_output(bev));
+	/* the headers alone may be over a tiny budget */
+	size_t room = queued < _limits.output_high
+		? _limits.output_high - queued
+		: _limits.output_high - _limits.output_low;
+	size_t added = 0;
+
+	while (added < room && xfer.queued < xfer.length)
+	{
+		ev_off_t len = std::min(xfer.length - xfer.queued,
+				static_cast<ev_off_t>(room - added));
+		/* keep the first part separate, see add_file() */
+		if (xfer.queued < static_cast<ev_off_t>(xfer.split))
+			len = std::min(len, static_cast<ev_off_t>(xfer.split)
+					- xfer.queued);
+
+		PSHS_PROBE(file__segment, req, xfer.queued, len);
+		if (evbuffer_add_file_segment(_scratch, xfer.seg, xfer.queued, len))
+			throw std::bad_alloc();
+		xfer.queued += len;
+		added += len;
+	}
+
+	if (xfer.queued < xfer.length)
+		evhttp_send_reply_chunk_with_cb(req, _scratch, transfer_callback, NULL);
+	else
+	{
+		release_transfer(xfer);
+		finish(req, _scratch);
+	}
+
+	return added;
+}
+
+/**
+ * ConnTracker::transfer_callback
+ * @evcon: the connection
+ * @data: unused
+ *
+ * Queue more of the file once the output drained to the low watermark.
+ */
+void ConnTracker::transfer_callback(struct evhttp_connection* evcon,
+		void* data)
+{
+	struct bufferevent* bev = evhttp_connection_get_bufferevent(evcon);
+	Conn* c = get_conn(bev);
+
+	if (tracker && c && c->xfer.req)
+		tracker->produce(bev);
+}
+
+/**
+ * ConnTracker::read_ahead
+ * @bev: bufferevent of the connection
+ *
+ * Start reading the next blocks of the file, so that the output plus
+ * the reads in flight are up to the output budget. If all buffers are
+ * in use, wait for one.
+ */
+void ConnTracker::read_ahead(struct bufferevent* bev)
+{
+	Transfer& xfer = get_conn(bev)->xfer;
+	size_t budget = _limits.output_high ? _limits.output_high
+		: read_ahead_budget;
+	size_t pending = evbuffer_get_length(bufferevent_get_output(bev));
+
+	for (ReadEngine::Read* r : xfer.reads)
+		pending += r->len;
+
+	while (pending < budget && xfer.queued < xfer.length)
+	{
+		ev_off_t len = std::min(xfer.length - xfer.queued,
+				static_cast<ev_off_t>(ReadEngine::block_size()));
+		/* keep the first part separate, see add_file() */
+		if (xfer.queued < static_cast<ev_off_t>(xfer.split))
+			len = std::min(len, static_cast<ev_off_t>(xfer.split)
+					- xfer.queued);
+
+		ReadEngine::Read* r = reader->read(xfer.file,
+				xfer.offset + xfer.queued, len, read_callback, bev);
+		if (!r)
+		{
+			/* otherwise the reads done will call again */
+			if (xfer.reads.empty() && !xfer.waiting)
+			{
+				xfer.waiting = bev;
+				reader->wait(buffer_callback, bev);
+			}
+			break;
+		}
+
+		PSHS_PROBE(file__segment, xfer.req, xfer.queued, len);
+		xfer.reads.push_back(r);
+		xfer.queued += len;
+		pending += len;
+	}
+}
+
+/**
+ * ConnTracker::flush
+ * @bev: bufferevent of the connection
+ *
+ * Pass the blocks read so far on to evhttp, in order, and either read
+ * ahead some more or finish the response. A failed or short read closes
+ * the connection, as the length has been sent already.
+ */
+void ConnTracker::flush(struct bufferevent* bev)
+{
+	Transfer& xfer = get_conn(bev)->xfer;
+	struct evhttp_request* req = xfer.req;
+	size_t done = 0;
+
+	while (done < xfer.reads.size() && !xfer.reads[done]->busy)
+	{
+		ReadEngine::Read* r = xfer.reads[done];
+
+		if (r->result != static_cast<ssize_t>(r->len))
+		{
+			std::cerr << "Reading file for [";
+			print_peer(std::cerr, evhttp_request_get_connection(req));
+			std::cerr << "] failed: " << (r->result < 0
+					? strerror(-r->result) : "file truncated") << std::endl;
+			evbuffer_drain(_scratch, evbuffer_get_length(_scratch));
+			evhttp_connection_free(evhttp_request_get_connection(req));
+			return;
+		}
+		if (reader->add_to(_scratch, r))
+			throw std::bad_alloc();
+		++done;
+	}
+	xfer.reads.erase(xfer.reads.begin(), xfer.reads.begin() + done);
+
+	if (xfer.queued < xfer.length || !xfer.reads.empty())
+	{
+		if (done)
+			evhttp_send_reply_chunk_with_cb(req, _scratch, transfer_callback,
+					NULL);
+		read_ahead(bev);
+	}
+	else
+	{
+		release_transfer(xfer);
+		finish(req, _scratch);
+	}
+}
+
+/**
+ * ConnTracker::finish_callback
+ * @evcon: the connection
+ * @data: the request object
+ *
+ * Finish the response once the output is empty.
+ */
+void ConnTracker::finish_callback(struct evhttp_connection* evcon,
+		void* data)
+{
+	struct evhttp_request* req = static_cast<struct evhttp_request*>(data);
+
+	if (!evbuffer_get_length(bufferevent_get_output(
+					evhttp_connection_get_bufferevent(evcon))))
+		evhttp_send_reply_end(req);
+}
+
+/**
+ * ConnTracker::read_callback
+ * @r: the read
+ * @data: bufferevent of the connection
+ *
+ * Queue the blocks read once they are complete.
+ */
+void ConnTracker::read_callback(ReadEngine::Read* r, void* data)
+{
+	struct bufferevent* bev = static_cast<struct bufferevent*>(data);
+
+	if (tracker)
+		tracker->flush(bev);
+}
+
+/**
+ * ConnTracker::buffer_callback
+ * @data: bufferevent of the connection
+ *
+ * Carry on reading once a buffer is free.
+ */
+void ConnTracker::buffer_callback(void* data)
+{
+	struct bufferevent* bev = static_cast<struct bufferevent*>(data);
+	Conn* c = get_conn(bev);
+
+	if (!c)
+		return;
+	c->xfer.waiting = NULL;
+	if (tracker && c->xfer.file)
+		tracker->read_ahead(bev);
+}
+
+/**
+ * ConnTracker::send_file
+ * @req: the request object
+ * @code: HTTP response code
+ * @reason: HTTP response reason
+ * @fd: open file, owned by the transfer from now on
+ * @offset: offset of the first byte to send
+ * @length: number of bytes to send
+ * @split: size of the first part, 0 for none
+ *
+ * Send the response with the file contents as body, adding them to the
+ * output in parts so that at most output_high bytes are queued at once.
+ *
+ * Returns: number of file bytes queued right away
+ */
+size_t ConnTracker::send_file(struct evhttp_request* req, int code,
+		const char* reason, int fd, ev_off_t offset, ev_off_t length,
+		unsigned long split)
+{
+	struct bufferevent* bev = evhttp_connection_get_bufferevent(
+			evhttp_request_get_connection(req));
+	Transfer& xfer = get_conn(bev)->xfer;
+	char lenbuf[24];
+
+	release_transfer(xfer);
+	if (reader)
+	{
+		xfer.file = ReadEngine::open(fd);
+		xfer.offset = offset;
+	}
+	else
+	{
+		xfer.seg = evbuffer_file_segment_new(fd, offset, length,
+				EVBUF_FS_CLOSE_ON_FREE);
+		if (!xfer.seg)
+		{
+			close(fd);
+			throw std::bad_alloc();
+		}
+	}
+	xfer.req = req;
+	xfer.length = length;
+	xfer.split = split < static_cast<unsigned long>(length) ? split : 0;
+
+	/* otherwise evhttp would use chunked encoding */
+	snprintf(lenbuf, sizeof(lenbuf), "%" PRIdMAX,
+			static_cast<intmax_t>(length));
+	if (evhttp_add_header(evhttp_request_get_output_headers(req),
+				"Content-Length", lenbuf))
+		throw std::bad_alloc();
+
+	bufferevent_setwatermark(bev, EV_WRITE, _limits.output_low, 0);
+	evhttp_send_reply_start(req, code, reason);
+	return produce(bev);
+}
+
+/**
+ * ConnTracker::finish
+ * @req: the request object
+ * @buf: the last part of the body, drained
+ *
+ * Queue the last part of a response started with evhttp_send_reply_start(),
+ * and finish the response once the output is empty. evhttp_send_reply_end()
+ * alone would do that too, but TLS connections run the write callback
+ * deferred: one queued for an earlier drain would have evhttp consider
+ * the response done with @buf still in the output, and stop writing.
+ */
+void ConnTracker::finish(struct evhttp_request* req, struct evbuffer* buf)
+{
+	struct bufferevent* bev = evhttp_connection_get_bufferevent(
+			evhttp_request_get_connection(req));
+
+	bufferevent_setwatermark(bev, EV_WRITE, 0, 0);
+	if (evbuffer_get_length(buf))
+		evhttp_send_reply_chunk_with_cb(req, buf, finish_callback, req);
+	else
+		evhttp_send_reply_end(req);
+}
+
+/**
+ * ConnTracker::set_close_hook
+ * @req: the request object
+ * @cb: function to call, or %NULL to remove the hook
+ * @data: argument for @cb
+ *
+ * Call @cb if the connection closes before the response to @req is done,
+ * for responses sent outside of send_file(). The hook is removed once
+ * the response is complete. If the client went away, the response is
+ * finished (and freed) after @cb returns.
+ */
+void ConnTracker::set_close_hook(struct evhttp_request* req, close_hook cb,
+		void* data)
+{
+	struct evhttp_connection* evcon = evhttp_request_get_connection(req);
+	Conn* c = evcon ? get_conn(evhttp_connection_get_bufferevent(evcon))
+		: NULL;
+
+	if (c && c->evcon == evcon)
+		c->hook = CloseHook{cb, data, req};
+}
+
+/**
+ * ConnTracker::drop
+ * @req: the request object
+ * @reason: why
+ *
+ * Close the connection in the middle of the response to @req, counting
+ * it as closed because of @reason.
+ */
+void ConnTracker::drop(struct evhttp_request* req, enum reap_reason reason)
+{
+	struct evhttp_connection* evcon = evhttp_request_get_connection(req);
+	Conn* c = evcon ? get_conn(evhttp_connection_get_bufferevent(evcon))
+		: NULL;
+
+	if (!evcon)
+		return;
+	if (c && c->evcon == evcon)
+		c->reap = reason;
+	evhttp_connection_free(evcon);
+}
+
+/**
+ * ConnTracker::track
+ * @req: the request object
+ * @file: name of the file being sent, kept until the response is done
+ * @length: length of the response body
+ * @queued: body bytes in the output already
+ *
+ * Start counting the progress of a file response, once its headers
+ * and the first part of the body have been queued.
+ */
+void ConnTracker::track(struct evhttp_request* req, const char* file,
+		ev_off_t length, size_t queued)
+{
+	struct evhttp_connection* evcon = evhttp_request_get_connection(req);
+
+	if (!evcon || !length
+			|| evhttp_request_get_command(req) == EVHTTP_REQ_HEAD)
+		return;
+
+	struct bufferevent* bev = evhttp_connection_get_bufferevent(evcon);
+	Conn* c = get_conn(bev);
+	if (!c || c->evcon != evcon)
+		return;
+
+	size_t pending = evbuffer_get_length(bufferevent_get_output(bev));
+	c->progress = Progress{file, 0, length,
+		pending > queued ? pending - queued : 0, 0, now_precise(), 0};
+}
+
+/**
+ * ConnTracker::status
+ * @st: the status to fill in
+ *
+ * Take a snapshot of the open connections and the files being sent.
+ */
+void ConnTracker::status(ServerStatus& st) const
+{
+	st.connections = 0;
+	st.sent = total_sent;
+	st.rate = total_rate;
+	st.transfers.clear();
+
+	for (const Conn& c : conns)
+	{
+		if (c.state == CONN_FREE)
+			continue;
+		++st.connections;
+
+		const Progress& p = c.progress;
+		if (c.state != CONN_WRITING || !p.file)
+			continue;
+
+		std::ostringstream peer;
+		print_peer(peer, c.evcon);
+		st.transfers.push_back(TransferStatus{peer.str(), p.file,
+				std::min(p.sent, p.total), p.total, p.rate});
+	}
+}
+
+/**
+ * ConnTracker::load
+ * @transfers: location to store the number of files being sent
+ * @rate: location to store the total send rate, in bytes per second
+ *
+ * Get the current load, without the details collected by status().
+ */
+void ConnTracker::load(unsigned int& transfers, double& rate) const
+{
+	transfers = 0;
+	rate = total_rate;
+
+	for (const Conn& c : conns)
+	{
+		if (c.state == CONN_WRITING && c.progress.file)
+			++transfers;
+	}
+}
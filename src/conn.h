@@ -0,0 +1,136 @@
+/* pshs -- connection lifecycle limits
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+#ifndef _PSHS_CONN_H
+#define _PSHS_CONN_H
+
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/http.h>
+
+#include "reader.h"
+
+typedef struct bufferevent* (*bev_factory)(struct event_base* evb,
+		void* data);
+/* called when the connection of an unfinished response closes */
+typedef void (*close_hook)(struct evhttp_request* req, void* data);
+
+/* why a connection was closed by the server */
+enum reap_reason
+{
+	REAP_IDLE,
+	REAP_READ,
+	REAP_WRITE,
+	REAP_KEEPALIVE,
+	REAP_HEADERS,
+	/* fell behind a live stream */
+	REAP_LAG,
+
+	REAP_MAX
+};
+
+struct ConnLimits
+{
+	/* seconds to wait for a request, 0 to wait forever */
+	int idle_timeout;
+	/* seconds to receive a complete request once it started */
+	int read_timeout;
+	/* seconds without any response data being sent */
+	int write_timeout;
+	/* requests served on a connection before closing it, 0 for no limit */
+	unsigned int max_requests;
+	/* size of the request line and headers, 0 for no limit */
+	size_t max_headers;
+	/* response data queued per connection: file contents are added while
+	 * it is below output_high, and then when it drains to output_low;
+	 * 0 to queue the whole file at once */
+	size_t output_high;
+	size_t output_low;
+
+	ConnLimits();
+};
+
+/* progress of a file being sent */
+struct TransferStatus
+{
+	std::string peer;
+	const char* file;
+	ev_off_t sent;
+	ev_off_t total;
+	/* bytes per second over the last few seconds, 0 until measured */
+	double rate;
+};
+
+struct ServerStatus
+{
+	unsigned int connections;
+	/* response bytes sent since start, headers included */
+	uint64_t sent;
+	double rate;
+	std::vector<TransferStatus> transfers;
+};
+
+class ConnTracker
+{
+	ConnLimits _limits;
+	bool _quiet;
+	struct event* _sweep;
+	/* holds file chunks on their way to evhttp */
+	struct evbuffer* _scratch;
+	bev_factory _bevcb;
+	void* _bevcb_arg;
+
+	static struct bufferevent* bev_callback(struct event_base* evb,
+			void* data);
+	static void transfer_callback(struct evhttp_connection* evcon,
+			void* data);
+	static void finish_callback(struct evhttp_connection* evcon,
+			void* data);
+	static void read_callback(ReadEngine::Read* r, void* data);
+	static void buffer_callback(void* data);
+	size_t produce(struct bufferevent* bev);
+	void read_ahead(struct bufferevent* bev);
+	void flush(struct bufferevent* bev);
+
+public:
+	ConnTracker(struct event_base* evb, struct evhttp* http,
+			const ConnLimits& limits);
+	~ConnTracker();
+
+	void set_bevcb(bev_factory cb, void* arg);
+	void set_reader(ReadEngine* engine);
+
+	void request(struct evhttp_request* req);
+	bool stream(struct evhttp_request* req, ev_off_t length) const;
+	size_t send_file(struct evhttp_request* req, int code,
+			const char* reason, int fd, ev_off_t offset, ev_off_t length,
+			unsigned long split);
+	void finish(struct evhttp_request* req, struct evbuffer* buf);
+
+	void set_close_hook(struct evhttp_request* req, close_hook cb,
+			void* data);
+	void drop(struct evhttp_request* req, enum reap_reason reason);
+
+	void track(struct evhttp_request* req, const char* file,
+			ev_off_t length, size_t queued);
+	void status(ServerStatus& st) const;
+	void load(unsigned int& transfers, double& rate) const;
+
+	const ConnLimits& limits() const { return _limits; }
+	/* whether requests and closed connections should not be logged */
+	bool quiet() const { return _quiet; }
+	void set_quiet(bool quiet) { _quiet = quiet; }
+
+	unsigned long reaped[REAP_MAX];
+};
+
+#endif /*_PSHS_CONN_H*/
@@ -5,11 +5,15 @@
 
 #include "config.h"
 
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
 #include <iostream>
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 
 #include <unistd.h>
 #include <errno.h>
@@ -17,47 +21,182 @@
 #ifdef HAVE_LIBMAGIC
 #	include <magic.h>
 
-/* XXX: make this local, pass within funcs? */
-static magic_t magic;
+/* libmagic is not thread-safe, so every thread guessing the types
+ * loads its own copy of the database */
+struct MagicHandle
+{
+	magic_t magic;
+	bool loaded;
+
+	MagicHandle() : magic(NULL), loaded(false) {}
+	~MagicHandle()
+	{
+		if (magic)
+			magic_close(magic);
+	}
+};
+
+static thread_local MagicHandle magic_handle;
+#endif
+
+#ifdef HAVE_BUILTIN_MAGIC
+/* data/pshs.magic, compiled by file -C */
+extern unsigned char builtin_magic[];
+extern const size_t builtin_magic_size;
 #endif
 
+struct ExtensionType
+{
+	const char* ext;
+	const char* type;
+};
+
+/* how much of an archive member is read to guess its type */
+static const size_t sniff_size = 64 * 1024;
+
+/* types told by the file name alone, sorted by extension; text types are
+ * left to libmagic, which finds their charset */
+static const ExtensionType extension_types[] = {
+	{ "7z", "application/x-7z-compressed" },
+	{ "avi", "video/x-msvideo" },
+	{ "bz2", "application/x-bzip2" },
+	{ "deb", "application/vnd.debian.binary-package" },
+	{ "epub", "application/epub+zip" },
+	{ "flac", "audio/flac" },
+	{ "gif", "image/gif" },
+	{ "gz", "application/gzip" },
+	{ "iso", "application/x-iso9660-image" },
+	{ "jpeg", "image/jpeg" },
+	{ "jpg", "image/jpeg" },
+	{ "m4a", "audio/mp4" },
+	{ "mkv", "video/x-matroska" },
+	{ "mov", "video/quicktime" },
+	{ "mp3", "audio/mpeg" },
+	{ "mp4", "video/mp4" },
+	{ "ogg", "audio/ogg" },
+	{ "pdf", "application/pdf" },
+	{ "png", "image/png" },
+	{ "rpm", "application/x-rpm" },
+	{ "tar", "application/x-tar" },
+	{ "tgz", "application/gzip" },
+	{ "wasm", "application/wasm" },
+	{ "wav", "audio/x-wav" },
+	{ "webm", "video/webm" },
+	{ "webp", "image/webp" },
+	{ "xz", "application/x-xz" },
+	{ "zip", "application/zip" },
+	{ "zst", "application/zstd" },
+};
+
 #include "content-type.h"
+#include "probes.h"
 
 /**
  * ContentType::ContentType
+ * @use_magic: whether to use libmagic (if enabled at build time)
  *
- * Init Content-Type guessing algos. If libmagic is enabled, initialize it
- * and load the database.
+ * Init Content-Type guessing algos. The libmagic database is loaded only
+ * once a file needs it.
  */
-ContentType::ContentType(void)
+ContentType::ContentType(bool use_magic)
+	: _use_magic(use_magic), _magic_reported(false)
+{
+}
+
+/**
+ * ContentType::load_magic
+ *
+ * Load the libmagic database for the calling thread, unless done already:
+ * the one built into the program if enabled at build time, the system one
+ * otherwise. Report how long it took the first time, since it is loaded
+ * while serving requests.
+ *
+ * Returns: the libmagic cookie, or %NULL if unavailable
+ */
+void* ContentType::load_magic()
 {
 #ifdef HAVE_LIBMAGIC
-	magic = magic_open(MAGIC_MIME);
-	if (!magic)
+	MagicHandle& h = magic_handle;
+
+	if (!_use_magic)
+		return NULL;
+	if (h.loaded)
+		return h.magic;
+	h.loaded = true;
+
+	auto start_time = std::chrono::steady_clock::now();
+
+	h.magic = magic_open(MAGIC_MIME);
+	if (!h.magic)
+	{
 		std::cerr << "magic_open() failed: " << strerror(errno) << std::endl;
-	else
+		return NULL;
+	}
+
+#ifdef HAVE_BUILTIN_MAGIC
+	void* buffers[] = { builtin_magic };
+	size_t sizes[] = { builtin_magic_size };
+	const char* db = "built-in";
+	int ret = magic_load_buffers(h.magic, buffers, sizes, 1);
+#else
+	const char* db = "system";
+	int ret = magic_load(h.magic, NULL);
+#endif
+	if (ret)
 	{
-		if (magic_load(magic, NULL))
-		{
-			std::cerr << "magic_open() failed: " << magic_error(magic) << std::endl;
-			magic_close(magic);
-			magic = NULL;
-		}
+		std::cerr << "magic_load() failed: " << magic_error(h.magic)
+			<< std::endl;
+		magic_close(h.magic);
+		h.magic = NULL;
+		return NULL;
 	}
+
+	if (!_magic_reported.exchange(true))
+	{
+		std::chrono::duration<double, std::milli> elapsed{
+			std::chrono::steady_clock::now() - start_time};
+		std::cerr << "Loaded " << db << " magic database in " << std::fixed
+			<< std::setprecision(1) << elapsed.count() << " ms."
+			<< std::defaultfloat << std::endl;
+	}
+	return h.magic;
+#else
+	return NULL;
 #endif
 }
 
 /**
- * ContentType::~ContentType
+ * ContentType::by_extension
+ * @name: file name
  *
- * Clean up after Content-Type guessing. Unload libmagic if enabled.
+ * Returns: MIME type for the extension of @name, or %NULL if it is not
+ * on the list
  */
-ContentType::~ContentType(void)
+const char* ContentType::by_extension(const char* name)
 {
-#ifdef HAVE_LIBMAGIC
-	if (magic)
-		magic_close(magic);
-#endif
+	const char* base = strrchr(name, '/');
+	const char* ext = strrchr(base ? base : name, '.');
+	size_t lo = 0;
+	size_t hi = sizeof(extension_types) / sizeof(*extension_types);
+
+	if (!ext)
+		return NULL;
+	++ext;
+
+	while (lo < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+		int cmp = strcasecmp(ext, extension_types[mid].ext);
+
+		if (!cmp)
+			return extension_types[mid].type;
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return NULL;
 }
 
 /**
@@ -74,6 +213,8 @@ ContentType::~ContentType(void)
 const char* ContentType::guess(int fd)
 {
 #ifdef HAVE_LIBMAGIC
+	magic_t magic = static_cast<magic_t>(load_magic());
+
 	if (magic)
 	{
 		/* we have to always dup() it;
@@ -98,3 +239,153 @@ const char* ContentType::guess(int fd)
 
 	return "application/octet-stream";
 }
+
+/**
+ * ContentType::guess
+ * @fd: open file descriptor
+ * @offset: offset of the part of the file
+ * @size: size of the part
+ *
+ * Guess format of a part of the file, from up to sniff_size bytes of it.
+ *
+ * Returns: file MIME type
+ */
+const char* ContentType::guess(int fd, off_t offset, off_t size)
+{
+#ifdef HAVE_LIBMAGIC
+	magic_t magic = static_cast<magic_t>(load_magic());
+
+	if (magic)
+	{
+		static thread_local char buf[sniff_size];
+		size_t want = std::min(static_cast<off_t>(sniff_size), size);
+		ssize_t rd = pread(fd, buf, want, offset);
+
+		if (rd == -1)
+			std::cerr << "pread() failed (for Content-Type guessing): "
+				<< strerror(errno) << std::endl;
+		else
+		{
+			const char* ct = magic_buffer(magic, buf, rd);
+
+			if (ct)
+				return ct;
+			std::cerr << "magic_buffer() failed: " << magic_error(magic)
+				<< std::endl;
+		}
+	}
+#endif
+
+	return "application/octet-stream";
+}
+
+/**
+ * ContentType::guess
+ * @name: file name
+ * @fd: open file descriptor
+ * @idx: index of the file in the served list
+ * @st: current stat of the file
+ *
+ * Guess file format from the extension of @name, or like above, caching
+ * the result for the served file. The cached type is used as long as
+ * the file does not change (according to @st), so repeated requests
+ * neither run libmagic nor allocate memory. Can be called from any
+ * thread.
+ *
+ * Returns: file MIME type
+ */
+const char* ContentType::guess(const char* name, int fd, size_t idx,
+		const struct stat& st)
+{
+	FileKey key{st};
+	const char* type;
+
+	PSHS_PROBE(content__type__start, idx);
+	{
+		std::lock_guard<std::mutex> lk{_lock};
+
+		if (idx >= _cache.size())
+			_cache.resize(idx + 1);
+
+		const CacheEntry& ent = _cache[idx];
+		if (ent.type && ent.key == key)
+		{
+			PSHS_PROBE(content__type__done, idx, ent.type, true);
+			return ent.type;
+		}
+	}
+
+	/* libmagic reads the file, so do not keep other threads waiting */
+	type = by_extension(name);
+	if (!type)
+		type = intern(guess(fd));
+
+	{
+		std::lock_guard<std::mutex> lk{_lock};
+		CacheEntry& ent = _cache[idx];
+
+		ent.type = type;
+		ent.key = key;
+	}
+	PSHS_PROBE(content__type__done, idx, type, false);
+
+	return type;
+}
+
+/**
+ * ContentType::guess
+ * @name: member name
+ * @fd: open archive
+ * @offset: offset of the member contents in the archive
+ * @size: size of the member
+ * @type: the type cached for the member, or %NULL
+ *
+ * Guess format of an archive member like above, caching the result
+ * in @type. Archives are not served once changed, so the cached type
+ * does not need to be checked.
+ *
+ * Returns: file MIME type
+ */
+const char* ContentType::guess(const char* name, int fd, off_t offset,
+		off_t size, const char*& type)
+{
+	const char* guessed;
+
+	PSHS_PROBE(content__type__start, -1);
+	{
+		std::lock_guard<std::mutex> lk{_lock};
+
+		if (type)
+		{
+			PSHS_PROBE(content__type__done, -1, type, true);
+			return type;
+		}
+	}
+
+	guessed = by_extension(name);
+	if (!guessed)
+		guessed = intern(guess(fd, offset, size));
+
+	{
+		std::lock_guard<std::mutex> lk{_lock};
+
+		type = guessed;
+	}
+	PSHS_PROBE(content__type__done, -1, guessed, false);
+
+	return guessed;
+}
+
+/**
+ * ContentType::intern
+ * @type: MIME type returned by libmagic
+ *
+ * Returns: a copy of @type that stays valid for the lifetime of the
+ * object
+ */
+const char* ContentType::intern(const char* type)
+{
+	std::lock_guard<std::mutex> lk{_lock};
+
+	return _types.emplace(type).first->c_str();
+}
@@ -7,13 +7,51 @@
 #ifndef _PSHS_CONTENT_TYPE_H
 #define _PSHS_CONTENT_TYPE_H
 
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "digest.h"
+
 class ContentType
 {
+	struct CacheEntry
+	{
+		FileKey key;
+		const char* type;
+
+		CacheEntry() : type(nullptr) {}
+	};
+
+	/* guessed types of served files, by index on the list */
+	std::vector<CacheEntry> _cache;
+	/* distinct types, cache entries point into it */
+	std::unordered_set<std::string> _types;
+	bool _use_magic;
+	/* whether the time to load libmagic was printed already */
+	std::atomic<bool> _magic_reported;
+	/* guards the cache and the types, looked up from the worker threads
+	 * opening the files; libmagic itself runs without it */
+	std::mutex _lock;
+
+	void* load_magic();
+	const char* guess(int fd, off_t offset, off_t size);
+	const char* intern(const char* type);
+
 public:
-	ContentType();
-	~ContentType();
+	ContentType(bool use_magic = true);
 
+	static const char* by_extension(const char* name);
 	const char* guess(int fd);
+	const char* guess(const char* name, int fd, size_t idx,
+			const struct stat& st);
+	const char* guess(const char* name, int fd, off_t offset, off_t size,
+			const char*& type);
 };
 
 #endif /*_PSHS_CONTENT_TYPE_H*/
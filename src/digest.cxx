@@ -0,0 +1,591 @@
+/* pshs -- content digest support
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#ifdef HAVE_LIBCRYPTO
+#	include <openssl/evp.h>
+#endif
+#ifdef HAVE_LIBBLAKE3
+#	include <blake3.h>
+#endif
+
+#include "digest.h"
+#include "workers.h"
+
+#if defined(HAVE_LIBCRYPTO) || defined(HAVE_LIBBLAKE3)
+#	define HAVE_DIGESTS 1
+#endif
+
+/* large sequential reads keep the (SHA-NI/AVX2) hash kernels busy */
+static const size_t read_buf_size = 1024 * 1024;
+
+static const char cache_magic[] = "pshs-digests 1";
+
+FileKey::FileKey()
+	: dev(0), ino(0), size(0), mtime(0), mtime_nsec(0)
+{
+}
+
+FileKey::FileKey(const struct stat& st)
+	: dev(st.st_dev), ino(st.st_ino), size(st.st_size),
+	mtime(st.st_mtim.tv_sec), mtime_nsec(st.st_mtim.tv_nsec)
+{
+}
+
+bool FileKey::operator==(const FileKey& other) const
+{
+	return dev == other.dev && ino == other.ino && size == other.size
+		&& mtime == other.mtime && mtime_nsec == other.mtime_nsec;
+}
+
+size_t FileKeyHash::operator()(const FileKey& key) const
+{
+	size_t h = std::hash<ino_t>()(key.ino);
+	h ^= std::hash<dev_t>()(key.dev) + 0x9e3779b9 + (h << 6) + (h >> 2);
+	h ^= std::hash<off_t>()(key.size) + 0x9e3779b9 + (h << 6) + (h >> 2);
+	h ^= std::hash<time_t>()(key.mtime) + 0x9e3779b9 + (h << 6) + (h >> 2);
+	return h;
+}
+
+/**
+ * to_hex
+ * @data: binary data
+ * @len: data length
+ *
+ * Returns: lowercase hex representation of @data
+ */
+static std::string to_hex(const unsigned char* data, size_t len)
+{
+	static const char digits[] = "0123456789abcdef";
+	std::string out(len * 2, '\0');
+
+	for (size_t i = 0; i < len; ++i)
+	{
+		out[2*i] = digits[data[i] >> 4];
+		out[2*i+1] = digits[data[i] & 0x0f];
+	}
+	return out;
+}
+
+/**
+ * from_hex
+ * @hex: hex string
+ * @out: output buffer
+ * @len: expected binary length
+ *
+ * Returns: true if @hex was a valid representation of @len bytes
+ */
+static bool from_hex(const std::string& hex, unsigned char* out, size_t len)
+{
+	if (hex.size() != len * 2)
+		return false;
+
+	for (size_t i = 0; i < len; ++i)
+	{
+		unsigned int byte;
+		if (sscanf(&hex[2*i], "%2x", &byte) != 1)
+			return false;
+		out[i] = byte;
+	}
+	return true;
+}
+
+/**
+ * to_base64
+ * @data: binary data
+ * @len: data length
+ *
+ * Returns: standard (padded) base64 representation of @data, as used
+ * in structured field byte sequences
+ */
+static std::string to_base64(const unsigned char* data, size_t len)
+{
+	static const char alphabet[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string out;
+
+	for (size_t i = 0; i < len; i += 3)
+	{
+		unsigned long v = data[i] << 16;
+		if (i + 1 < len)
+			v |= data[i+1] << 8;
+		if (i + 2 < len)
+			v |= data[i+2];
+
+		out += alphabet[(v >> 18) & 0x3f];
+		out += alphabet[(v >> 12) & 0x3f];
+		out += i + 1 < len ? alphabet[(v >> 6) & 0x3f] : '=';
+		out += i + 2 < len ? alphabet[v & 0x3f] : '=';
+	}
+	return out;
+}
+
+/**
+ * DigestStore::DigestStore
+ * @files: null-terminated served file list
+ * @enable: whether digests were requested via config
+ * @cache_path: path to the persistent digest cache, or %NULL
+ * @use_blake3: whether to compute BLAKE3 in addition to SHA-256
+ * @piece_size: size of pieces to compute SHA-256 for, 0 to disable
+ *
+ * Load the digest cache and start computing digests for all served files
+ * in background threads. Files found in the cache (by device, inode, size
+ * and mtime) are not reread.
+ */
+DigestStore::DigestStore(char* const* files, bool enable,
+		const char* cache_path, bool use_blake3, off_t piece_size)
+	: _files(files), _cache_path(cache_path), _pending(0), _hashed(0),
+	_use_blake3(use_blake3), _piece_size(piece_size), enabled(false)
+{
+	if (!enable)
+		return;
+
+#ifdef HAVE_DIGESTS
+#	ifndef HAVE_LIBCRYPTO
+	if (_piece_size)
+	{
+		std::cerr << "Piece hashes require SHA-256 support." << std::endl;
+		_piece_size = 0;
+	}
+#	endif
+#	ifndef HAVE_LIBBLAKE3
+	if (_use_blake3)
+	{
+		std::cerr << "BLAKE3 support disabled at build time." << std::endl;
+		_use_blake3 = false;
+	}
+#	endif
+#	ifndef HAVE_LIBCRYPTO
+	/* BLAKE3 is all we've got */
+	_use_blake3 = true;
+#	endif
+
+	size_t count = 0;
+	while (files[count])
+		++count;
+
+	_entries = std::vector<Entry>(count);
+	if (_cache_path)
+		load_cache();
+
+	_pending = count;
+	_pool.reset(new WorkerPool());
+	for (size_t i = 0; i < count; ++i)
+		_pool->submit(std::bind(&DigestStore::process, this, i));
+
+	enabled = true;
+#else
+	std::cerr << "Digest support disabled at build time." << std::endl;
+#endif
+}
+
+/**
+ * DigestStore::~DigestStore
+ *
+ * Stop the hashing threads and save whatever was computed to the cache.
+ */
+DigestStore::~DigestStore()
+{
+	if (!enabled)
+		return;
+
+	_pool->stop();
+	_pool.reset(nullptr);
+	if (_cache_path && _pending)
+		save_cache();
+}
+
+#ifdef HAVE_LIBCRYPTO
+/**
+ * finish_piece
+ * @ctx: piece digest context
+ * @pieces: piece hash list
+ *
+ * Append the digest of the current piece to @pieces and restart @ctx
+ * for the next one.
+ *
+ * Returns: true on success
+ */
+static bool finish_piece(EVP_MD_CTX* ctx, std::vector<unsigned char>& pieces)
+{
+	size_t pos = pieces.size();
+
+	pieces.resize(pos + 32);
+	return EVP_DigestFinal_ex(ctx, &pieces[pos], NULL)
+		&& EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+}
+#endif
+
+/**
+ * DigestStore::hash_file
+ * @fd: open file descriptor
+ * @out: digest output
+ *
+ * Read the whole file @fd and compute its digests.
+ *
+ * Returns: true on success, false on read error or shutdown
+ */
+bool DigestStore::hash_file(int fd, Digests& out)
+{
+#ifdef HAVE_DIGESTS
+#ifdef HAVE_LIBCRYPTO
+	std::unique_ptr<EVP_MD_CTX, std::function<void(EVP_MD_CTX*)>>
+		sha256{EVP_MD_CTX_new(), EVP_MD_CTX_free};
+	if (!sha256)
+		throw std::bad_alloc();
+	if (!EVP_DigestInit_ex(sha256.get(), EVP_sha256(), NULL))
+		throw std::runtime_error("EVP_DigestInit_ex() failed");
+
+	std::unique_ptr<EVP_MD_CTX, std::function<void(EVP_MD_CTX*)>>
+		piece{EVP_MD_CTX_new(), EVP_MD_CTX_free};
+	off_t piece_left = _piece_size;
+	if (!piece)
+		throw std::bad_alloc();
+	if (_piece_size && !EVP_DigestInit_ex(piece.get(), EVP_sha256(), NULL))
+		throw std::runtime_error("EVP_DigestInit_ex() failed");
+	out.pieces.clear();
+#endif
+#ifdef HAVE_LIBBLAKE3
+	blake3_hasher blake3;
+	blake3_hasher_init(&blake3);
+#endif
+	std::unique_ptr<unsigned char[]> buf{new unsigned char[read_buf_size]};
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	for (;;)
+	{
+		ssize_t rd = read(fd, buf.get(), read_buf_size);
+
+		if (rd == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		if (rd == 0)
+			break;
+		if (_pool->stopping())
+			return false;
+
+#ifdef HAVE_LIBCRYPTO
+		if (!EVP_DigestUpdate(sha256.get(), buf.get(), rd))
+			throw std::runtime_error("EVP_DigestUpdate() failed");
+
+		/* split the buffer at piece boundaries */
+		for (ssize_t pos = 0; _piece_size && pos < rd; )
+		{
+			ssize_t len = std::min<off_t>(rd - pos, piece_left);
+
+			if (!EVP_DigestUpdate(piece.get(), buf.get() + pos, len))
+				throw std::runtime_error("EVP_DigestUpdate() failed");
+			pos += len;
+			piece_left -= len;
+
+			if (!piece_left)
+			{
+				if (!finish_piece(piece.get(), out.pieces))
+					throw std::runtime_error("EVP_DigestFinal_ex() failed");
+				piece_left = _piece_size;
+			}
+		}
+#endif
+#ifdef HAVE_LIBBLAKE3
+		if (_use_blake3)
+			blake3_hasher_update(&blake3, buf.get(), rd);
+#endif
+	}
+
+#ifdef HAVE_LIBCRYPTO
+	if (!EVP_DigestFinal_ex(sha256.get(), out.sha256, NULL))
+		throw std::runtime_error("EVP_DigestFinal_ex() failed");
+	out.have_sha256 = true;
+
+	if (_piece_size)
+	{
+		/* the last, short piece */
+		if (piece_left != _piece_size
+				&& !finish_piece(piece.get(), out.pieces))
+			throw std::runtime_error("EVP_DigestFinal_ex() failed");
+		out.piece_size = _piece_size;
+	}
+#endif
+#ifdef HAVE_LIBBLAKE3
+	if (_use_blake3)
+	{
+		blake3_hasher_finalize(&blake3, out.blake3, sizeof(out.blake3));
+		out.have_blake3 = true;
+	}
+#endif
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ * DigestStore::publish
+ * @ent: entry with digests filled in
+ *
+ * Prepare the header values for @ent and mark it ready for use.
+ */
+void DigestStore::publish(Entry& ent)
+{
+	const Digests& d = ent.digests;
+
+	if (d.have_sha256)
+	{
+		ent.repr = "sha-256=:" + to_base64(d.sha256, sizeof(d.sha256)) + ':';
+		ent.sha256_hex = to_hex(d.sha256, sizeof(d.sha256));
+	}
+	if (d.have_blake3 && _use_blake3)
+	{
+		if (!ent.repr.empty())
+			ent.repr += ", ";
+		ent.repr += "blake3=:" + to_base64(d.blake3, sizeof(d.blake3)) + ':';
+	}
+
+	ent.ready.store(true, std::memory_order_release);
+}
+
+/**
+ * DigestStore::process
+ * @idx: index of the file in the served list
+ *
+ * Compute (or take from the cache) digests for a single served file.
+ * Called in a worker thread.
+ */
+void DigestStore::process(size_t idx)
+{
+	const char* path = _files[idx];
+	Entry& ent = _entries[idx];
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd == -1)
+		std::cerr << "open() failed for " << path << " (digest): "
+			<< strerror(errno) << std::endl;
+	else
+	{
+		struct stat st;
+
+		if (fstat(fd, &st))
+			std::cerr << "fstat() failed for " << path << " (digest): "
+				<< strerror(errno) << std::endl;
+		else if (S_ISREG(st.st_mode))
+		{
+			ent.key = FileKey(st);
+
+			auto cached = _cache.find(ent.key);
+			if (cached != _cache.end()
+#ifdef HAVE_LIBCRYPTO
+					&& cached->second.have_sha256
+#endif
+					&& (!_use_blake3 || cached->second.have_blake3)
+					&& cached->second.piece_size == _piece_size)
+			{
+				ent.digests = cached->second;
+				publish(ent);
+			}
+			else if (hash_file(fd, ent.digests))
+			{
+				++_hashed;
+				publish(ent);
+			}
+			else if (!_pool->stopping())
+				std::cerr << "read() failed for " << path << " (digest): "
+					<< strerror(errno) << std::endl;
+		}
+
+		close(fd);
+	}
+
+	if (--_pending == 0)
+	{
+		std::cerr << "Digests ready for " << _entries.size() << " files ("
+			<< _hashed << " hashed, " << _entries.size() - _hashed
+			<< " cached or skipped)." << std::endl;
+		if (_cache_path && _hashed)
+			save_cache();
+	}
+}
+
+/**
+ * DigestStore::load_cache
+ *
+ * Load the persistent digest cache from disk. A missing or invalid cache
+ * is not an error, it will just be regenerated.
+ */
+void DigestStore::load_cache()
+{
+	std::ifstream f{_cache_path};
+	std::string line;
+
+	if (!f || !std::getline(f, line) || line != cache_magic)
+		return;
+
+	while (std::getline(f, line))
+	{
+		std::istringstream ls{line};
+		FileKey key;
+		Digests d;
+		std::string field;
+
+		if (!(ls >> key.dev >> key.ino >> key.size >> key.mtime
+					>> key.mtime_nsec))
+			continue;
+
+		while (ls >> field)
+		{
+			if (!field.compare(0, 8, "sha-256="))
+				d.have_sha256 = from_hex(field.substr(8),
+						d.sha256, sizeof(d.sha256));
+			else if (!field.compare(0, 7, "blake3="))
+				d.have_blake3 = from_hex(field.substr(7),
+						d.blake3, sizeof(d.blake3));
+			else if (!field.compare(0, 7, "pieces="))
+			{
+				/* pieces=<size>:<hex>... */
+				size_t colon = field.find(':');
+				if (colon == std::string::npos)
+					continue;
+
+				std::string hex{field.substr(colon + 1)};
+				d.pieces.resize(hex.size() / 2);
+				if (from_hex(hex, d.pieces.data(), d.pieces.size())
+						&& d.pieces.size() % 32 == 0)
+					d.piece_size = strtoll(&field[7], NULL, 10);
+				else
+					d.pieces.clear();
+			}
+		}
+
+		_cache[key] = d;
+	}
+}
+
+/**
+ * DigestStore::save_cache
+ *
+ * Merge computed digests into the cache and write it back to disk.
+ * The file is replaced atomically.
+ */
+void DigestStore::save_cache()
+{
+	std::lock_guard<std::mutex> lk{_cache_lock};
+	std::unordered_map<FileKey, Digests, FileKeyHash> merged{_cache};
+
+	for (const Entry& ent : _entries)
+	{
+		if (ent.ready.load(std::memory_order_acquire))
+			merged[ent.key] = ent.digests;
+	}
+
+	std::string tmp_path{_cache_path};
+	tmp_path += ".tmp";
+
+	std::ofstream f{tmp_path, std::ios::trunc};
+	f << cache_magic << '\n';
+	for (const auto& it : merged)
+	{
+		const FileKey& k = it.first;
+		const Digests& d = it.second;
+
+		f << k.dev << ' ' << k.ino << ' ' << k.size << ' ' << k.mtime
+			<< ' ' << k.mtime_nsec;
+		if (d.have_sha256)
+			f << " sha-256=" << to_hex(d.sha256, sizeof(d.sha256));
+		if (d.have_blake3)
+			f << " blake3=" << to_hex(d.blake3, sizeof(d.blake3));
+		if (d.piece_size)
+			f << " pieces=" << d.piece_size << ':'
+				<< to_hex(d.pieces.data(), d.pieces.size());
+		f << '\n';
+	}
+	f.close();
+
+	if (!f || rename(tmp_path.c_str(), _cache_path))
+	{
+		std::cerr << "Unable to write digest cache " << _cache_path << ": "
+			<< strerror(errno) << std::endl;
+		unlink(tmp_path.c_str());
+	}
+}
+
+/**
+ * DigestStore::repr_digest
+ * @idx: index of the file in the served list
+ * @st: current stat of the file
+ *
+ * Get the Repr-Digest header value for the served file. If the file has
+ * changed since it was hashed (according to @st), no digest is returned.
+ *
+ * Returns: header value or %NULL if the digest is not available (yet)
+ */
+const char* DigestStore::repr_digest(size_t idx, const struct stat& st) const
+{
+	if (!enabled || idx >= _entries.size())
+		return NULL;
+
+	const Entry& ent = _entries[idx];
+	if (!ent.ready.load(std::memory_order_acquire) || !(ent.key == FileKey(st)))
+		return NULL;
+	return ent.repr.c_str();
+}
+
+/**
+ * DigestStore::sha256_hex
+ * @idx: index of the file in the served list
+ *
+ * Returns: hex SHA-256 of the served file, or %NULL if not available (yet)
+ */
+const char* DigestStore::sha256_hex(size_t idx) const
+{
+	if (!enabled || idx >= _entries.size())
+		return NULL;
+
+	const Entry& ent = _entries[idx];
+	if (!ent.ready.load(std::memory_order_acquire) || ent.sha256_hex.empty())
+		return NULL;
+	return ent.sha256_hex.c_str();
+}
+
+/**
+ * DigestStore::get
+ * @idx: index of the file in the served list
+ * @size: location to store the size of the hashed file
+ *
+ * Returns: all digests computed for the served file, or %NULL if not
+ * available (yet)
+ */
+const Digests* DigestStore::get(size_t idx, off_t& size) const
+{
+	if (!enabled || idx >= _entries.size())
+		return NULL;
+
+	const Entry& ent = _entries[idx];
+	if (!ent.ready.load(std::memory_order_acquire))
+		return NULL;
+	size = ent.key.size;
+	return &ent.digests;
+}
@@ -0,0 +1,98 @@
+/* pshs -- content digest support
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+#ifndef _PSHS_DIGEST_H
+#define _PSHS_DIGEST_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+class WorkerPool;
+
+struct FileKey
+{
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	long mtime_nsec;
+
+	FileKey();
+	FileKey(const struct stat& st);
+
+	bool operator==(const FileKey& other) const;
+};
+
+struct FileKeyHash
+{
+	size_t operator()(const FileKey& key) const;
+};
+
+struct Digests
+{
+	unsigned char sha256[32];
+	unsigned char blake3[32];
+	bool have_sha256;
+	bool have_blake3;
+
+	/* SHA-256 of consecutive @piece_size chunks, 32 bytes each */
+	off_t piece_size;
+	std::vector<unsigned char> pieces;
+
+	Digests() : have_sha256(false), have_blake3(false), piece_size(0) {}
+};
+
+class DigestStore
+{
+	struct Entry
+	{
+		FileKey key;
+		Digests digests;
+		std::string repr;
+		std::string sha256_hex;
+		std::atomic<bool> ready;
+
+		Entry() : ready(false) {}
+	};
+
+	char* const* _files;
+	std::vector<Entry> _entries;
+	std::unique_ptr<WorkerPool> _pool;
+
+	const char* _cache_path;
+	std::unordered_map<FileKey, Digests, FileKeyHash> _cache;
+	std::mutex _cache_lock;
+	std::atomic<size_t> _pending;
+	std::atomic<size_t> _hashed;
+	bool _use_blake3;
+	off_t _piece_size;
+
+	void process(size_t idx);
+	bool hash_file(int fd, Digests& out);
+	void publish(Entry& ent);
+	void load_cache();
+	void save_cache();
+
+public:
+	DigestStore(char* const* files, bool enable, const char* cache_path,
+			bool use_blake3, off_t piece_size);
+	~DigestStore();
+
+	const char* repr_digest(size_t idx, const struct stat& st) const;
+	const char* sha256_hex(size_t idx) const;
+	const Digests* get(size_t idx, off_t& size) const;
+
+	bool enabled;
+};
+
+#endif /*_PSHS_DIGEST_H*/
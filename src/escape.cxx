@@ -0,0 +1,631 @@
+/* pshs -- URI encoding and HTML escaping
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <new>
+
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#	include <immintrin.h>
+#	define HAVE_AVX2_KERNEL 1
+#elif defined(__SSE2__)
+#	include <emmintrin.h>
+#endif
+
+#include "escape.h"
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+/* percent-encoded form of every byte value; unreserved characters
+ * (RFC 3986) are kept as-is, like evhttp_encode_uri() does */
+struct UriTable
+{
+	struct
+	{
+		char chars[3];
+		unsigned char len;
+	} codes[256];
+
+	UriTable()
+		: codes()
+	{
+		for (int c = 0; c < 256; ++c)
+		{
+			if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+					|| (c >= '0' && c <= '9')
+					|| c == '-' || c == '.' || c == '_' || c == '~')
+			{
+				codes[c].chars[0] = c;
+				codes[c].len = 1;
+			}
+			else
+			{
+				codes[c].chars[0] = '%';
+				codes[c].chars[1] = hex_digits[c >> 4];
+				codes[c].chars[2] = hex_digits[c & 0xf];
+				codes[c].len = 3;
+			}
+		}
+	}
+};
+
+static const UriTable uri_table;
+
+/**
+ * encode_byte
+ * @out: output position, with room for 3 bytes
+ * @c: input byte
+ *
+ * Write @c, percent-encoded unless it is an unreserved character.
+ * All three bytes are always written, to avoid a branch.
+ *
+ * Returns: new output position
+ */
+static inline char* encode_byte(char* out, unsigned char c)
+{
+	memcpy(out, uri_table.codes[c].chars, 3);
+	return out + uri_table.codes[c].len;
+}
+
+/**
+ * escape_byte
+ * @out: output position
+ * @c: input byte
+ *
+ * Write @c, replaced with an entity if it is special in HTML, like
+ * evhttp_htmlescape() does.
+ *
+ * Returns: new output position
+ */
+static inline char* escape_byte(char* out, char c)
+{
+	const char* repl;
+	size_t repl_len;
+
+	switch (c)
+	{
+		case '<': repl = "&lt;"; repl_len = 4; break;
+		case '>': repl = "&gt;"; repl_len = 4; break;
+		case '"': repl = "&quot;"; repl_len = 6; break;
+		case '\'': repl = "&#039;"; repl_len = 6; break;
+		case '&': repl = "&amp;"; repl_len = 5; break;
+		default:
+			*out++ = c;
+			return out;
+	}
+
+	memcpy(out, repl, repl_len);
+	return out + repl_len;
+}
+
+static size_t uri_encode_scalar(char* out, const char* in, size_t len)
+{
+	char* start = out;
+
+	for (size_t i = 0; i < len; ++i)
+		out = encode_byte(out, in[i]);
+	return out - start;
+}
+
+static size_t html_escape_scalar(char* out, const char* in, size_t len)
+{
+	char* start = out;
+
+	for (size_t i = 0; i < len; ++i)
+		out = escape_byte(out, in[i]);
+	return out - start;
+}
+
+/* The vector kernels classify a whole block at once, and store it as-is
+ * if no byte needs escaping (which is the common case for file names).
+ * Otherwise, the clean prefix is kept and the rest of the block is done
+ * byte by byte. The block is stored before it is checked; this is safe
+ * since the output has room for at least the block length.
+ *
+ * In names with spaces or accented letters, most URI blocks are mixed,
+ * and classifying them only costs time (and mispredicted branches) over
+ * the scalar loop. So uri_encode() leaves names mixed from the start to
+ * the scalar loop, and the URI kernels hand the rest of the input over
+ * to it after a mixed block. The AVX2 one does so only once both halves
+ * of a block are mixed, since it can still encode the non-ASCII halves
+ * in between in bulk. */
+
+#if defined(HAVE_AVX2_KERNEL) || defined(__SSE2__)
+/**
+ * uri_encode_rest
+ * @out: output position, where the mixed block is stored already
+ * @in: the mixed block
+ * @len: length of the input left, starting with the block
+ * @clean: mask of unreserved bytes in the block, not all of them set
+ *
+ * Returns: length of the output, from @out on
+ */
+static inline size_t uri_encode_rest(char* out, const char* in, size_t len,
+		unsigned int clean)
+{
+	unsigned int run = __builtin_ctz(~clean);
+
+	return run + uri_encode_scalar(out + run, in + run, len - run);
+}
+
+/**
+ * unreserved_sse2
+ * @v: input block
+ *
+ * Returns: mask of bytes in @v that are unreserved characters
+ */
+static inline __m128i unreserved_sse2(__m128i v)
+{
+	/* x - lo < n (unsigned) is done as signed compare with both sides
+	 * offset by -128 */
+	__m128i alpha = _mm_cmplt_epi8(
+			_mm_add_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)),
+				_mm_set1_epi8(0x80 - 'a')),
+			_mm_set1_epi8(-128 + 26));
+	__m128i digit = _mm_cmplt_epi8(
+			_mm_add_epi8(v, _mm_set1_epi8(0x80 - '0')),
+			_mm_set1_epi8(-128 + 10));
+	__m128i other = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('-')),
+				_mm_cmpeq_epi8(v, _mm_set1_epi8('.'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('_')),
+				_mm_cmpeq_epi8(v, _mm_set1_epi8('~'))));
+
+	return _mm_or_si128(_mm_or_si128(alpha, digit), other);
+}
+
+/**
+ * special_sse2
+ * @v: input block
+ *
+ * Returns: mask of bytes in @v that are special in HTML
+ */
+static inline __m128i special_sse2(__m128i v)
+{
+	return _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('<')),
+				_mm_cmpeq_epi8(v, _mm_set1_epi8('>'))),
+			_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+					_mm_cmpeq_epi8(v, _mm_set1_epi8('\''))),
+				_mm_cmpeq_epi8(v, _mm_set1_epi8('&'))));
+}
+
+static size_t uri_encode_sse2(char* out, const char* in, size_t len)
+{
+	char* start = out;
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		unsigned int clean = _mm_movemask_epi8(unreserved_sse2(v));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), v);
+		if (clean == 0xffff)
+		{
+			out += 16;
+			continue;
+		}
+
+		return out - start + uri_encode_rest(out, in + i, len - i, clean);
+	}
+
+	return out - start + uri_encode_scalar(out, in + i, len - i);
+}
+
+static size_t html_escape_sse2(char* out, const char* in, size_t len)
+{
+	char* start = out;
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		unsigned int special = _mm_movemask_epi8(special_sse2(v));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), v);
+		if (!special)
+		{
+			out += 16;
+			continue;
+		}
+
+		unsigned int run = __builtin_ctz(special);
+		out += run;
+		for (size_t j = i + run; j < i + 16; ++j)
+			out = escape_byte(out, in[j]);
+	}
+
+	return out - start + html_escape_scalar(out, in + i, len - i);
+}
+#endif
+
+#ifdef HAVE_AVX2_KERNEL
+__attribute__((target("avx2")))
+static inline __m256i unreserved_avx2(__m256i v)
+{
+	__m256i alpha = _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 26),
+			_mm256_add_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)),
+				_mm256_set1_epi8(0x80 - 'a')));
+	__m256i digit = _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 10),
+			_mm256_add_epi8(v, _mm256_set1_epi8(0x80 - '0')));
+	__m256i other = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('-')),
+				_mm256_cmpeq_epi8(v, _mm256_set1_epi8('.'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')),
+				_mm256_cmpeq_epi8(v, _mm256_set1_epi8('~'))));
+
+	return _mm256_or_si256(_mm256_or_si256(alpha, digit), other);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i special_avx2(__m256i v)
+{
+	return _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')),
+				_mm256_cmpeq_epi8(v, _mm256_set1_epi8('>'))),
+			_mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+					_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\''))),
+				_mm256_cmpeq_epi8(v, _mm256_set1_epi8('&'))));
+}
+
+/* pshufb indices spreading the hex digits of 16 bytes over three blocks
+ * as %XX triplets (0x80 yields zero) */
+alignas(16) static const signed char expand_hi[3][16] =
+{
+	{ -128, 0, -128, -128, 1, -128, -128, 2, -128, -128, 3, -128, -128, 4, -128, -128 },
+	{ 5, -128, -128, 6, -128, -128, 7, -128, -128, 8, -128, -128, 9, -128, -128, 10 },
+	{ -128, -128, 11, -128, -128, 12, -128, -128, 13, -128, -128, 14, -128, -128, 15, -128 },
+};
+alignas(16) static const signed char expand_lo[3][16] =
+{
+	{ -128, -128, 0, -128, -128, 1, -128, -128, 2, -128, -128, 3, -128, -128, 4, -128 },
+	{ -128, 5, -128, -128, 6, -128, -128, 7, -128, -128, 8, -128, -128, 9, -128, -128 },
+	{ 10, -128, -128, 11, -128, -128, 12, -128, -128, 13, -128, -128, 14, -128, -128, 15 },
+};
+alignas(16) static const char expand_pct[3][16] =
+{
+	{ '%', 0, 0, '%', 0, 0, '%', 0, 0, '%', 0, 0, '%', 0, 0, '%' },
+	{ 0, 0, '%', 0, 0, '%', 0, 0, '%', 0, 0, '%', 0, 0, '%', 0 },
+	{ 0, '%', 0, 0, '%', 0, 0, '%', 0, 0, '%', 0, 0, '%', 0, 0 },
+};
+
+/**
+ * encode_block_avx2
+ * @out: output position
+ * @v: input block, with no unreserved characters
+ *
+ * Percent-encode all 16 bytes of @v. This is the common case for names
+ * in non-Latin scripts, where every byte of UTF-8 needs encoding.
+ *
+ * Returns: new output position
+ */
+__attribute__((target("avx2")))
+static inline char* encode_block_avx2(char* out, __m128i v)
+{
+	const __m128i digits = _mm_loadu_si128(
+			reinterpret_cast<const __m128i*>(hex_digits));
+	const __m128i nibble = _mm_set1_epi8(0xf);
+	__m128i hi = _mm_shuffle_epi8(digits,
+			_mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+	__m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, nibble));
+
+	for (int k = 0; k < 3; ++k)
+	{
+		__m128i o = _mm_or_si128(
+				_mm_or_si128(
+					_mm_shuffle_epi8(hi, _mm_load_si128(
+							reinterpret_cast<const __m128i*>(expand_hi[k]))),
+					_mm_shuffle_epi8(lo, _mm_load_si128(
+							reinterpret_cast<const __m128i*>(expand_lo[k])))),
+				_mm_load_si128(reinterpret_cast<const __m128i*>(expand_pct[k])));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16 * k), o);
+	}
+
+	return out + 48;
+}
+
+__attribute__((target("avx2")))
+static size_t uri_encode_avx2(char* out, const char* in, size_t len)
+{
+	char* start = out;
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256(
+				reinterpret_cast<const __m256i*>(in + i));
+		unsigned int clean = _mm256_movemask_epi8(unreserved_avx2(v));
+
+		if (clean == 0xffffffff)
+		{
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v);
+			out += 32;
+			continue;
+		}
+
+		unsigned int lo = clean & 0xffff;
+		unsigned int hi = clean >> 16;
+		if (lo && lo != 0xffff && hi && hi != 0xffff)
+		{
+			/* the wide registers are not used past this point */
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v);
+			_mm256_zeroupper();
+			return out - start + uri_encode_rest(out, in + i, len - i, clean);
+		}
+
+		/* the block is split in halves, so that runs of non-ASCII
+		 * characters can still be encoded in bulk */
+		for (int half = 0; half < 2; ++half)
+		{
+			__m128i hv = half ? _mm256_extracti128_si256(v, 1)
+				: _mm256_castsi256_si128(v);
+			unsigned int hclean = (clean >> (16 * half)) & 0xffff;
+			size_t base = i + 16 * half;
+
+			if (!hclean)
+			{
+				out = encode_block_avx2(out, hv);
+				continue;
+			}
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), hv);
+			if (hclean == 0xffff)
+			{
+				out += 16;
+				continue;
+			}
+
+			unsigned int run = __builtin_ctz(~hclean);
+			out += run;
+			for (size_t j = base + run; j < base + 16; ++j)
+				out = encode_byte(out, in[j]);
+		}
+	}
+
+	_mm256_zeroupper();
+	return out - start + uri_encode_sse2(out, in + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t html_escape_avx2(char* out, const char* in, size_t len)
+{
+	char* start = out;
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256(
+				reinterpret_cast<const __m256i*>(in + i));
+		unsigned int special = _mm256_movemask_epi8(special_avx2(v));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v);
+		if (!special)
+		{
+			out += 32;
+			continue;
+		}
+
+		unsigned int run = __builtin_ctz(special);
+		out += run;
+		for (size_t j = i + run; j < i + 32; ++j)
+			out = escape_byte(out, in[j]);
+	}
+
+	_mm256_zeroupper();
+	return out - start + html_escape_sse2(out, in + i, len - i);
+}
+#endif
+
+/* in order of preference, the best supported one is last */
+static const EscapeKernel kernels[] =
+{
+	{ "scalar", uri_encode_scalar, html_escape_scalar },
+#if defined(HAVE_AVX2_KERNEL) || defined(__SSE2__)
+	{ "sse2", uri_encode_sse2, html_escape_sse2 },
+#endif
+#ifdef HAVE_AVX2_KERNEL
+	{ "avx2", uri_encode_avx2, html_escape_avx2 },
+#endif
+};
+
+/**
+ * escape_kernels
+ * @count: location to store the number of kernels in
+ *
+ * Get the escaping kernels supported by the CPU, so that they can be
+ * verified and benchmarked against each other.
+ *
+ * Returns: the kernel array, with the one in use last
+ */
+const EscapeKernel* escape_kernels(size_t& count)
+{
+	count = sizeof(kernels) / sizeof(*kernels);
+#ifdef HAVE_AVX2_KERNEL
+	__builtin_cpu_init();
+	if (!__builtin_cpu_supports("avx2"))
+		--count;
+#endif
+	return kernels;
+}
+
+/**
+ * best_kernel
+ *
+ * Returns: the fastest kernel supported by the CPU
+ */
+static const EscapeKernel& best_kernel()
+{
+	static const EscapeKernel* best = nullptr;
+
+	if (!best)
+	{
+		size_t count;
+		best = &escape_kernels(count)[count - 1];
+	}
+	return *best;
+}
+
+/**
+ * uri_encode
+ * @out: output, with room for at least @len * uri_encode_ratio bytes
+ * @in: input string
+ * @len: length of the input
+ *
+ * Percent-encode @in like evhttp_encode_uri(), without allocating memory.
+ * The output is not null-terminated.
+ *
+ * Returns: length of the output
+ */
+size_t uri_encode(char* out, const char* in, size_t len)
+{
+#if defined(HAVE_AVX2_KERNEL) || defined(__SSE2__)
+	/* names mixed from the start gain nothing from the vector kernels */
+	if (len >= 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+		unsigned int clean = _mm_movemask_epi8(unreserved_sse2(v));
+
+		if (clean && clean != 0xffff)
+			return uri_encode_scalar(out, in, len);
+	}
+#endif
+	return best_kernel().uri_encode(out, in, len);
+}
+
+/**
+ * html_escape
+ * @out: output, with room for at least @len * html_escape_ratio bytes
+ * @in: input string
+ * @len: length of the input
+ *
+ * Escape @in like evhttp_htmlescape(), without allocating memory.
+ * The output is not null-terminated.
+ *
+ * Returns: length of the output
+ */
+size_t html_escape(char* out, const char* in, size_t len)
+{
+	return best_kernel().html_escape(out, in, len);
+}
+
+/**
+ * json_escape
+ * @out: output, with room for at least @len * json_escape_ratio bytes
+ * @in: input string
+ * @len: length of the input
+ *
+ * Escape @in for use in a JSON string. Bytes over 0x7f are copied
+ * as they are. The output is not null-terminated.
+ *
+ * Returns: length of the output
+ */
+size_t json_escape(char* out, const char* in, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	char* p = out;
+
+	for (size_t i = 0; i < len; ++i)
+	{
+		unsigned char c = in[i];
+
+		if (c == '"' || c == '\\')
+		{
+			*p++ = '\\';
+			*p++ = c;
+		}
+		else if (c < 0x20 || c == 0x7f)
+		{
+			memcpy(p, "\\u00", 4);
+			p[4] = hex[c >> 4];
+			p[5] = hex[c & 15];
+			p += 6;
+		}
+		else
+			*p++ = c;
+	}
+
+	return p - out;
+}
+
+/**
+ * add_escaped
+ * @buf: target buffer
+ * @str: input string
+ * @ratio: maximum output bytes per input byte
+ * @fn: escaping function
+ *
+ * Append @str to @buf escaped by @fn. The output is written straight
+ * into space reserved in the buffer, without a temporary copy.
+ */
+static void add_escaped(struct evbuffer* buf, const char* str, size_t ratio,
+		size_t (*fn)(char*, const char*, size_t))
+{
+	size_t len = strlen(str);
+	struct evbuffer_iovec vec;
+
+	if (!len)
+		return;
+	if (evbuffer_reserve_space(buf, len * ratio, &vec, 1) != 1)
+		throw std::bad_alloc();
+
+	vec.iov_len = fn(static_cast<char*>(vec.iov_base), str, len);
+	evbuffer_commit_space(buf, &vec, 1);
+}
+
+/**
+ * add_uri_encoded
+ * @buf: target buffer
+ * @str: string to encode
+ *
+ * Append percent-encoded @str to @buf.
+ */
+void add_uri_encoded(struct evbuffer* buf, const char* str)
+{
+	add_escaped(buf, str, uri_encode_ratio, uri_encode);
+}
+
+/**
+ * add_html_escaped
+ * @buf: target buffer
+ * @str: string to escape
+ *
+ * Append HTML-escaped @str to @buf.
+ */
+void add_html_escaped(struct evbuffer* buf, const char* str)
+{
+	add_escaped(buf, str, html_escape_ratio, html_escape);
+}
+
+/**
+ * add_json_escaped
+ * @buf: target buffer
+ * @str: string to escape
+ *
+ * Append @str escaped for a JSON string to @buf.
+ */
+void add_json_escaped(struct evbuffer* buf, const char* str)
+{
+	add_escaped(buf, str, json_escape_ratio, json_escape);
+}
+
+/**
+ * uri_encoded
+ * @str: string to encode
+ *
+ * Returns: percent-encoded @str
+ */
+std::string uri_encoded(const char* str)
+{
+	size_t len = strlen(str);
+	std::string ret(len * uri_encode_ratio, '\0');
+
+	ret.resize(uri_encode(&ret[0], str, len));
+	return ret;
+}
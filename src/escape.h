@@ -0,0 +1,39 @@
+/* pshs -- URI encoding and HTML escaping
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+#ifndef _PSHS_ESCAPE_H
+#define _PSHS_ESCAPE_H
+
+#include <string>
+
+#include <stddef.h>
+
+#include <event2/buffer.h>
+
+/* output needs at most this many bytes per input byte */
+static const size_t uri_encode_ratio = 3;
+static const size_t html_escape_ratio = 6;
+static const size_t json_escape_ratio = 6;
+
+struct EscapeKernel
+{
+	const char* name;
+	size_t (*uri_encode)(char* out, const char* in, size_t len);
+	size_t (*html_escape)(char* out, const char* in, size_t len);
+};
+
+const EscapeKernel* escape_kernels(size_t& count);
+
+size_t uri_encode(char* out, const char* in, size_t len);
+size_t html_escape(char* out, const char* in, size_t len);
+size_t json_escape(char* out, const char* in, size_t len);
+
+void add_uri_encoded(struct evbuffer* buf, const char* str);
+void add_html_escaped(struct evbuffer* buf, const char* str);
+void add_json_escaped(struct evbuffer* buf, const char* str);
+std::string uri_encoded(const char* str);
+
+#endif /*_PSHS_ESCAPE_H*/
@@ -0,0 +1,319 @@
+/* pshs -- served file list
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "filelist.h"
+#include "workers.h"
+
+/* names are read straight into arena chunks of this size */
+static const size_t chunk_size = 4 * 1024 * 1024;
+
+/* how many invalid entries to report individually */
+static const size_t max_warnings = 10;
+
+FileList::FileList()
+	: _files{NULL}
+{
+}
+
+/**
+ * FileList::new_chunk
+ * @size: chunk size
+ *
+ * Allocate a new arena chunk.
+ *
+ * Returns: pointer to the chunk
+ */
+char* FileList::new_chunk(size_t size)
+{
+	_chunks.emplace_back(new char[size]);
+	return _chunks.back().get();
+}
+
+/**
+ * FileList::add
+ * @name: file name
+ *
+ * Add @name to the list. The string is not copied, it must outlive the list.
+ * Leading ./ is removed since it is known to cause trouble, and empty names
+ * are skipped.
+ */
+void FileList::add(char* name)
+{
+	if (name[0] == '.' && name[1] == '/')
+		name += 2;
+	if (!*name)
+		return;
+
+	_files.back() = name;
+	_files.push_back(NULL);
+}
+
+/**
+ * FileList::load
+ * @path: path to the list file, or "-" for stdin
+ *
+ * Load file names from @path. The names can be either NUL-delimited
+ * (e.g. find -print0) or newline-delimited, with or without a carriage
+ * return; the former is assumed if a NUL is found in the first block
+ * read.
+ *
+ * Returns: true on success, false on error (reported to stderr)
+ */
+bool FileList::load(const char* path)
+{
+	bool use_stdin = !strcmp(path, "-");
+	int fd = use_stdin ? 0 : open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd == -1)
+	{
+		std::cerr << "Unable to open file list " << path << ": "
+			<< strerror(errno) << std::endl;
+		return false;
+	}
+
+	size_t cap = chunk_size;
+	char* chunk = new_chunk(cap);
+	/* start of the current (incomplete) name, and end of data in chunk */
+	size_t start = 0;
+	size_t used = 0;
+	char delim = '\n';
+	bool first = true;
+	bool ret = true;
+
+	for (;;)
+	{
+		/* keep one byte spare for the terminator of the last name */
+		if (used == cap - 1)
+		{
+			/* move the incomplete name to a new chunk, growing it
+			 * if a single name does not fit */
+			size_t partial = used - start;
+			size_t new_cap = std::max(chunk_size, partial * 2);
+			char* next = new_chunk(new_cap);
+
+			memcpy(next, chunk + start, partial);
+			chunk = next;
+			cap = new_cap;
+			start = 0;
+			used = partial;
+		}
+
+		ssize_t rd = read(fd, chunk + used, cap - 1 - used);
+		if (rd == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			std::cerr << "Unable to read file list " << path << ": "
+				<< strerror(errno) << std::endl;
+			ret = false;
+			break;
+		}
+		if (rd == 0)
+			break;
+
+		char* p = chunk + used;
+		char* end = p + rd;
+		if (first)
+		{
+			if (memchr(p, '\0', rd))
+				delim = '\0';
+			first = false;
+		}
+
+		used += rd;
+		while ((p = static_cast<char*>(memchr(p, delim, end - p))))
+		{
+			/* lists written on Windows end lines with \r\n */
+			if (delim == '\n' && p > chunk + start && p[-1] == '\r')
+				p[-1] = '\0';
+			*p++ = '\0';
+			add(chunk + start);
+			start = p - chunk;
+		}
+	}
+
+	/* last name may lack the trailing delimiter */
+	if (ret && start < used)
+	{
+		if (delim == '\n' && chunk[used - 1] == '\r')
+			--used;
+		chunk[used] = '\0';
+		add(chunk + start);
+	}
+
+	if (!use_stdin)
+		close(fd);
+	return ret;
+}
+
+/**
+ * check_file
+ * @path: file path
+ *
+ * Check whether @path can be served.
+ *
+ * Returns: 0 if it can, errno value or -1 (not a regular file) otherwise
+ */
+static int check_file(const char* path)
+{
+	struct stat st;
+
+	if (stat(path, &st))
+		return errno;
+	if (!S_ISREG(st.st_mode))
+		return -1;
+	if (faccessat(AT_FDCWD, path, R_OK, AT_EACCESS))
+		return errno;
+	return 0;
+}
+
+/**
+ * FileList::validate
+ * @report: whether to report progress and timing
+ *
+ * Stat all files on the list in parallel, and remove those that do not
+ * exist, are not regular files or are not readable. The removed files
+ * are reported to stderr.
+ *
+ * Returns: true if any files are left on the list
+ */
+bool FileList::validate(bool report)
+{
+	const size_t count = size();
+	std::vector<int> results(count);
+	std::atomic<size_t> checked{0};
+	auto start_time = std::chrono::steady_clock::now();
+	bool progress = report && isatty(2);
+
+	{
+		WorkerPool pool;
+		const size_t slices = std::min(count, pool.size() * 16);
+		std::mutex lock;
+		std::condition_variable cond;
+		size_t done_slices = 0;
+
+		for (size_t s = 0; s < slices; ++s)
+		{
+			pool.submit([&, s]() {
+				size_t first = count * s / slices;
+				size_t last = count * (s + 1) / slices;
+
+				for (size_t i = first; i < last; ++i)
+				{
+					results[i] = check_file(_files[i]);
+					checked.fetch_add(1, std::memory_order_relaxed);
+				}
+
+				std::lock_guard<std::mutex> lk{lock};
+				++done_slices;
+				cond.notify_one();
+			});
+		}
+
+		std::unique_lock<std::mutex> lk{lock};
+		while (!cond.wait_for(lk, std::chrono::milliseconds(250),
+					[&] { return done_slices == slices; }))
+		{
+			if (progress)
+				std::cerr << "\rValidating files: " << checked
+					<< '/' << count << std::flush;
+		}
+	}
+
+	size_t invalid = 0;
+	size_t out = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!results[i])
+		{
+			_files[out++] = _files[i];
+			continue;
+		}
+
+		if (invalid++ < max_warnings)
+		{
+			std::cerr << (progress ? "\r" : "") << "Skipping "
+				<< _files[i] << ": " << (results[i] == -1
+						? "not a regular file" : strerror(results[i]))
+				<< std::endl;
+		}
+	}
+	_files.resize(out);
+	_files.push_back(NULL);
+
+	if (invalid > max_warnings)
+		std::cerr << "... and " << invalid - max_warnings
+			<< " more files skipped." << std::endl;
+
+	if (report)
+	{
+		std::chrono::duration<double> elapsed{
+			std::chrono::steady_clock::now() - start_time};
+
+		std::cerr << (progress ? "\r" : "") << "Validated " << count
+			<< " files in " << std::fixed << std::setprecision(3)
+			<< elapsed.count() << " s (" << invalid << " skipped)."
+			<< std::defaultfloat << std::endl;
+	}
+
+	return out > 0;
+}
+
+/**
+ * FileList::finish
+ *
+ * Index the names once the list is complete, so that requests do not
+ * have to walk it.
+ */
+void FileList::finish()
+{
+	_sorted.resize(size());
+	for (size_t i = 0; i < _sorted.size(); ++i)
+		_sorted[i] = i;
+	/* stable, so that the first of duplicate names is found, as before */
+	std::stable_sort(_sorted.begin(), _sorted.end(),
+			[this](size_t a, size_t b) {
+				return strcmp(_files[a], _files[b]) < 0;
+			});
+}
+
+/**
+ * FileList::find
+ * @name: requested path
+ *
+ * Returns: index of the file called @name on the list, or -1 if it is
+ * not served
+ */
+ssize_t FileList::find(const char* name) const
+{
+	auto it = std::lower_bound(_sorted.begin(), _sorted.end(), name,
+			[this](size_t i, const char* n) {
+				return strcmp(_files[i], n) < 0;
+			});
+
+	if (it == _sorted.end() || strcmp(_files[*it], name))
+		return -1;
+	return *it;
+}
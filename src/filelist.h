@@ -0,0 +1,41 @@
+/* pshs -- served file list
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+#ifndef _PSHS_FILELIST_H
+#define _PSHS_FILELIST_H
+
+#include <memory>
+#include <vector>
+
+#include <stddef.h>
+#include <sys/types.h>
+
+class FileList
+{
+	/* arena holding names read from --files-from */
+	std::vector<std::unique_ptr<char[]>> _chunks;
+	/* null-terminated, like argv */
+	std::vector<char*> _files;
+	/* indices into _files, sorted by name */
+	std::vector<size_t> _sorted;
+
+	char* new_chunk(size_t size);
+
+public:
+	FileList();
+
+	void add(char* name);
+	bool load(const char* path);
+	bool validate(bool report);
+	void finish();
+
+	ssize_t find(const char* name) const;
+
+	char* const* files() const { return _files.data(); }
+	size_t size() const { return _files.size() - 1; }
+};
+
+#endif /*_PSHS_FILELIST_H*/
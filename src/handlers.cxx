@@ -5,11 +5,11 @@
 
 #include "config.h"
 
-#include <functional>
 #include <iostream>
-#include <memory>
 #include <sstream>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -29,12 +29,31 @@
 #include <event2/event.h>
 
 #include "handlers.h"
+#include "archive.h"
+#include "cluster.h"
+#include "conn.h"
 #include "content-type.h"
+#include "digest.h"
+#include "escape.h"
+#include "filelist.h"
 #include "index.h"
+#include "metalink.h"
 #include "network.h"
+#include "opener.h"
+#include "probes.h"
+#include "proxy.h"
+#include "request.h"
+#include "status.h"
+#include "stream.h"
+#include "tcp.h"
 
 char ct_buf[80];
 
+/* requested paths are decoded into this buffer; the handlers run only
+ * in the event loop thread, and it is reused to avoid allocating memory
+ * for every request */
+static std::vector<char> path_buf;
+
 /**
  * init_charset
  * @charset: new charset or %NULL
@@ -51,26 +70,6 @@ void init_charset(const char* charset)
 	}
 }
 
-/**
- * has_file
- * @path: requested path
- * @served: null-terminated served file list
- *
- * Check whether requested @path is on the @served list.
- *
- * Returns: 1 if it is, 0 otherwise
- */
-static int has_file(const char* path, char* const* served)
-{
-	for (; *served; served++)
-	{
-		if (!strcmp(path, *served))
-			return 1;
-	}
-
-	return 0;
-}
-
 /**
  * print_req
  * @req: the request object
@@ -91,30 +90,375 @@ static void print_req(struct evhttp_request* req)
 
 	assert(conn);
 	evhttp_connection_get_peer(conn, &addr, &port);
-	std::cout << '[' << IPAddrPrinter(addr, port) << "] "
-		<< uri << std::endl;
+	/* behind a proxy, log the real client */
+	const char* real_addr = proxy_peer(conn, port);
+	std::cout << '[' << IPAddrPrinter(real_addr ? real_addr : addr, port)
+		<< "] " << uri << std::endl;
 }
 
 /**
- * handle_close
- * @conn: the connection
- * @data: unused
+ * handle_metalink
+ * @req: the request object
+ * @cb_data: callback data
+ * @vpath: requested path, with prefix removed
  *
- * Handle the connection close event.
+ * Handle the request for a Metalink manifest of a served file, i.e.
+ * the file name followed by the Metalink suffix. The suffix is stripped
+ * from @vpath in place.
+ *
+ * Returns: true if the request was handled, false if @vpath does not
+ * refer to a manifest
  */
-void handle_close(struct evhttp_connection* conn, void* data)
+static bool handle_metalink(struct evhttp_request* req,
+		const struct callback_data* cb_data, char* vpath)
 {
-#if LIBEVENT_VERSION_NUMBER >= 0x02020000
-	const char* addr;
-#else
-	char* addr;
+	size_t len = strlen(vpath);
+	const size_t suffix_len = strlen(metalink_suffix);
+
+	if (!cb_data->digests || len <= suffix_len
+			|| strcmp(&vpath[len - suffix_len], metalink_suffix))
+		return false;
+
+	/* strip the suffix in place */
+	vpath[len - suffix_len] = '\0';
+	const char* name = vpath;
+	ssize_t file_idx = cb_data->file_list->find(name);
+	if (file_idx == -1)
+		return false;
+
+	struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
+	assert(headers);
+	evhttp_add_header(headers, "Server", PACKAGE_NAME "/" PACKAGE_VERSION);
+
+	off_t size;
+	const Digests* digests = cb_data->digests->get(file_idx, size);
+	if (!digests)
+	{
+		/* still hashing */
+		evhttp_add_header(headers, "Retry-After", "10");
+		evhttp_send_error(req, 503, "Service Unavailable");
+		return true;
+	}
+
+	/* Metalink wants absolute URLs, use whatever the client used */
+	std::stringstream url;
+	const char* host = evhttp_find_header(
+			evhttp_request_get_input_headers(req), "Host");
+	if (host)
+		url << (cb_data->ssl ? "https://" : "http://") << host;
+	url << '/';
+	if (cb_data->prefix)
+		url << cb_data->prefix << '/';
+	url << uri_encoded(name);
+
+	struct evbuffer* buf = evbuffer_new();
+	if (!buf)
+		throw std::bad_alloc();
+	generate_metalink(buf, name, url.str().c_str(), size, *digests);
+
+	if (evhttp_add_header(headers, "Content-Type", metalink_content_type))
+		throw std::bad_alloc();
+	PSHS_PROBE(reply__headers, req, 200, evbuffer_get_length(buf));
+	evhttp_send_reply(req, 200, "OK", buf);
+	evbuffer_free(buf);
+	return true;
+}
+
+/**
+ * add_file
+ * @buf: the output buffer
+ * @fd: open file
+ * @offset: offset of the first byte to send
+ * @length: number of bytes to send
+ * @split: size of the first part, 0 to add the file as a whole
+ *
+ * Add the file contents to @buf, taking ownership of @fd. If the file is
+ * larger than @split, it is added as two chains so that it is written in
+ * two separate SSL_write() calls, and TLS record size changes made while
+ * sending the first part apply to the rest.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+static int add_file(struct evbuffer* buf, int fd, ev_off_t offset,
+		ev_off_t length, unsigned long split)
+{
+	if (!split || length <= static_cast<ev_off_t>(split))
+		return evbuffer_add_file(buf, fd, offset, length);
+
+	struct evbuffer_file_segment* seg = evbuffer_file_segment_new(fd,
+			offset, length, EVBUF_FS_CLOSE_ON_FREE);
+	if (!seg)
+		return evbuffer_add_file(buf, fd, offset, length);
+
+	/* the chains hold their own references */
+	int ret = evbuffer_add_file_segment(buf, seg, 0, split);
+	if (!ret)
+		ret = evbuffer_add_file_segment(buf, seg, split, length - split);
+	evbuffer_file_segment_free(seg);
+	return ret;
+}
+
+/**
+ * plan_reply
+ * @r: the reply to fill in
+ * @cb_data: callback data
+ * @req: the request object
+ * @st: stat of the open file
+ * @file_idx: index of the file on the served list, if not a member
+ * @member: the archive member to send, or %NULL to send the whole file
+ *
+ * Work out the response to a file request from the Range and conditional
+ * request headers, and format the headers that depend on them. Nothing
+ * is added to the response yet, and no memory is allocated.
+ */
+void plan_reply(FileReply& r, const struct callback_data* cb_data,
+		struct evhttp_request* req, const struct stat& st,
+		ssize_t file_idx, ArchiveMember* member)
+{
+	struct evkeyvalq* inhead = evhttp_request_get_input_headers(req);
+	ev_off_t size = member ? member->size : st.st_size;
+	const char* range;
+	intmax_t first, last;
+
+	assert(inhead);
+
+	r.offset = member ? member->offset : 0;
+	r.length = 0;
+	r.content_range[0] = '\0';
+	r.link[0] = '\0';
+	make_validators(r.validators, st, r.offset, size,
+			member ? member->mtime : st.st_mtime);
+
+	if (not_modified(evhttp_find_header(inhead, "If-None-Match"),
+				evhttp_find_header(inhead, "If-Modified-Since"), r.validators))
+	{
+		r.code = 304;
+		r.reason = "Not Modified";
+		return;
+	}
+
+	range = evhttp_find_header(inhead, "Range");
+	/* the client has a different version, send it the whole file */
+	if (range && !range_allowed(evhttp_find_header(inhead, "If-Range"),
+				r.validators))
+		range = NULL;
+	switch (parse_range(range, size, first, last))
+	{
+		case RANGE_INVALID:
+			r.code = 501;
+			r.reason = "Not Implemented";
+			return;
+		case RANGE_UNSATISFIABLE:
+			r.code = 416;
+			r.reason = "Requested Range Not Satisfiable";
+			return;
+		case RANGE_NONE:
+		case RANGE_OK:
+			break;
+	}
+	/* never send anything outside the file, with archive members
+	 * that would be the other members */
+	if (first < 0 || (size != 0 && (first > last || last >= size)))
+	{
+		r.code = 416;
+		r.reason = "Requested Range Not Satisfiable";
+		return;
+	}
+
+	if (cb_data->digests && !member)
+	{
+		/* Point segmented downloaders at the piece hashes
+		 * (RFC 6249), at the path the index links to. Names that
+		 * do not fit when fully encoded go without. */
+		const char* name = cb_data->files[file_idx];
+		size_t name_len = strlen(name);
+		int prefix_len = snprintf(r.link, sizeof(r.link), "</%s%s",
+				cb_data->prefix ? cb_data->prefix : "",
+				cb_data->prefix ? "/" : "");
+		size_t pos = prefix_len;
+
+		if (prefix_len > 0 && pos < sizeof(r.link)
+				&& name_len < (sizeof(r.link) - pos) / uri_encode_ratio)
+		{
+			pos += uri_encode(&r.link[pos], name, name_len);
+			int len = snprintf(&r.link[pos], sizeof(r.link) - pos,
+					"%s>; rel=describedby; type=\"%s\"",
+					metalink_suffix, metalink_content_type);
+			if (len < 0 || static_cast<size_t>(len) >= sizeof(r.link) - pos)
+				r.link[0] = '\0';
+		}
+		else
+			r.link[0] = '\0';
+	}
+
+	r.code = 200;
+	r.reason = "OK";
+	if (range)
+	{
+		snprintf(r.content_range, sizeof(r.content_range),
+				"bytes %" PRIdMAX "-%" PRIdMAX "/%" PRIdMAX,
+				first, last, static_cast<intmax_t>(size));
+		r.code = 206;
+		r.reason = "Partial Content";
+	}
+
+	r.offset += first;
+	r.length = size != 0 ? last - first + 1 : 0;
+}
+
+/**
+ * reply_file
+ * @req: the request object
+ * @cb_data: callback data
+ * @fd: open file, owned by the reply from now on
+ * @st: stat of @fd
+ * @file_idx: index of the file on the served list, if not a member
+ * @member: the archive member to send, or %NULL to send the whole file
+ * @type: Content-Type of the file
+ *
+ * Send the file (or the archive member) honoring Range and conditional
+ * request headers, with the correct headers.
+ */
+static void reply_file(struct evhttp_request* req,
+		const struct callback_data* cb_data, int fd, const struct stat& st,
+		ssize_t file_idx, ArchiveMember* member, const char* type)
+{
+	struct evhttp_connection* conn = evhttp_request_get_connection(req);
+	struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
+
+	const char* name = member ? member->name : cb_data->files[file_idx];
+	FileReply r;
+
+	assert(headers);
+
+	plan_reply(r, cb_data, req, st, file_idx, member);
+	if (evhttp_add_header(headers, "ETag", r.validators.etag)
+			|| evhttp_add_header(headers, "Last-Modified",
+				r.validators.last_modified))
+		throw std::bad_alloc();
+
+	switch (r.code)
+	{
+		case 304:
+			evhttp_add_header(headers, "Server",
+					PACKAGE_NAME "/" PACKAGE_VERSION);
+			PSHS_PROBE(reply__headers, req, 304, 0);
+			evhttp_send_reply(req, r.code, r.reason, NULL);
+			close(fd);
+			return;
+		case 416:
+		case 501:
+			evhttp_send_error(req, r.code, r.reason);
+			close(fd);
+			return;
+	}
+
+	/* Advertise range support */
+	evhttp_add_header(headers, "Accept-Ranges", "bytes");
+	/* Be proud! */
+	evhttp_add_header(headers, "Server", PACKAGE_NAME "/" PACKAGE_VERSION);
+
+	/* Good Content-Type is nice for users. */
+	if (evhttp_add_header(headers, "Content-Type", type))
+		throw std::bad_alloc();
+
+	/* Let clients verify the download. */
+	if (cb_data->digests && !member)
+	{
+		const char* digest = cb_data->digests->repr_digest(file_idx, st);
+		if (digest && evhttp_add_header(headers, "Repr-Digest", digest))
+			throw std::bad_alloc();
+	}
+	if (r.link[0] && evhttp_add_header(headers, "Link", r.link))
+		throw std::bad_alloc();
+	if (r.content_range[0]
+			&& evhttp_add_header(headers, "Content-Range", r.content_range))
+		throw std::bad_alloc();
+
+	/* Send the file. */
+	size_t queued = r.length;
+	PSHS_PROBE(reply__headers, req, r.code, r.length);
+	if (cb_data->conns->stream(req, r.length))
+		queued = cb_data->conns->send_file(req, r.code, r.reason,
+				fd, r.offset, r.length, cb_data->ssl_record_boost);
+	else
+	{
+		struct evbuffer* buf = evbuffer_new();
+#if 0 /* breaks ssl support */
+		evbuffer_set_flags(buf, EVBUFFER_FLAG_DRAINS_TO_FD);
 #endif
-	ev_uint16_t port;
+		if (r.length)
+		{
+			PSHS_PROBE(file__segment, req, 0, r.length);
+			add_file(buf, fd, r.offset, r.length, cb_data->ssl_record_boost);
+		}
+		else
+			close(fd);
+		evhttp_send_reply(req, r.code, r.reason, buf);
+		evbuffer_free(buf);
+	}
 
-	assert(conn);
-	evhttp_connection_get_peer(conn, &addr, &port);
-	std::cout << '[' << IPAddrPrinter(addr, port)
-		<< "] connection closed" << std::endl;
+	if (cb_data->tcp->cork && queued)
+		cork_response(evhttp_connection_get_bufferevent(conn), queued);
+	cb_data->conns->track(req, name, r.length, queued);
+}
+
+/**
+ * route_file
+ * @cb_data: callback data
+ * @uri: requested URI, without the leading slash
+ * @file_idx: set to the index of the requested file on the served list,
+ * or -1
+ * @member: set to the requested archive member, or %NULL
+ *
+ * Decode the requested path and look it up among the served files
+ * and archive members.
+ *
+ * Returns: the decoded path, valid until the next request, or %NULL
+ * if it is outside the prefix or invalid
+ */
+char* route_file(const struct callback_data* cb_data, const char* uri,
+		ssize_t& file_idx, ArchiveMember*& member)
+{
+	char* path = resolve_path(uri, cb_data->prefix, cb_data->prefix_len,
+			path_buf);
+
+	file_idx = -1;
+	member = NULL;
+	if (!path)
+		return NULL;
+
+	file_idx = cb_data->file_list->find(path);
+	if (file_idx == -1 && cb_data->archives)
+		member = cb_data->archives->find(path);
+	return path;
+}
+
+/**
+ * redirect_to_peer
+ * @req: the request object
+ * @url: URL the peer serves the files at
+ * @path: requested file
+ *
+ * Redirect the request to the same file on another instance.
+ *
+ * Returns: true if redirected, false if the Location header could not
+ * be added and the file should be served locally instead
+ */
+static bool redirect_to_peer(struct evhttp_request* req, const char* url,
+		const char* path)
+{
+	struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
+	std::string location{url};
+
+	location += uri_encoded(path);
+	if (evhttp_add_header(headers, "Location", location.c_str()))
+		return false;
+	evhttp_add_header(headers, "Server", PACKAGE_NAME "/" PACKAGE_VERSION);
+
+	PSHS_PROBE(reply__headers, req, 302, 0);
+	evhttp_send_reply(req, 302, "Found", NULL);
+	return true;
 }
 
 /**
@@ -122,11 +466,12 @@ void handle_close(struct evhttp_connection* conn, void* data)
  * @req: the request object
  * @data: served file list
  *
- * Handle the request for regular file. Check whether the file is served, get
- * its type, send correct headers and the file contents.
+ * Handle the request for regular file or archive member. Check whether
+ * the file is served, and have it opened (off the event loop, unless
+ * there are no opener threads) to be sent.
  *
- * If file is not served, 404 is sent back. If file is unreadable somehow, 500
- * is sent instead.
+ * If file is not served, 404 is sent back. If too many files are being
+ * opened already, 503 is sent instead.
  */
 void handle_file(struct evhttp_request* req, void* data)
 {
@@ -137,135 +482,72 @@ void handle_file(struct evhttp_request* req, void* data)
 	assert(vpath);
 	assert(conn);
 
-	/* Report connection being closed. */
-	evhttp_connection_set_closecb(conn, handle_close, 0);
+	cb_data->conns->request(req);
+	PSHS_PROBE(request__start, req, vpath);
 
 	/* Chop the leading slash. */
 	assert(vpath[0] == '/');
 	vpath++;
 
-	print_req(req);
+	if (!cb_data->conns->quiet())
+		print_req(req);
 
-	std::unique_ptr<char, std::function<void(char*)>>
-		dpath{evhttp_decode_uri(vpath), free};
+	ssize_t file_idx;
+	ArchiveMember* member;
+	char* path = route_file(cb_data, vpath, file_idx, member);
+	if (!path)
+	{
+		evhttp_send_error(req, 404, "Not Found");
+		return;
+	}
 
-	if (!dpath)
+	vpath = path;
+	if (cb_data->stream && !strcmp(vpath, cb_data->stream->name()))
 	{
-		std::cerr << "Unable to decode URI: " << vpath << std::endl;
-		evhttp_send_error(req, 500, "Internal Server Error");
+		cb_data->stream->serve(req);
 		return;
 	}
 
-	vpath = dpath.get();
-	if (cb_data->prefix)
+	const char* peer = (file_idx != -1 || member) && cb_data->cluster
+		? cb_data->cluster->pick(vpath) : NULL;
+	if (peer && redirect_to_peer(req, peer, vpath))
+		return;
+
+	if (file_idx == -1 && !member)
 	{
-		if (strncmp(vpath, cb_data->prefix, cb_data->prefix_len)
-				|| vpath[cb_data->prefix_len] != '/')
-		{
+		if (!handle_metalink(req, cb_data, path))
 			evhttp_send_error(req, 404, "Not Found");
-			return;
-		}
-		vpath += cb_data->prefix_len + 1;
 	}
-
-	if (!has_file(vpath, cb_data->files))
-		evhttp_send_error(req, 404, "Not Found");
-	else
+	/* continued in handle_file_opened() */
+	else if (!cb_data->opener->open(req, file_idx, member))
 	{
-		int fd = open(vpath, O_RDONLY);
+		struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
 
-		if (fd == -1)
-			std::cerr << "open() failed for " << vpath << ": "
-				<< strerror(errno) << std::endl;
-		else
-		{
-			struct stat st;
-
-			/* we need to have a regular file here,
-			 * with static Content-Length */
-			if (fstat(fd, &st))
-				std::cerr << "fstat() failed for " << vpath << ": "
-					<< strerror(errno) << std::endl;
-			else if (!S_ISREG(st.st_mode))
-				std::cerr << "fstat() says that " << vpath
-					<< "is not a regular file" << std::endl;
-			else
-			{
-				struct evbuffer* buf = evbuffer_new();
-				struct evkeyvalq* inhead = evhttp_request_get_input_headers(req);
-				struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
-
-				const char* range;
-				intmax_t first = 0, last = -1;
-				ev_off_t size = st.st_size;
-
-				assert(inhead);
-				assert(headers);
-
-				range = evhttp_find_header(inhead, "Range");
-				if (range)
-				{
-					/* We support only single byte range,
-					 * so fail on ',' or invalid bytes=%d-%d */
-					if (strchr(range, ',') || sscanf(range,
-								"bytes = %" SCNdMAX " - %" SCNdMAX,
-								&first, &last) < 1)
-					{
-						evhttp_send_error(req, 501, "Not Implemented");
-						close(fd);
-						return;
-					}
-				}
-
-				if (first < 0)
-					first += size;
-				if (last < 0)
-					last += size;
-
-				if (range && first > last)
-				{
-					evhttp_send_error(req, 416, "Requested Range Not Satisfiable");
-					close(fd);
-					return;
-				}
-
-				/* Advertise range support */
-				evhttp_add_header(headers, "Accept-Ranges", "bytes");
-				/* Be proud! */
-				evhttp_add_header(headers, "Server", PACKAGE_NAME "/" PACKAGE_VERSION);
-
-				/* Good Content-Type is nice for users. */
-				if (evhttp_add_header(headers, "Content-Type",
-							cb_data->ct->guess(fd)))
-					throw std::bad_alloc();
-
-				/* Send the file. */
-#if 0 /* breaks ssl support */
-				evbuffer_set_flags(buf, EVBUFFER_FLAG_DRAINS_TO_FD);
-#endif
-				if (size != 0)
-					evbuffer_add_file(buf, fd, first, last - first + 1);
-				if (range)
-				{
-					std::stringstream rangebuf;
-					rangebuf << "bytes " << first << '-' << last << '/' << size;
-
-					if (evhttp_add_header(headers, "Content-Range", rangebuf.str().c_str()))
-						throw std::bad_alloc();
-					evhttp_send_reply(req, 206, "Partial Content", buf);
-				} else
-					evhttp_send_reply(req, 200, "OK", buf);
-
-				evbuffer_free(buf);
-				return;
-			}
-
-			close(fd);
-		}
-		evhttp_send_error(req, 500, "Internal Server Error");
+		evhttp_add_header(headers, "Retry-After", "1");
+		evhttp_send_error(req, 503, "Service Unavailable");
 	}
 }
 
+/**
+ * handle_file_opened
+ * @job: the opened file
+ * @data: callback data
+ *
+ * Send the file requested in handle_file(), once it has been opened.
+ *
+ * If file is unreadable somehow, 500 is sent instead.
+ */
+void handle_file_opened(OpenJob* job, void* data)
+{
+	const struct callback_data* cb_data = static_cast<callback_data*>(data);
+
+	if (job->fd == -1)
+		evhttp_send_error(job->req, 500, "Internal Server Error");
+	else
+		reply_file(job->req, cb_data, job->fd, job->st, job->file_idx,
+				job->member, job->type);
+}
+
 /**
  * handle_index
  * @req: the request object
@@ -279,7 +561,10 @@ void handle_index_with_list(struct evhttp_request* req, void* data)
 	struct evbuffer* buf = evbuffer_new();
 	struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
 
-	print_req(req);
+	cb_data->conns->request(req);
+	PSHS_PROBE(request__start, req, evhttp_request_get_uri(req));
+	if (!cb_data->conns->quiet())
+		print_req(req);
 
 	assert(headers);
 	evhttp_add_header(headers, "Server", PACKAGE_NAME "/" PACKAGE_VERSION);
@@ -287,8 +572,10 @@ void handle_index_with_list(struct evhttp_request* req, void* data)
 				"text/html; charset=utf-8"))
 		throw std::bad_alloc();
 
-	generate_index(buf, cb_data->files);
+	generate_index(buf, cb_data->files, cb_data->digests, cb_data->archives,
+			cb_data->stream ? cb_data->stream->name() : NULL);
 
+	PSHS_PROBE(reply__headers, req, 200, evbuffer_get_length(buf));
 	evhttp_send_reply(req, 200, "OK", buf);
 	evbuffer_free(buf);
 }
@@ -306,12 +593,47 @@ void handle_index_with_redirect(struct evhttp_request* req, void* data)
 	struct evbuffer* buf = evbuffer_new();
 	struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
 
-	print_req(req);
+	cb_data->conns->request(req);
+	PSHS_PROBE(request__start, req, evhttp_request_get_uri(req));
+	if (!cb_data->conns->quiet())
+		print_req(req);
 
 	assert(headers);
 	evhttp_add_header(headers, "Server", PACKAGE_NAME "/" PACKAGE_VERSION);
-	evhttp_add_header(headers, "Location", cb_data->files[0]);
+	if (evhttp_add_header(headers, "Location",
+				uri_encoded(cb_data->files[0]).c_str()))
+		throw std::bad_alloc();
 
+	PSHS_PROBE(reply__headers, req, 302, 0);
 	evhttp_send_reply(req, 302, "Found", buf);
 	evbuffer_free(buf);
 }
+
+/**
+ * handle_status
+ * @req: the request object
+ * @data: callback data
+ *
+ * Send back the status of the transfers as JSON.
+ */
+void handle_status(struct evhttp_request* req, void* data)
+{
+	const struct callback_data* cb_data = static_cast<callback_data*>(data);
+	struct evbuffer* buf = evbuffer_new();
+	struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
+
+	cb_data->conns->request(req);
+	PSHS_PROBE(request__start, req, evhttp_request_get_uri(req));
+
+	assert(headers);
+	evhttp_add_header(headers, "Server", PACKAGE_NAME "/" PACKAGE_VERSION);
+	if (evhttp_add_header(headers, "Content-Type", "application/json")
+			|| evhttp_add_header(headers, "Cache-Control", "no-store"))
+		throw std::bad_alloc();
+
+	status_json(buf, *cb_data->conns, cb_data->opener);
+
+	PSHS_PROBE(reply__headers, req, 200, evbuffer_get_length(buf));
+	evhttp_send_reply(req, 200, "OK", buf);
+	evbuffer_free(buf);
+}
@@ -9,22 +9,76 @@
 
 #include <event2/http.h>
 
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "request.h"
+
 // abstract
+class ArchiveIndex;
+class Cluster;
+class ConnTracker;
 class ContentType;
+class DigestStore;
+class FileList;
+class FileOpener;
+class StreamShare;
+struct ArchiveMember;
+struct OpenJob;
+struct TcpProfile;
 
 struct callback_data
 {
 	const char* prefix;
 	size_t prefix_len;
 	char* const* files;
+	/* the same list, to look the requested names up in */
+	const FileList* file_list;
+	/* archives served alongside, or %NULL */
+	ArchiveIndex* archives;
+	/* live stream, or %NULL */
+	StreamShare* stream;
 
 	ContentType* ct;
+	DigestStore* digests;
+	bool ssl;
+	/* send this many bytes of a file before the rest, so that TLS
+	 * record size can grow in between (0 to send it whole) */
+	unsigned long ssl_record_boost;
+	const TcpProfile* tcp;
+	ConnTracker* conns;
+	/* instances to redirect to under load, or %NULL */
+	Cluster* cluster;
+	FileOpener* opener;
+};
+
+/* the response to a file request, worked out from the request headers */
+struct FileReply
+{
+	Validators validators;
+	/* 200, 206, 304, 416 or 501 */
+	int code;
+	const char* reason;
+	/* the part of the file to send */
+	ev_off_t offset;
+	ev_off_t length;
+	/* Content-Range and Link header values, empty if not sent */
+	char content_range[80];
+	char link[1024];
 };
 
 void init_charset(const char* charset);
 
+char* route_file(const struct callback_data* cb_data, const char* uri,
+		ssize_t& file_idx, ArchiveMember*& member);
+void plan_reply(FileReply& r, const struct callback_data* cb_data,
+		struct evhttp_request* req, const struct stat& st,
+		ssize_t file_idx, ArchiveMember* member);
+
 void handle_file(struct evhttp_request* req, void* data);
+void handle_file_opened(OpenJob* job, void* data);
 void handle_index_with_list(struct evhttp_request* req, void* data);
 void handle_index_with_redirect(struct evhttp_request* neq, void *data);
+void handle_status(struct evhttp_request* req, void* data);
 
 #endif /*_PSHS_HANDLERS_H*/
@@ -5,16 +5,15 @@
 
 #include "config.h"
 
-#include <functional>
-#include <memory>
-#include <stdexcept>
-
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
-#include <event2/http.h>
+#include <event2/buffer.h>
 
+#include "archive.h"
+#include "digest.h"
+#include "escape.h"
 #include "index.h"
 
 /* Building parts of the index page. */
@@ -32,6 +31,10 @@ const char head[] = "<!DOCTYPE html>\n"
 					"bottom: 1cm;"
 					"z-index: -1000;"
 				"}"
+				"code {"
+					"margin-left: 1em;"
+					"color: #888;"
+				"}"
 			"</style>"
 		"</head>"
 		"<body>"
@@ -47,36 +50,73 @@ const char tail[] =
 
 const char filenameprefix[] = "<li><a href='";
 const char filenamemidfix[] = "'>";
-const char filenamesuffix[] = "</a></li>";
+const char filenamesuffix[] = "</a>";
+const char digestprefix[] = "<code>sha256:";
+const char digestsuffix[] = "</code>";
+const char entrysuffix[] = "</li>";
 
 /**
  * generate_index
  * @buf: target buffer
  * @files: filelist
+ * @digests: file digests, or %NULL if disabled
+ * @archives: served archives, or %NULL
+ * @stream: path of the live stream, or %NULL
+ *
+ * Generate HTML index of @stream and files in @filelist, followed by
+ * the members of @archives, and write it to buffer @buf. If digests are enabled,
+ * the SHA-256 of every file that has already been hashed is listed next
+ * to it.
  *
- * Generate HTML index of files in @filelist and write it to buffer @buf.
+ * The short per-file fragments are copied rather than referenced, since
+ * every reference would take a separate buffer chain.
  */
-void generate_index(struct evbuffer* buf, char* const* files)
+void generate_index(struct evbuffer* buf, char* const* files,
+		const DigestStore* digests, const ArchiveIndex* archives,
+		const char* stream)
 {
 	evbuffer_add_reference(buf, head, sizeof(head)-1, NULL, NULL);
 
-	for (; *files; files++)
+	if (stream)
+	{
+		evbuffer_add(buf, filenameprefix, sizeof(filenameprefix)-1);
+		add_uri_encoded(buf, stream);
+		evbuffer_add(buf, filenamemidfix, sizeof(filenamemidfix)-1);
+		add_html_escaped(buf, stream);
+		evbuffer_add(buf, filenamesuffix, sizeof(filenamesuffix)-1);
+		evbuffer_add(buf, entrysuffix, sizeof(entrysuffix)-1);
+	}
+
+	for (size_t i = 0; files[i]; i++)
+	{
+		evbuffer_add(buf, filenameprefix, sizeof(filenameprefix)-1);
+		add_uri_encoded(buf, files[i]);
+		evbuffer_add(buf, filenamemidfix, sizeof(filenamemidfix)-1);
+		add_html_escaped(buf, files[i]);
+		evbuffer_add(buf, filenamesuffix, sizeof(filenamesuffix)-1);
+
+		const char* digest = digests ? digests->sha256_hex(i) : NULL;
+		if (digest)
+		{
+			evbuffer_add(buf, digestprefix, sizeof(digestprefix)-1);
+			evbuffer_add(buf, digest, strlen(digest));
+			evbuffer_add(buf, digestsuffix, sizeof(digestsuffix)-1);
+		}
+
+		evbuffer_add(buf, entrysuffix, sizeof(entrysuffix)-1);
+	}
+
+	if (archives)
 	{
-		std::unique_ptr<char, std::function<void(char*)>>
-			urlenc{evhttp_encode_uri(*files), free},
-			htmlenc{evhttp_htmlescape(*files), free};
-
-		if (!urlenc || !htmlenc)
-			throw std::bad_alloc();
-
-		evbuffer_add_reference(buf, filenameprefix,
-				sizeof(filenameprefix)-1, NULL, NULL);
-		evbuffer_add(buf, urlenc.get(), strlen(urlenc.get()));
-		evbuffer_add_reference(buf, filenamemidfix,
-				sizeof(filenamemidfix)-1, NULL, NULL);
-		evbuffer_add(buf, htmlenc.get(), strlen(htmlenc.get()));
-		evbuffer_add_reference(buf, filenamesuffix,
-				sizeof(filenamesuffix)-1, NULL, NULL);
+		for (const ArchiveMember& m : archives->members())
+		{
+			evbuffer_add(buf, filenameprefix, sizeof(filenameprefix)-1);
+			add_uri_encoded(buf, m.name);
+			evbuffer_add(buf, filenamemidfix, sizeof(filenamemidfix)-1);
+			add_html_escaped(buf, m.name);
+			evbuffer_add(buf, filenamesuffix, sizeof(filenamesuffix)-1);
+			evbuffer_add(buf, entrysuffix, sizeof(entrysuffix)-1);
+		}
 	}
 
 	evbuffer_add_reference(buf, tail, sizeof(tail)-1, NULL, NULL);
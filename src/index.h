@@ -9,6 +9,12 @@
 
 #include <event2/buffer.h>
 
-void generate_index(struct evbuffer* buf, char* const* files);
+// abstract
+class ArchiveIndex;
+class DigestStore;
+
+void generate_index(struct evbuffer* buf, char* const* files,
+		const DigestStore* digests, const ArchiveIndex* archives,
+		const char* stream);
 
 #endif /*_PSHS_INDEX_H*/
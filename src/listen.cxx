@@ -0,0 +1,222 @@
+/* pshs -- inherited listening sockets
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <iostream>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <event2/util.h>
+
+#include "listen.h"
+
+/* first file descriptor passed by systemd */
+static const int listen_fds_start = 3;
+
+/**
+ * get_systemd_listen_fds
+ * @fds: vector to append the descriptors to
+ *
+ * Get the sockets passed via systemd socket activation protocol
+ * (LISTEN_FDS and LISTEN_PID), and unset the variables so that they are
+ * not inherited further.
+ *
+ * Returns: false if the variables are invalid, true otherwise (including
+ * when no sockets were passed)
+ */
+bool get_systemd_listen_fds(std::vector<int>& fds)
+{
+	const char* listen_fds = getenv("LISTEN_FDS");
+	const char* listen_pid = getenv("LISTEN_PID");
+	bool ret = true;
+
+	if (!listen_fds)
+		return true;
+
+	char* end;
+	/* the sockets may be meant for another process */
+	bool ours = true;
+	if (listen_pid)
+	{
+		long pid = strtol(listen_pid, &end, 10);
+		ours = !*end && pid == getpid();
+	}
+
+	if (ours)
+	{
+		long count = strtol(listen_fds, &end, 10);
+		if (*end || count < 0 || count > INT16_MAX)
+		{
+			std::cerr << "Invalid LISTEN_FDS: " << listen_fds << "\n";
+			ret = false;
+		}
+		else
+		{
+			for (long i = 0; i < count; ++i)
+				fds.push_back(listen_fds_start + i);
+		}
+	}
+
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDNAMES");
+	return ret;
+}
+
+/**
+ * listen_unix
+ * @path: socket path
+ * @mode: socket file permissions
+ *
+ * Create a Unix domain stream socket listening at @path. A stale socket
+ * left at @path is replaced, other files are not.
+ *
+ * Returns: the socket, or -1 on error (reported to stderr)
+ */
+int listen_unix(const char* path, mode_t mode)
+{
+	struct sockaddr_un sa = {};
+	struct stat st;
+
+	sa.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sa.sun_path))
+	{
+		std::cerr << "Socket path too long: " << path << "\n";
+		return -1;
+	}
+	strcpy(sa.sun_path, path);
+
+	if (!lstat(path, &st))
+	{
+		if (!S_ISSOCK(st.st_mode))
+		{
+			std::cerr << "Refusing to replace non-socket " << path << "\n";
+			return -1;
+		}
+		unlink(path);
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+	{
+		std::cerr << "socket() failed: " << strerror(errno) << "\n";
+		return -1;
+	}
+
+	if (bind(fd, reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa))
+			|| chmod(path, mode) || listen(fd, SOMAXCONN))
+	{
+		std::cerr << "Unable to listen on " << path << ": "
+			<< strerror(errno) << "\n";
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * attach_listener
+ * @http: the HTTP server
+ * @fd: bound, listening socket
+ * @addr: string to store the socket address in (unix:PATH for Unix
+ * domain sockets)
+ * @port: location to store the socket port in
+ *
+ * Make @http accept connections on an already listening socket, e.g. one
+ * inherited from the parent process.
+ *
+ * Returns: true on success, false on error (reported to stderr)
+ */
+bool attach_listener(struct evhttp* http, int fd, std::string& addr,
+		unsigned int& port)
+{
+	int accepting = 0;
+	socklen_t optlen = sizeof(accepting);
+	if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &accepting, &optlen)
+			|| !accepting)
+	{
+		std::cerr << "File descriptor " << fd
+			<< " is not a listening socket.\n";
+		return false;
+	}
+
+	struct sockaddr_storage ss;
+	socklen_t sslen = sizeof(ss);
+	char buf[INET6_ADDRSTRLEN];
+	const void* binaddr;
+
+	if (getsockname(fd, reinterpret_cast<struct sockaddr*>(&ss), &sslen))
+	{
+		std::cerr << "getsockname(" << fd << ") failed: "
+			<< strerror(errno) << "\n";
+		return false;
+	}
+
+	switch (ss.ss_family)
+	{
+		case AF_INET:
+		{
+			struct sockaddr_in* in = reinterpret_cast<struct sockaddr_in*>(&ss);
+			binaddr = &in->sin_addr;
+			port = ntohs(in->sin_port);
+			break;
+		}
+		case AF_INET6:
+		{
+			struct sockaddr_in6* in = reinterpret_cast<struct sockaddr_in6*>(&ss);
+			binaddr = &in->sin6_addr;
+			port = ntohs(in->sin6_port);
+			break;
+		}
+		case AF_UNIX:
+		{
+			struct sockaddr_un* un = reinterpret_cast<struct sockaddr_un*>(&ss);
+			binaddr = NULL;
+			port = 0;
+			addr = "unix:";
+			addr += un->sun_path;
+			break;
+		}
+		default:
+			std::cerr << "File descriptor " << fd
+				<< " has unsupported address family.\n";
+			return false;
+	}
+
+	if (binaddr)
+	{
+		if (!inet_ntop(ss.ss_family, binaddr, buf, sizeof(buf)))
+		{
+			std::cerr << "inet_ntop() failed: " << strerror(errno) << "\n";
+			return false;
+		}
+		addr = buf;
+	}
+
+	if (evutil_make_socket_nonblocking(fd)
+			|| evutil_make_socket_closeonexec(fd)
+			|| !evhttp_accept_socket_with_handle(http, fd))
+	{
+		std::cerr << "Unable to accept connections on file descriptor "
+			<< fd << ".\n";
+		return false;
+	}
+
+	return true;
+}
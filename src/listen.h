@@ -0,0 +1,22 @@
+/* pshs -- inherited listening sockets
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+#ifndef _PSHS_LISTEN_H
+#define _PSHS_LISTEN_H
+
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <event2/http.h>
+
+bool get_systemd_listen_fds(std::vector<int>& fds);
+int listen_unix(const char* path, mode_t mode);
+bool attach_listener(struct evhttp* http, int fd, std::string& addr,
+		unsigned int& port);
+
+#endif /*_PSHS_LISTEN_H*/
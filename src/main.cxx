@@ -6,18 +6,27 @@
 #include "config.h"
 
 #include <array>
+#include <chrono>
 #include <functional>
+#include <future>
+#include <iomanip>
 #include <iostream>
 #include <memory>
 #include <sstream>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <signal.h>
 
+#include <sys/types.h>
+#include <unistd.h>
+
 #include <getopt.h>
 #include <locale.h>
 #ifdef HAVE_NL_LANGINFO
@@ -27,11 +36,28 @@
 #include <event2/event.h>
 #include <event2/http.h>
 
+#include "archive.h"
+#include "cluster.h"
+#include "conn.h"
 #include "content-type.h"
+#include "digest.h"
+#include "escape.h"
+#include "filelist.h"
 #include "handlers.h"
+#include "listen.h"
 #include "network.h"
+#include "opener.h"
+#include "proxy.h"
 #include "qrencode.h"
+#include "reader.h"
 #include "ssl.h"
+#include "startup.h"
+#include "status.h"
+#include "stream.h"
+#include "tcp.h"
+
+/* buffers of the read engine, shared by all transfers */
+static const unsigned int read_buffers = 256;
 
 /**
  * term_handler
@@ -59,6 +85,42 @@ static void term_handler(evutil_socket_t fd, short what, void* data)
 	event_base_loopbreak(evb);
 }
 
+/* options without a short equivalent */
+enum long_only_opts
+{
+	OPT_BLAKE3 = 0x100,
+	OPT_PIECE_SIZE,
+	OPT_SSL_KEY,
+	OPT_SSL_CACHE,
+	OPT_SSL_SESSIONS,
+	OPT_SSL_TICKET_LIFETIME,
+	OPT_SSL_RECORD_SIZE,
+	OPT_UPNP_LEASE,
+	OPT_LISTEN_FD,
+	OPT_LISTEN,
+	OPT_LISTEN_MODE,
+	OPT_PROXY_PROTOCOL,
+	OPT_TCP_PROFILE,
+	OPT_IDLE_TIMEOUT,
+	OPT_READ_TIMEOUT,
+	OPT_WRITE_TIMEOUT,
+	OPT_MAX_REQUESTS,
+	OPT_MAX_HEADER_SIZE,
+	OPT_OUTPUT_BUDGET,
+	OPT_READ_ENGINE,
+	OPT_OPEN_THREADS,
+	OPT_STATUS,
+	OPT_STATUS_ENDPOINT,
+	OPT_STARTUP_REPORT,
+	OPT_STREAM,
+	OPT_STREAM_BUFFER,
+	OPT_STREAM_LAG,
+	OPT_CLUSTER_PORT,
+	OPT_CLUSTER_PEER,
+	OPT_CLUSTER_URL,
+	OPT_CLUSTER_THRESHOLD,
+};
+
 const struct option opts[] =
 {
 	{ "help", no_argument, NULL, 'h' },
@@ -66,9 +128,44 @@ const struct option opts[] =
 
 	{ "bind", required_argument, NULL, 'b' },
 	{ "port", required_argument, NULL, 'p' },
+	{ "listen-fd", required_argument, NULL, OPT_LISTEN_FD },
+	{ "listen", required_argument, NULL, OPT_LISTEN },
+	{ "listen-mode", required_argument, NULL, OPT_LISTEN_MODE },
+	{ "proxy-protocol", no_argument, NULL, OPT_PROXY_PROTOCOL },
+	{ "tcp-profile", required_argument, NULL, OPT_TCP_PROFILE },
+	{ "idle-timeout", required_argument, NULL, OPT_IDLE_TIMEOUT },
+	{ "read-timeout", required_argument, NULL, OPT_READ_TIMEOUT },
+	{ "write-timeout", required_argument, NULL, OPT_WRITE_TIMEOUT },
+	{ "max-requests", required_argument, NULL, OPT_MAX_REQUESTS },
+	{ "max-header-size", required_argument, NULL, OPT_MAX_HEADER_SIZE },
+	{ "output-budget", required_argument, NULL, OPT_OUTPUT_BUDGET },
+	{ "read-engine", required_argument, NULL, OPT_READ_ENGINE },
+	{ "open-threads", required_argument, NULL, OPT_OPEN_THREADS },
+	{ "status", no_argument, NULL, OPT_STATUS },
+	{ "status-endpoint", no_argument, NULL, OPT_STATUS_ENDPOINT },
+	{ "startup-report", no_argument, NULL, OPT_STARTUP_REPORT },
+	{ "cluster-port", required_argument, NULL, OPT_CLUSTER_PORT },
+	{ "cluster-peer", required_argument, NULL, OPT_CLUSTER_PEER },
+	{ "cluster-url", required_argument, NULL, OPT_CLUSTER_URL },
+	{ "cluster-threshold", required_argument, NULL, OPT_CLUSTER_THRESHOLD },
 	{ "ssl", no_argument, NULL, 's' },
+	{ "ssl-key", required_argument, NULL, OPT_SSL_KEY },
+	{ "ssl-cache", required_argument, NULL, OPT_SSL_CACHE },
+	{ "ssl-sessions", required_argument, NULL, OPT_SSL_SESSIONS },
+	{ "ssl-ticket-lifetime", required_argument, NULL, OPT_SSL_TICKET_LIFETIME },
+	{ "ssl-record-size", required_argument, NULL, OPT_SSL_RECORD_SIZE },
 	{ "no-upnp", no_argument, NULL, 'U' },
+	{ "upnp-lease", required_argument, NULL, OPT_UPNP_LEASE },
 	{ "redirect", no_argument, NULL, 'r' },
+	{ "files-from", required_argument, NULL, 'f' },
+	{ "archive", required_argument, NULL, 'a' },
+	{ "stream", required_argument, NULL, OPT_STREAM },
+	{ "stream-buffer", required_argument, NULL, OPT_STREAM_BUFFER },
+	{ "stream-lag", required_argument, NULL, OPT_STREAM_LAG },
+	{ "digest", no_argument, NULL, 'd' },
+	{ "digest-cache", required_argument, NULL, 'C' },
+	{ "blake3", no_argument, NULL, OPT_BLAKE3 },
+	{ "piece-size", required_argument, NULL, OPT_PIECE_SIZE },
 
 	{ 0, 0, 0, 0 }
 };
@@ -80,14 +177,97 @@ const char opt_help[] =
 "\n"
 #ifdef HAVE_LIBMINIUPNPC
 "    --no-upnp, -U        disable port redirection using UPnP\n"
+"    --upnp-lease S       request UPnP mapping for S seconds and renew it\n"
+"                         periodically (default: 3600, 0 for permanent)\n"
 #endif
 #ifdef HAVE_LIBSSL
 "    --ssl, -s            enable SSL/TLS socket\n"
+"    --ssl-key TYPE       key type: ecdsa (P-256, default), ed25519 or rsa\n"
+"    --ssl-cache FILE     reuse key and certificate from FILE while valid\n"
+"    --ssl-sessions N     size of TLS session cache (default: 1024, 0 disables)\n"
+"    --ssl-ticket-lifetime S\n"
+"                         rotate session ticket keys every S seconds\n"
+"                         (default: 3600, 0 disables tickets)\n"
+"    --ssl-record-size N  send TLS records of N bytes (512..16384) instead\n"
+"                         of growing them from one TCP segment to 16 KiB\n"
 #endif
 "    --bind IP, -b IP     bind the server to IP address\n"
 "    --port N, -p N       set port to listen on (default: random)\n"
+"    --listen-fd FD       accept connections on inherited listening socket FD\n"
+"                         instead of binding (also via LISTEN_FDS)\n"
+"    --listen unix:PATH   listen on Unix domain socket at PATH\n"
+"    --listen-mode MODE   permissions of the socket (octal, default: 0660)\n"
+"    --proxy-protocol     expect PROXY protocol v2 header on connections,\n"
+"                         and log the client address passed in it\n"
+"    --tcp-profile P[,OPT=V...]\n"
+"                         tune sockets for bulk, lan or latency (default:\n"
+"                         kernel settings); OPT is one of sndbuf,\n"
+"                         notsent_lowat, nodelay, cork, congestion, backlog\n"
+"                         or defer_accept\n"
+"    --idle-timeout S     close connections idle for S seconds (default: 60)\n"
+"    --read-timeout S     close connections not sending a complete request\n"
+"                         within S seconds (default: 30)\n"
+"    --write-timeout S    close connections not reading the response for\n"
+"                         S seconds (default: 60)\n"
+"    --max-requests N     close connections after N requests (default: 1000)\n"
+"    --max-header-size N  refuse requests with over N bytes of headers\n"
+"                         (default: 16384)\n"
+"    --output-budget HIGH[,LOW]\n"
+"                         queue at most HIGH KiB of a file per connection,\n"
+"                         and add more when it drains to LOW KiB (default:\n"
+"                         1024,256; 0 to queue the whole file)\n"
+"                         (0 disables any of the above limits)\n"
+"    --read-engine ENGINE read files ahead of the output with io_uring or\n"
+"                         threads, or let the pages fault in while sending\n"
+"                         (io_uring, threads or mmap, default: io_uring\n"
+"                         with --ssl, mmap otherwise)\n"
+"    --open-threads N     open files and guess their types in N threads, so\n"
+"                         that a slow filesystem does not stall the other\n"
+"                         clients (default: 4, 0 to do it in the event loop)\n"
+"    --status             show the transfers in progress on stderr, instead\n"
+"                         of logging requests when stdout is the terminal\n"
+"    --status-endpoint    serve the transfers in progress as JSON at\n"
+"                         /.pshs/status (under the prefix)\n"
+"    --startup-report     print how long each startup phase took\n"
+"    --cluster-port N     exchange the load with other instances serving\n"
+"                         the same files over UDP port N, and redirect\n"
+"                         requests to them when busy\n"
+"    --cluster-peer IP:PORT\n"
+"                         exchange the load with the instance at IP:PORT,\n"
+"                         which has to list this one too (can be given\n"
+"                         multiple times)\n"
+"    --cluster-url URL    URL peers redirect to (default: http://IP:PORT/\n"
+"                         of this instance)\n"
+"    --cluster-threshold N\n"
+"                         redirect requests while sending N files or more\n"
+"                         (default: 8)\n"
 "    --prefix PFX, -P PFX require all URLs to start with the prefix PFX\n"
-"    --redirect, -r       redirect / to a single provided file\n";
+"    --redirect, -r       redirect / to a single provided file\n"
+"    --files-from FILE, -f FILE\n"
+"                         read additional files to serve from FILE (or stdin\n"
+"                         if '-'), one per line or NUL-delimited\n"
+"    --archive FILE, -a FILE\n"
+"                         serve members of the tar or zip (stored, not\n"
+"                         compressed) archive FILE at their paths in it\n"
+"                         (can be given multiple times)\n"
+"    --stream NAME[=FIFO] serve what is written to stdin (or FIFO) at NAME,\n"
+"                         live to all clients at once\n"
+"    --stream-buffer N    keep the last N KiB of the stream for the clients\n"
+"                         (default: 4096)\n"
+"    --stream-lag POLICY  drop clients that fell behind the buffer, or skip\n"
+"                         them ahead to the oldest data kept (drop or skip,\n"
+"                         default: drop)\n"
+"\n"
+"    --digest, -d         compute file digests in background and send them\n"
+"                         in Repr-Digest headers\n"
+"    --digest-cache FILE, -C FILE\n"
+"                         keep computed digests in FILE (implies --digest)\n"
+#ifdef HAVE_LIBBLAKE3
+"    --blake3             compute BLAKE3 digests in addition to SHA-256\n"
+#endif
+"    --piece-size N       hash files in N KiB pieces too, and serve Metalink\n"
+"                         manifests at FILE.meta4 (implies --digest)\n"
+;
 
 int main(int argc, char* argv[])
 {
@@ -99,18 +279,53 @@ int main(int argc, char* argv[])
 	const char* prefix = 0;
 	const char* bindip = NULL;
 	unsigned int port = 0;
+	std::vector<int> listen_fds;
+	std::string listen_addr;
+	const char* listen_path = NULL;
+	mode_t listen_mode = 0660;
+	bool proxy_protocol = false;
+	TcpProfile tcp_profile;
+	bool tcp_tuning = false;
+	ConnLimits limits;
+	enum read_engine read_engine = READ_MMAP;
+	bool read_engine_set = false;
+	unsigned int open_threads = 4;
+	bool status_view = false;
+	bool status_endpoint = false;
+	bool startup_report = false;
+	unsigned int cluster_port = 0;
+	std::vector<const char*> cluster_peers;
+	const char* cluster_url = NULL;
+	unsigned int cluster_threshold = 8;
 	int ssl = false;
+	enum key_type ssl_key = KEYTYPE_ECDSA;
+	const char* ssl_cache = NULL;
+	long ssl_sessions = 1024;
+	long ssl_ticket_lifetime = 3600;
+	long ssl_record_size = 0;
 	bool upnp = true;
+	int upnp_lease = 3600;
 	bool redirect = false;
+	const char* files_from = NULL;
+	std::vector<const char*> archive_paths;
+	const char* stream_name = NULL;
+	const char* stream_source = NULL;
+	size_t stream_buffer = 4096 * 1024;
+	enum stream_policy stream_lag = STREAM_DROP;
+	bool digest = false;
+	const char* digest_cache = NULL;
+	bool blake3 = false;
+	off_t piece_size = 0;
 
 	/* main variables */
+	StartupReport startup;
 	const std::array<int, 5> sigs{ SIGINT, SIGTERM, SIGHUP, SIGUSR1, SIGUSR2 };
 
 	struct callback_data cb_data;
 
 	setlocale(LC_ALL, "");
 
-	while ((opt = getopt_long(argc, argv, "hVb:p:P:sUr", opts, NULL)) != -1)
+	while ((opt = getopt_long(argc, argv, "hVb:p:P:sUrf:a:dC:", opts, NULL)) != -1)
 	{
 		switch (opt)
 		{
@@ -132,15 +347,261 @@ int main(int argc, char* argv[])
 			case 's':
 				ssl = true;
 				break;
+			case OPT_SSL_KEY:
+				if (!strcmp(optarg, "ecdsa"))
+					ssl_key = KEYTYPE_ECDSA;
+				else if (!strcmp(optarg, "ed25519"))
+					ssl_key = KEYTYPE_ED25519;
+				else if (!strcmp(optarg, "rsa"))
+					ssl_key = KEYTYPE_RSA;
+				else
+				{
+					std::cerr << "Invalid key type: " << optarg << "\n";
+					return 1;
+				}
+				break;
+			case OPT_SSL_CACHE:
+				ssl_cache = optarg;
+				break;
+			case OPT_SSL_SESSIONS:
+				ssl_sessions = strtol(optarg, &tmp, 0);
+				if (*tmp || ssl_sessions < 0)
+				{
+					std::cerr << "Invalid session cache size: " << optarg << "\n";
+					return 1;
+				}
+				break;
+			case OPT_SSL_TICKET_LIFETIME:
+				ssl_ticket_lifetime = strtol(optarg, &tmp, 0);
+				if (*tmp || ssl_ticket_lifetime < 0)
+				{
+					std::cerr << "Invalid ticket lifetime: " << optarg << "\n";
+					return 1;
+				}
+				break;
+			case OPT_SSL_RECORD_SIZE:
+				ssl_record_size = strtol(optarg, &tmp, 0);
+				if (*tmp || ssl_record_size < 512 || ssl_record_size > 16384)
+				{
+					std::cerr << "Invalid TLS record size: " << optarg << "\n";
+					return 1;
+				}
+				break;
 			case 'U':
 				upnp = false;
 				break;
+			case OPT_LISTEN_FD:
+			{
+				long fd = strtol(optarg, &tmp, 0);
+				if (*tmp || fd < 0 || fd > INT16_MAX)
+				{
+					std::cerr << "Invalid file descriptor: " << optarg << "\n";
+					return 1;
+				}
+				listen_fds.push_back(fd);
+				break;
+			}
+			case OPT_LISTEN:
+				if (strncmp(optarg, "unix:", 5) || !optarg[5])
+				{
+					std::cerr << "Unsupported listen address: " << optarg
+						<< " (only unix:PATH is supported)\n";
+					return 1;
+				}
+				listen_path = &optarg[5];
+				break;
+			case OPT_LISTEN_MODE:
+				listen_mode = strtol(optarg, &tmp, 8);
+				if (*tmp || listen_mode > 0777)
+				{
+					std::cerr << "Invalid socket mode: " << optarg << "\n";
+					return 1;
+				}
+				break;
+			case OPT_PROXY_PROTOCOL:
+				proxy_protocol = true;
+				break;
+			case OPT_TCP_PROFILE:
+				if (!tcp_profile.parse(optarg))
+					return 1;
+				tcp_tuning = true;
+				break;
+			case OPT_IDLE_TIMEOUT:
+			case OPT_READ_TIMEOUT:
+			case OPT_WRITE_TIMEOUT:
+			{
+				long timeout = strtol(optarg, &tmp, 0);
+				if (*tmp || timeout < 0 || timeout > 86400)
+				{
+					std::cerr << "Invalid timeout: " << optarg << "\n";
+					return 1;
+				}
+				if (opt == OPT_IDLE_TIMEOUT)
+					limits.idle_timeout = timeout;
+				else if (opt == OPT_READ_TIMEOUT)
+					limits.read_timeout = timeout;
+				else
+					limits.write_timeout = timeout;
+				break;
+			}
+			case OPT_MAX_REQUESTS:
+				limits.max_requests = strtoul(optarg, &tmp, 0);
+				if (*tmp || *optarg == '-')
+				{
+					std::cerr << "Invalid request limit: " << optarg << "\n";
+					return 1;
+				}
+				break;
+			case OPT_MAX_HEADER_SIZE:
+				limits.max_headers = strtoul(optarg, &tmp, 0);
+				if (*tmp || *optarg == '-'
+						|| (limits.max_headers && limits.max_headers < 256))
+				{
+					std::cerr << "Invalid header size limit: " << optarg << "\n";
+					return 1;
+				}
+				break;
+			case OPT_OUTPUT_BUDGET:
+				limits.output_high = strtoul(optarg, &tmp, 0) * 1024;
+				limits.output_low = limits.output_high / 4;
+				if (*tmp == ',')
+					limits.output_low = strtoul(tmp + 1, &tmp, 0) * 1024;
+				if (*tmp || *optarg == '-' || limits.output_high > 0x40000000
+						|| (limits.output_high
+							&& limits.output_low >= limits.output_high))
+				{
+					std::cerr << "Invalid output budget: " << optarg << "\n";
+					return 1;
+				}
+				break;
+			case OPT_READ_ENGINE:
+				if (!strcmp(optarg, "io_uring"))
+					read_engine = READ_URING;
+				else if (!strcmp(optarg, "threads"))
+					read_engine = READ_THREADS;
+				else if (!strcmp(optarg, "mmap"))
+					read_engine = READ_MMAP;
+				else
+				{
+					std::cerr << "Invalid read engine: " << optarg << "\n";
+					return 1;
+				}
+				read_engine_set = true;
+				break;
+			case OPT_OPEN_THREADS:
+				open_threads = strtoul(optarg, &tmp, 0);
+				if (*tmp || *optarg == '-' || open_threads > 256)
+				{
+					std::cerr << "Invalid number of open threads: " << optarg
+						<< "\n";
+					return 1;
+				}
+				break;
+			case OPT_STATUS:
+				status_view = true;
+				break;
+			case OPT_STATUS_ENDPOINT:
+				status_endpoint = true;
+				break;
+			case OPT_STARTUP_REPORT:
+				startup_report = true;
+				break;
+			case OPT_CLUSTER_PORT:
+				cluster_port = strtol(optarg, &tmp, 0);
+				if (*tmp || !cluster_port || cluster_port > 0xffff)
+				{
+					std::cerr << "Invalid cluster port: " << optarg << "\n";
+					return 1;
+				}
+				break;
+			case OPT_CLUSTER_PEER:
+				cluster_peers.push_back(optarg);
+				break;
+			case OPT_CLUSTER_URL:
+				cluster_url = optarg;
+				break;
+			case OPT_CLUSTER_THRESHOLD:
+				cluster_threshold = strtoul(optarg, &tmp, 0);
+				if (*tmp || *optarg == '-' || !cluster_threshold)
+				{
+					std::cerr << "Invalid cluster threshold: " << optarg << "\n";
+					return 1;
+				}
+				break;
+			case OPT_UPNP_LEASE:
+				upnp_lease = strtol(optarg, &tmp, 0);
+				/* IGDv2 caps leases at a week */
+				if (*tmp || upnp_lease < 0 || upnp_lease > 604800)
+				{
+					std::cerr << "Invalid UPnP lease duration: " << optarg << "\n";
+					return 1;
+				}
+				break;
 			case 'V':
 				std::cout << PACKAGE_STRING "\n";
 				return 0;
 			case 'r':
 				redirect = true;
 				break;
+			case 'f':
+				files_from = optarg;
+				break;
+			case 'a':
+				archive_paths.push_back(optarg);
+				break;
+			case OPT_STREAM:
+				stream_name = optarg;
+				tmp = strchr(optarg, '=');
+				if (tmp)
+				{
+					*tmp = 0;
+					stream_source = tmp + 1;
+				}
+				if (!*stream_name || (tmp && !*stream_source))
+				{
+					std::cerr << "Invalid stream: " << optarg << "\n";
+					return 1;
+				}
+				break;
+			case OPT_STREAM_BUFFER:
+				stream_buffer = strtoul(optarg, &tmp, 0) * 1024;
+				if (*tmp || *optarg == '-' || stream_buffer < 128 * 1024
+						|| stream_buffer > 0x40000000)
+				{
+					std::cerr << "Invalid stream buffer size: " << optarg << "\n";
+					return 1;
+				}
+				break;
+			case OPT_STREAM_LAG:
+				if (!strcmp(optarg, "drop"))
+					stream_lag = STREAM_DROP;
+				else if (!strcmp(optarg, "skip"))
+					stream_lag = STREAM_SKIP;
+				else
+				{
+					std::cerr << "Invalid stream lag policy: " << optarg << "\n";
+					return 1;
+				}
+				break;
+			case 'C':
+				digest_cache = optarg;
+				/* fallthrough */
+			case 'd':
+				digest = true;
+				break;
+			case OPT_BLAKE3:
+				blake3 = true;
+				break;
+			case OPT_PIECE_SIZE:
+				piece_size = strtol(optarg, &tmp, 0);
+				if (*tmp || piece_size <= 0 || piece_size > 0x100000)
+				{
+					std::cerr << "Invalid piece size: " << optarg << "\n";
+					return 1;
+				}
+				piece_size *= 1024;
+				digest = true;
+				break;
 			default:
 				std::cout << "Usage: " << argv[0] << " [options] file [...]\n\n"
 					<< opt_help;
@@ -149,48 +610,126 @@ int main(int argc, char* argv[])
 	}
 
 	/* no files supplied */
-	if (argc == optind)
+	if (argc == optind && !files_from && archive_paths.empty() && !stream_name)
 	{
 		std::cerr << "Usage: " << argv[0] << " [options] file [...]\n\n"
 			<< opt_help;
 		return 1;
 	}
 
+	FileList files;
+	for (int i = optind; i < argc; ++i)
+		files.add(argv[i]);
+	if (files_from && !files.load(files_from))
+		return 1;
+
+	/* catch missing and unreadable files now rather than at request time */
+	if (!files.validate(files_from != NULL) && archive_paths.empty()
+			&& !stream_name)
+	{
+		std::cerr << "No files to share.\n";
+		return 1;
+	}
+	files.finish();
+
 	/* redirect only supporst a single file */
-	if ((argc == optind - 1) && redirect)
+	if ((files.size() != 1 || !archive_paths.empty() || stream_name)
+			&& redirect)
 	{
 		std::cerr << "--redirect only works with a single file\n";
 		return 1;
 	}
 
-	/* Remove ./ prefixes from filenames, they're known to cause trouble. */
-	for (int i = optind; i < argc; ++i)
+	if (stream_name && !stream_source && files_from
+			&& !strcmp(files_from, "-"))
 	{
-		if (argv[i][0] == '.' && argv[i][1] == '/')
-			argv[i] += 2;
+		std::cerr << "--stream can not read stdin with --files-from -.\n";
+		return 1;
 	}
 
 	void (*handle_index)(evhttp_request*, void*) = redirect
 		? handle_index_with_redirect : handle_index_with_list;
+	startup.done("options and file list");
+
+	ArchiveIndex archives;
+	if (!archive_paths.empty())
+	{
+		auto start_time = std::chrono::steady_clock::now();
+
+		for (const char* path : archive_paths)
+		{
+			if (!archives.add(path))
+				return 1;
+		}
+		archives.finish();
+
+		std::chrono::duration<double> elapsed{
+			std::chrono::steady_clock::now() - start_time};
+		std::cerr << "Indexed " << archives.size() << " members of "
+			<< archives.archives() << " archives in " << std::fixed
+			<< std::setprecision(3) << elapsed.count() << " s."
+			<< std::defaultfloat << std::endl;
+		startup.done("archive index");
+	}
+
+	/* generating the TLS key takes a while, and does not depend on the rest
+	 * of the setup */
+	std::future<std::shared_ptr<SSLKey>> ssl_key_future;
+	if (ssl)
+		ssl_key_future = std::async(std::launch::async, [&] {
+				return startup.time("TLS key", [&] {
+					return ssl_prepare_key(ssl_key, ssl_cache);
+				});
+			});
 
 	srandom(time(NULL));
 
 	cb_data.prefix = prefix;
 	if (prefix)
 		cb_data.prefix_len = strlen(prefix);
-	cb_data.files = &argv[optind];
+	cb_data.files = files.files();
+	cb_data.file_list = &files;
+	cb_data.archives = archives.empty() ? NULL : &archives;
+	cb_data.tcp = &tcp_profile;
 
 	std::unique_ptr<event_base, std::function<void(event_base*)>>
 		evb{event_base_new(), event_base_free};
 	if (!evb)
 		throw std::runtime_error("event_base_new() failed");
 
+	/* TLS copies the file contents anyway, so read them off the loop */
+	if (ssl && !read_engine_set)
+		read_engine = READ_URING;
+	/* needs to outlive the connections, and the buffers queued on them */
+	std::unique_ptr<ReadEngine> reader;
+	if (read_engine != READ_MMAP)
+	{
+		reader.reset(new ReadEngine{evb.get(), read_engine, read_buffers});
+		std::cerr << "Reading files with " << reader->name() << ", "
+			<< reader->buffers() << " buffers of "
+			<< ReadEngine::block_size() / 1024 << " KiB." << std::endl;
+	}
+
 	std::unique_ptr<evhttp, std::function<void(evhttp*)>>
 		http{evhttp_new(evb.get()), evhttp_free};
 	if (!http)
 		throw std::runtime_error("evhttp_new() failed");
 	/* we're just a small download server, GET & HEAD should handle it all */
 	evhttp_set_allowed_methods(http.get(), EVHTTP_REQ_GET | EVHTTP_REQ_HEAD);
+	ConnTracker conns{evb.get(), http.get(), limits};
+	conns.set_reader(reader.get());
+	cb_data.conns = &conns;
+	/* reads the input from now on, whether anyone listens or not */
+	std::unique_ptr<StreamShare> stream;
+	if (stream_name)
+	{
+		int fd = open_stream(stream_source);
+		if (fd == -1)
+			return 1;
+		stream.reset(new StreamShare{evb.get(), &conns, fd, stream_name,
+				stream_buffer, stream_lag});
+	}
+	cb_data.stream = stream.get();
 	/* generic callback - file download */
 	evhttp_set_gencb(http.get(), handle_file, &cb_data);
 	/* index callback */
@@ -203,32 +742,107 @@ int main(int argc, char* argv[])
 
 		evhttp_set_cb(http.get(), index_uri.str().c_str(), handle_index, &cb_data);
 	}
+	if (status_endpoint)
+	{
+		std::stringstream status_uri;
+		status_uri << '/';
+		if (prefix)
+			status_uri << prefix << '/';
+		status_uri << status_path;
+
+		evhttp_set_cb(http.get(), status_uri.str().c_str(), handle_status,
+				&cb_data);
+	}
+
+	/* sockets passed by the service manager or the previous instance */
+	if (!get_systemd_listen_fds(listen_fds))
+		return 1;
 
-	/* if no port was provided, choose a nice random value */
-	if (!port)
+	if ((listen_path || !listen_fds.empty()) && (bindip || port))
 	{
-		/* generate a random port between 0x400 and 0x7fff
-		 * e.g. above the privileged ports but below outgoing */
-		port = random() % 0x7bff + 0x400;
+		std::cerr << "--bind and --port can not be used with --listen "
+			"or inherited sockets.\n";
+		return 1;
 	}
 
-	bool bound = false;
-	if (!bindip)
+	if (listen_path)
 	{
-		/* try :: first, fall back to 0.0.0.0 */
-		bindip = "::";
-		if (!evhttp_bind_socket(http.get(), bindip, port))
-			bound = true;
-		else
-			bindip = "0.0.0.0";
+		int fd = listen_unix(listen_path, listen_mode);
+		if (fd == -1)
+			return 1;
+		listen_fds.push_back(fd);
 	}
-	if (!bound && evhttp_bind_socket(http.get(), bindip, port))
+
+	if (proxy_protocol)
 	{
-		std::cerr << "Unable to bind socket to " << bindip
-			<< ':' << port << "\n";
-		return 1;
+		if (ssl)
+		{
+			std::cerr << "--proxy-protocol can not be used with --ssl.\n";
+			return 1;
+		}
+		conns.set_bevcb(proxy_bev_callback, NULL);
 	}
 
+	/* listening sockets to apply the TCP profile to */
+	std::vector<int> tuned_fds;
+
+	if (!listen_fds.empty())
+	{
+		/* announce the address of the first one */
+		for (int fd : listen_fds)
+		{
+			std::string addr;
+			unsigned int fd_port;
+
+			if (!attach_listener(http.get(), fd, addr, fd_port))
+				return 1;
+			tuned_fds.push_back(fd);
+			if (listen_addr.empty())
+			{
+				listen_addr = addr;
+				port = fd_port;
+			}
+		}
+		bindip = listen_addr.c_str();
+	}
+	else
+	{
+		/* if no port was provided, choose a nice random value */
+		if (!port)
+		{
+			/* generate a random port between 0x400 and 0x7fff
+			 * e.g. above the privileged ports but below outgoing */
+			port = random() % 0x7bff + 0x400;
+		}
+
+		struct evhttp_bound_socket* bound = NULL;
+		if (!bindip)
+		{
+			/* try :: first, fall back to 0.0.0.0 */
+			bindip = "::";
+			bound = evhttp_bind_socket_with_handle(http.get(), bindip, port);
+			if (!bound)
+				bindip = "0.0.0.0";
+		}
+		if (!bound)
+			bound = evhttp_bind_socket_with_handle(http.get(), bindip, port);
+		if (!bound)
+		{
+			std::cerr << "Unable to bind socket to " << bindip
+				<< ':' << port << "\n";
+			return 1;
+		}
+		tuned_fds.push_back(evhttp_bound_socket_get_fd(bound));
+	}
+
+	if (tcp_tuning)
+	{
+		for (int fd : tuned_fds)
+			tcp_profile.apply(fd);
+		tcp_profile.report(tuned_fds.front());
+	}
+	startup.done("listening sockets");
+
 #ifdef HAVE_NL_LANGINFO
 	tmp = nl_langinfo(CODESET);
 	if (!*tmp)
@@ -237,35 +851,120 @@ int main(int argc, char* argv[])
 
 	/* init helper modules */
 	init_charset(tmp);
+	/* loads the magic database once a file needs it */
 	ContentType ct;
 	cb_data.ct = &ct;
-
-	ExternalIP extip{port, bindip, upnp};
-	SSLMod ssl_mod(http.get(), extip.addr, ssl);
-
-	std::cerr << "Ready to share " << argc - optind << " files.\n"
-		"Bound to " << IPAddrPrinter(bindip, port) << '.' << std::endl;
-	if (extip.addr)
-	{
+	DigestStore digests{cb_data.files, digest, digest_cache, blake3,
+		piece_size};
+	cb_data.digests = digests.enabled ? &digests : NULL;
+	startup.done("digest store");
+	FileOpener opener{evb.get(), conns, ct, cb_data.files, cb_data.archives,
+		open_threads, handle_file_opened, &cb_data};
+	cb_data.opener = &opener;
+
+	/* print the URL (and QR code) the server is reachable at */
+	auto announce = [&](const char* addr) {
 		std::stringstream server_uri;
 		server_uri << "http";
 		if (ssl)
 			server_uri << 's';
-		server_uri << "://" << IPAddrPrinter(extip.addr, port) << '/';
+		server_uri << "://" << IPAddrPrinter(addr, port) << '/';
 		if (prefix)
 			server_uri << prefix << '/';
-		if (argc - optind == 1)
-		{
-			std::unique_ptr<char, std::function<void(char*)>>
-				urlenc{evhttp_encode_uri(argv[optind]), free};
-			if (!urlenc)
-				throw std::bad_alloc();
-			server_uri << urlenc.get();
-		}
+		if (files.size() == 1 && archives.empty() && !stream)
+			server_uri << uri_encoded(files.files()[0]);
+		else if (!files.size() && archives.empty() && stream)
+			server_uri << uri_encoded(stream->name());
 
 		std::cerr << "Server reachable at: " << server_uri.str() << std::endl;
 		print_qrcode(server_uri.str().c_str());
+	};
+
+	/* Unix sockets are reachable only locally (or via a proxy) */
+	bool unix_socket = !strncmp(bindip, "unix:", 5);
+
+	/* UPnP runs in background, and announces the external address
+	 * once the port mapping is set up */
+	ExternalIP extip{evb.get(), port, unix_socket ? "localhost" : bindip,
+		upnp && !unix_socket, upnp_lease, announce};
+	startup.done("network interfaces");
+
+	/* the certificate is issued for the address found above */
+	std::shared_ptr<SSLKey> ssl_key_ready;
+	if (ssl)
+	{
+		ssl_key_ready = ssl_key_future.get();
+		startup.done("waiting for TLS key");
 	}
+	SSLMod ssl_mod(extip.addr, ssl, ssl_key, ssl_cache, ssl_key_ready,
+			ssl_sessions, ssl_ticket_lifetime, ssl_record_size);
+	if (ssl_mod.bevcb)
+		conns.set_bevcb(ssl_mod.bevcb, ssl_mod.bevcb_arg);
+	cb_data.ssl = ssl_mod.enabled;
+	cb_data.ssl_record_boost = ssl_mod.record_boost;
+	if (ssl)
+		startup.done("TLS certificate");
+
+	std::unique_ptr<Cluster> cluster;
+	if (cluster_port)
+	{
+		std::stringstream url;
+		const char* addr = unix_socket ? NULL : extip.addr;
+
+		if (cluster_url)
+			url << cluster_url;
+		else if (addr)
+		{
+			url << (ssl ? "https" : "http") << "://"
+				<< IPAddrPrinter(addr, port) << '/';
+			if (prefix)
+				url << prefix << '/';
+		}
+		else
+		{
+			std::cerr << "--cluster-url is needed, the address of this "
+				"instance is not known.\n";
+			return 1;
+		}
+
+		int fd = cluster_socket(unix_socket ? NULL : bindip, cluster_port);
+		if (fd == -1)
+			return 1;
+		cluster.reset(new Cluster{evb.get(), conns, fd, url.str().c_str(),
+				cluster_fingerprint(cb_data.files, cb_data.archives),
+				cluster_threshold});
+		for (const char* peer : cluster_peers)
+		{
+			if (!cluster->add_peer(peer))
+				return 1;
+		}
+		startup.done("cluster");
+	}
+	else if (!cluster_peers.empty() || cluster_url)
+	{
+		std::cerr << "--cluster-peer and --cluster-url need --cluster-port.\n";
+		return 1;
+	}
+	cb_data.cluster = cluster.get();
+
+	startup.ready();
+
+	std::cerr << "Ready to share " << files.size() + archives.size()
+		<< " files";
+	if (stream)
+		std::cerr << " and stream " << stream->name();
+	std::cerr << ".\n";
+	if (unix_socket)
+		std::cerr << "Bound to " << bindip << '.' << std::endl;
+	else
+	{
+		std::cerr << "Bound to " << IPAddrPrinter(bindip, port) << '.'
+			<< std::endl;
+		if (extip.addr)
+			startup.time("URL and QR code", [&] { announce(extip.addr); });
+	}
+	if (startup_report)
+		startup.print(std::cerr);
 
 	std::array<std::unique_ptr<event, std::function<void(event*)>>, sigs.size()>
 		sigevents;
@@ -285,8 +984,25 @@ int main(int argc, char* argv[])
 		std::cerr << "warning: unable to override SIGPIPE, may terminate"
 				"on interrupted connections." << std::endl;
 
+	std::unique_ptr<StatusView> status;
+	if (status_view)
+	{
+		if (!isatty(STDERR_FILENO))
+			std::cerr << "stderr is not a terminal, not showing the status."
+				<< std::endl;
+		else
+		{
+			status.reset(new StatusView{evb.get(), conns});
+			/* the log would scroll the view away */
+			conns.set_quiet(isatty(STDOUT_FILENO));
+		}
+	}
+
 	/* run the loop */
 	event_base_dispatch(evb.get());
 
+	if (listen_path)
+		unlink(listen_path);
+
 	return 0;
 }
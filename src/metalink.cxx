@@ -0,0 +1,87 @@
+/* pshs -- Metalink manifest generation
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <event2/buffer.h>
+
+#include "digest.h"
+#include "escape.h"
+#include "metalink.h"
+
+const char metalink_suffix[] = ".meta4";
+const char metalink_content_type[] = "application/metalink4+xml";
+
+/**
+ * add_hex
+ * @buf: target buffer
+ * @data: binary data
+ * @len: data length
+ *
+ * Append lowercase hex representation of @data to @buf.
+ */
+static void add_hex(struct evbuffer* buf, const unsigned char* data, size_t len)
+{
+	for (size_t i = 0; i < len; ++i)
+		evbuffer_add_printf(buf, "%02x", data[i]);
+}
+
+/**
+ * generate_metalink
+ * @buf: target buffer
+ * @name: served file name
+ * @url: download URL for the file
+ * @size: file size
+ * @digests: file digests
+ *
+ * Generate a Metalink 4 (RFC 5854) document for the file and write it
+ * to buffer @buf. If piece hashes were computed, they are included so that
+ * segmented downloads can verify and retry individual pieces.
+ */
+void generate_metalink(struct evbuffer* buf, const char* name,
+		const char* url, off_t size, const Digests& digests)
+{
+	evbuffer_add_printf(buf,
+			"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+			"<metalink xmlns=\"urn:ietf:params:xml:ns:metalink\">\n"
+			"  <generator>" PACKAGE_NAME "/" PACKAGE_VERSION "</generator>\n"
+			"  <file name=\"");
+	add_html_escaped(buf, name);
+	evbuffer_add_printf(buf, "\">\n"
+			"    <size>%" PRIdMAX "</size>\n",
+			static_cast<intmax_t>(size));
+
+	if (digests.have_sha256)
+	{
+		evbuffer_add_printf(buf, "    <hash type=\"sha-256\">");
+		add_hex(buf, digests.sha256, sizeof(digests.sha256));
+		evbuffer_add_printf(buf, "</hash>\n");
+	}
+
+	if (digests.piece_size)
+	{
+		evbuffer_add_printf(buf,
+				"    <pieces length=\"%" PRIdMAX "\" type=\"sha-256\">\n",
+				static_cast<intmax_t>(digests.piece_size));
+		for (size_t i = 0; i < digests.pieces.size(); i += 32)
+		{
+			evbuffer_add_printf(buf, "      <hash>");
+			add_hex(buf, &digests.pieces[i], 32);
+			evbuffer_add_printf(buf, "</hash>\n");
+		}
+		evbuffer_add_printf(buf, "    </pieces>\n");
+	}
+
+	evbuffer_add_printf(buf, "    <url>");
+	add_html_escaped(buf, url);
+	evbuffer_add_printf(buf, "</url>\n"
+			"  </file>\n"
+			"</metalink>\n");
+}
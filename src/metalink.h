@@ -0,0 +1,23 @@
+/* pshs -- Metalink manifest generation
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+#ifndef _PSHS_METALINK_H
+#define _PSHS_METALINK_H
+
+#include <sys/types.h>
+
+#include <event2/buffer.h>
+
+// abstract
+struct Digests;
+
+extern const char metalink_suffix[];
+extern const char metalink_content_type[];
+
+void generate_metalink(struct evbuffer* buf, const char* name,
+		const char* url, off_t size, const Digests& digests);
+
+#endif /*_PSHS_METALINK_H*/
@@ -5,13 +5,25 @@
 
 #include "config.h"
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <event2/event.h>
+
 #ifdef HAVE_LIBMINIUPNPC
 #	include <miniupnpc/miniupnpc.h>
 #	include <miniupnpc/upnpcommands.h>
@@ -23,122 +35,308 @@
 #ifdef HAVE_LIBMINIUPNPC
 static const int discovery_delay = 1000; /* [ms] */
 
-static struct UPNPUrls upnp_urls;
-static struct IGDdatas upnp_data;
+/* state shared between the main loop and the UPnP thread */
+static struct
+{
+	std::thread thread;
+	std::mutex lock;
+	std::condition_variable cond;
+	bool stopping;
+
+	struct UPNPUrls urls;
+	struct IGDdatas data;
+	char lan_addr[16];
+	/* written by the thread, guarded by lock */
+	char extip[16];
+	/* whether the port mapping exists and needs to be removed */
+	bool mapped;
 
-static char lan_addr[16];
+	/* pipe used to wake up the main loop */
+	int notify_fds[2];
+	std::unique_ptr<event, std::function<void(event*)>> notify_event;
+} upnp;
 
-static int upnp_enabled;
-#endif
+/* owned by the main loop */
+static char upnp_addr[16];
 
 /**
- * ExternalIP::ExternalIP
+ * add_port_mapping
+ * @port: port to map
+ * @lease: lease duration in seconds, 0 for permanent mapping
+ *
+ * Add (or renew) the port mapping for @port.
+ *
+ * Returns: UPnP status code
+ */
+static int add_port_mapping(const char* port, int lease)
+{
+	std::string strlease{std::to_string(lease)};
+
+	return UPNP_AddPortMapping(
+			upnp.urls.controlURL,
+			upnp.data.first.servicetype,
+			port, port, upnp.lan_addr,
+			"Pretty small HTTP server",
+			"TCP",
+			NULL,
+			strlease.c_str());
+}
+
+/**
+ * upnp_thread
  * @port: listening port
  * @bindip: IP the server is bound to
- * @use_upnp: whether UPnP is enabled via config
+ * @lease: mapping lease duration in seconds, 0 for permanent mapping
  *
- * Try to set up port forwardings and get the external IP. This tries to use
- * UPnP first, then falls back to bound IP or searching interfaces via netlink.
+ * Discover the IGD, set up the port forwarding and get the external IP,
+ * then keep renewing the mapping at half of the lease duration until
+ * stopped. The main loop is notified once the external IP is known.
  */
-ExternalIP::ExternalIP(unsigned int port, const char* bindip, bool use_upnp)
-	: _port(port)
+static void upnp_thread(unsigned int port, const char* bindip, int lease)
 {
-#ifdef HAVE_LIBMINIUPNPC
-	/* use UPnP only if user wants to */
-	if (use_upnp)
-	{
-		struct UPNPDev* devlist = upnpDiscover(discovery_delay, bindip, NULL, 0, 0, 2, NULL);
-		static char extip[16];
+	struct UPNPDev* devlist = upnpDiscover(discovery_delay, bindip, NULL, 0, 0, 2, NULL);
+	char extip[16] = "";
 
 #if MINIUPNPC_API_VERSION >= 18
-		int ret = UPNP_GetValidIGD(devlist, &upnp_urls, &upnp_data,
-				lan_addr, sizeof(lan_addr), extip, sizeof(extip));
+	int ret = UPNP_GetValidIGD(devlist, &upnp.urls, &upnp.data,
+			upnp.lan_addr, sizeof(upnp.lan_addr), extip, sizeof(extip));
 #else
-		int ret = UPNP_GetValidIGD(devlist, &upnp_urls, &upnp_data,
-				lan_addr, sizeof(lan_addr));
+	int ret = UPNP_GetValidIGD(devlist, &upnp.urls, &upnp.data,
+			upnp.lan_addr, sizeof(upnp.lan_addr));
 #endif
-		freeUPNPDevlist(devlist);
+	freeUPNPDevlist(devlist);
 
-		/* ret=1 means we've got IGD,
-		 * since API 18, ret=2 means we've got IGD without external IP,
-		 * higher values mean we've got other UPnP device, so we need
-		 * to clean up */
-		upnp_enabled = (ret == 1);
+	/* ret=1 means we've got IGD,
+	 * since API 18, ret=2 means we've got IGD without external IP,
+	 * higher values mean we've got other UPnP device, so we need
+	 * to clean up */
+	bool have_igd = (ret == 1);
 #if MINIUPNPC_API_VERSION >= 18
-		upnp_enabled |= (ret == 2);
+	have_igd |= (ret == 2);
 #endif
-		if (upnp_enabled)
+	if (!have_igd)
+	{
+		if (ret > 0)
+			FreeUPNPUrls(&upnp.urls);
+		std::cerr << "No UPnP IGD found, serving on local address only."
+			<< std::endl;
+		return;
+	}
+
+	/* do not map the port if we are terminating already */
+	{
+		std::lock_guard<std::mutex> lk{upnp.lock};
+		if (upnp.stopping)
 		{
-			/* UPnP likes ASCII */
-			std::string strport{std::to_string(port)};
-
-			/* Set the port forwarding. */
-			ret = UPNP_AddPortMapping(
-					upnp_urls.controlURL,
-					upnp_data.first.servicetype,
-					strport.c_str(), strport.c_str(), lan_addr,
-					"Pretty small HTTP server",
-					"TCP",
-					NULL,
-					NULL);
-			if (ret != UPNPCOMMAND_SUCCESS)
-			{
-				std::cerr << "UPNP_AddPortMapping() failed: " << strupnperror(ret)
-					<< std::endl;
-				upnp_enabled = 0;
-				FreeUPNPUrls(&(upnp_urls));
-			}
-			else
-			{
-				/* And then get external IP. */
+			FreeUPNPUrls(&upnp.urls);
+			return;
+		}
+	}
+
+	/* UPnP likes ASCII */
+	std::string strport{std::to_string(port)};
+
+	/* Set the port forwarding. */
+	ret = add_port_mapping(strport.c_str(), lease);
+	/* OnlyPermanentLeasesSupported */
+	if (ret == 725 && lease)
+	{
+		lease = 0;
+		ret = add_port_mapping(strport.c_str(), lease);
+	}
+	if (ret != UPNPCOMMAND_SUCCESS)
+	{
+		std::cerr << "UPNP_AddPortMapping() failed: " << strupnperror(ret)
+			<< std::endl;
+		FreeUPNPUrls(&upnp.urls);
+		return;
+	}
+
+	/* And then get external IP. */
 #if MINIUPNPC_API_VERSION >= 18
-				if (ret == 1)
+	bool have_extip = (extip[0] != '\0');
 #else
-				if (UPNP_GetExternalIPAddress(
-						upnp_urls.controlURL,
-						upnp_data.first.servicetype,
-						extip) == UPNPCOMMAND_SUCCESS)
+	bool have_extip = (UPNP_GetExternalIPAddress(
+			upnp.urls.controlURL,
+			upnp.data.first.servicetype,
+			extip) == UPNPCOMMAND_SUCCESS);
 #endif
-				{
-					addr = extip;
-					return;
-				}
-			}
-		} else if (ret > 0)
-			FreeUPNPUrls(&(upnp_urls));
+
+	std::unique_lock<std::mutex> lk{upnp.lock};
+	upnp.mapped = true;
+	if (have_extip)
+	{
+		memcpy(upnp.extip, extip, sizeof(extip));
+		if (write(upnp.notify_fds[1], "", 1) == -1)
+			std::cerr << "Unable to notify about the external IP: "
+				<< strerror(errno) << std::endl;
 	}
+
+	/* permanent mappings need no renewal */
+	while (lease && !upnp.cond.wait_for(lk,
+				std::chrono::seconds(std::max(lease / 2, 1)),
+				[] { return upnp.stopping; }))
+	{
+		lk.unlock();
+		ret = add_port_mapping(strport.c_str(), lease);
+		if (ret != UPNPCOMMAND_SUCCESS)
+			std::cerr << "Renewing UPnP port mapping failed: "
+				<< strupnperror(ret) << std::endl;
+		lk.lock();
+	}
+}
+
+/**
+ * ExternalIP::upnp_notify
+ * @fd: read end of the notification pipe
+ * @what: unused
+ * @data: the ExternalIP instance
+ *
+ * Handle the external IP being found by the UPnP thread.
+ */
+void ExternalIP::upnp_notify(evutil_socket_t fd, short what, void* data)
+{
+	ExternalIP* self = static_cast<ExternalIP*>(data);
+	char c;
+
+	if (read(fd, &c, 1) != 1)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lk{upnp.lock};
+		memcpy(upnp_addr, upnp.extip, sizeof(upnp_addr));
+	}
+
+	std::cerr << "UPnP port mapping established." << std::endl;
+	self->addr = upnp_addr;
+	self->_upnp_addr = true;
+	if (self->_announce)
+		self->_announce(self->addr);
+}
 #endif
 
-	/* Fallback to bindip or netlink */
+/**
+ * ExternalIP::local_addr_changed
+ * @new_addr: new best local address, or %NULL if none
+ *
+ * Handle the best local address changing. The new address is announced
+ * unless UPnP provides the external one.
+ */
+void ExternalIP::local_addr_changed(const char* new_addr)
+{
+	if (_upnp_addr)
+		return;
+
+	addr = new_addr;
+	if (!addr)
+		std::cerr << "No usable network address left." << std::endl;
+	else
+	{
+		std::cerr << "Network address changed." << std::endl;
+		if (_announce)
+			_announce(addr);
+	}
+}
+
+/**
+ * ExternalIP::ExternalIP
+ * @evb: the event base to deliver address changes on
+ * @port: listening port
+ * @bindip: IP the server is bound to
+ * @use_upnp: whether UPnP is enabled via config
+ * @upnp_lease: UPnP mapping lease duration in seconds, 0 for permanent
+ * @announce: function called with the new address when it changes
+ *
+ * Get the local IP that the server is reachable at, from the bound IP or
+ * from network interfaces. When bound to all addresses, interfaces are
+ * monitored via rtnetlink and @announce is called from the event loop
+ * when the best address changes. If UPnP is enabled, discovery and port
+ * forwarding are done in background, and @announce is called once
+ * the external IP is known.
+ */
+ExternalIP::ExternalIP(struct event_base* evb, unsigned int port,
+		const char* bindip, bool use_upnp, int upnp_lease,
+		std::function<void(const char*)> announce)
+	: _port(port), _announce(announce), _upnp_addr(false)
+{
 	if (!strcmp(bindip, "0.0.0.0") || !strcmp(bindip, "::"))
-		addr = get_rtnl_external_ip(bindip);
+	{
+		_monitor.reset(new AddressMonitor{evb, bindip,
+				[this](const char* new_addr) {
+					local_addr_changed(new_addr);
+				}});
+		if (_monitor->enabled())
+			addr = _monitor->best();
+		else
+		{
+			_monitor.reset(nullptr);
+			addr = get_rtnl_external_ip(bindip);
+		}
+	}
 	else
 		addr = bindip;
+
+#ifdef HAVE_LIBMINIUPNPC
+	/* use UPnP only if user wants to */
+	if (use_upnp)
+	{
+		if (pipe2(upnp.notify_fds, O_CLOEXEC | O_NONBLOCK))
+		{
+			std::cerr << "pipe2() failed: " << strerror(errno) << std::endl;
+			return;
+		}
+
+		upnp.notify_event = {event_new(evb, upnp.notify_fds[0],
+				EV_READ | EV_PERSIST, upnp_notify, this), event_free};
+		if (!upnp.notify_event)
+			throw std::bad_alloc();
+		event_add(upnp.notify_event.get(), NULL);
+
+		upnp.stopping = false;
+		upnp.mapped = false;
+		upnp.thread = std::thread{upnp_thread, port, bindip, upnp_lease};
+	}
+#endif
 }
 
 /**
  * ExternalIP::~ExternalIP
  *
- * Cleanup after ExternalIP. If UPnP was used, remove the port
- * forwarding established then.
+ * Cleanup after ExternalIP. If UPnP was used, stop the background thread
+ * and remove the port forwarding established by it.
  */
 ExternalIP::~ExternalIP()
 {
 #ifdef HAVE_LIBMINIUPNPC
-	if (upnp_enabled)
+	if (upnp.thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lk{upnp.lock};
+			upnp.stopping = true;
+		}
+		upnp.cond.notify_one();
+		/* this may wait for discovery to finish */
+		upnp.thread.join();
+
+		upnp.notify_event.reset(nullptr);
+		close(upnp.notify_fds[0]);
+		close(upnp.notify_fds[1]);
+	}
+
+	if (upnp.mapped)
 	{
 		int ret;
 		std::string strport{std::to_string(_port)};
 
 		/* Remove the port forwarding when done. */
 		ret = UPNP_DeletePortMapping(
-				upnp_urls.controlURL,
-				upnp_data.first.servicetype,
+				upnp.urls.controlURL,
+				upnp.data.first.servicetype,
 				strport.c_str(), "TCP", NULL);
 		if (ret != UPNPCOMMAND_SUCCESS)
 			std::cerr << "UPNP_DeletePortMapping() failed: " << strupnperror(ret)
 				<< std::endl;
-		FreeUPNPUrls(&(upnp_urls));
+		FreeUPNPUrls(&upnp.urls);
 	}
 #endif
 }
@@ -7,14 +7,67 @@
 #ifndef _PSHS_NETWORK_H
 #define _PSHS_NETWORK_H
 
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include <event2/event.h>
+
+class AddressMonitor
+{
+	struct Entry
+	{
+		int family;
+		unsigned int ifindex;
+		unsigned char addr[16];
+		/* enum is_local, lower is better */
+		int rank;
+	};
+
+	/* most preferred first */
+	std::vector<Entry> _table;
+	int _fd;
+	bool _want_ipv6;
+	/* whether a full dump is in progress */
+	bool _dumping;
+	std::unique_ptr<event, std::function<void(event*)>> _event;
+	std::function<void(const char*)> _changed;
+	char _best[INET6_ADDRSTRLEN];
+
+	bool request_dump();
+	bool process(const void* buf, size_t len);
+	void update(bool add, int family, unsigned int ifindex,
+			const unsigned char* addr);
+	bool update_best();
+	static void read_cb(evutil_socket_t fd, short what, void* data);
+
+public:
+	AddressMonitor(struct event_base* evb, const char* bindip,
+			std::function<void(const char*)> changed);
+	~AddressMonitor();
+
+	bool enabled() const { return _fd != -1; }
+	const char* best() const { return _best[0] ? _best : NULL; }
+};
 
 class ExternalIP
 {
 	int _port;
+	std::unique_ptr<AddressMonitor> _monitor;
+	std::function<void(const char*)> _announce;
+	/* whether UPnP provided the external address */
+	bool _upnp_addr;
+
+	void local_addr_changed(const char* new_addr);
+	static void upnp_notify(evutil_socket_t fd, short what, void* data);
 
 public:
-	ExternalIP(unsigned int port, const char* bindip, bool use_upnp);
+	ExternalIP(struct event_base* evb, unsigned int port, const char* bindip,
+			bool use_upnp, int upnp_lease,
+			std::function<void(const char*)> announce);
 	~ExternalIP();
 
 	const char* addr;
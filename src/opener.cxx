@@ -0,0 +1,392 @@
+/* pshs -- opening served files off the event loop
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+
+#include <string.h>
+#include <stdint.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+
+#include "archive.h"
+#include "conn.h"
+#include "content-type.h"
+#include "opener.h"
+#include "workers.h"
+
+static const char* const stage_names[OPEN_STAGES] = {
+	"queued",
+	"open",
+	"content-type",
+	"reply",
+};
+
+/* requests waiting for or in a worker thread, per thread; more are
+ * refused, rather than queued behind a hung filesystem */
+static const unsigned int jobs_per_thread = 64;
+
+/**
+ * FileOpener::FileOpener
+ * @evb: the event base
+ * @conns: the connection tracker
+ * @ct: the Content-Type guesser
+ * @files: served file list
+ * @archives: served archives, or %NULL
+ * @threads: number of worker threads, 0 to open the files in the event
+ * loop thread
+ * @cb: function called on the event loop thread once a file is open
+ * @data: argument for @cb
+ *
+ * Set up opening the files, and guessing their types, in worker threads.
+ */
+FileOpener::FileOpener(struct event_base* evb, ConnTracker& conns,
+		ContentType& ct, char* const* files, ArchiveIndex* archives,
+		unsigned int threads, open_done cb, void* data)
+	: _conns(conns), _ct(ct), _files(files), _archives(archives), _cb(cb),
+	_cb_data(data), _slots(threads ? threads * jobs_per_thread : 1),
+	_free(NULL), _refused(0), _eventfd(-1), _done_ev(NULL),
+	_stopping(false), _queued(NULL), _queued_tail(&_queued),
+	_completed(NULL), _stages()
+{
+	for (OpenJob& job : _slots)
+	{
+		job.stage = OPEN_STAGES;
+		job.next = _free;
+		_free = &job;
+	}
+	if (!threads)
+		return;
+
+	_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_eventfd == -1)
+		throw std::runtime_error("Unable to create the file opener eventfd");
+	_done_ev = event_new(evb, _eventfd, EV_READ | EV_PERSIST, done_callback,
+			this);
+	if (!_done_ev || event_add(_done_ev, NULL))
+	{
+		if (_done_ev)
+			event_free(_done_ev);
+		close(_eventfd);
+		throw std::runtime_error("Unable to watch the opened files");
+	}
+	_pool.reset(new WorkerPool{threads});
+	for (unsigned int i = 0; i < threads; ++i)
+		_pool->submit(std::bind(&FileOpener::worker, this));
+}
+
+/**
+ * FileOpener::~FileOpener
+ *
+ * Stop the threads, and drop the files opened but not sent yet. Their
+ * requests are freed along with the connections.
+ */
+FileOpener::~FileOpener()
+{
+	if (_pool)
+	{
+		unsigned int busy;
+
+		{
+			std::lock_guard<std::mutex> lk{_lock};
+			busy = _stages[OPEN_FILE].depth + _stages[OPEN_TYPE].depth;
+			_stopping = true;
+		}
+		_cond.notify_all();
+		/* a blocked open() can not be interrupted, so tell why we hang */
+		if (busy)
+			std::cerr << "Waiting for " << busy << " files being opened."
+				<< std::endl;
+		_pool->stop();
+	}
+
+	for (OpenJob& job : _slots)
+	{
+		if (job.stage == OPEN_STAGES)
+			continue;
+		if (!job.cancelled)
+			_conns.set_close_hook(job.req, NULL, NULL);
+		if (job.fd != -1)
+			close(job.fd);
+	}
+	if (_done_ev)
+		event_free(_done_ev);
+	if (_eventfd != -1)
+		close(_eventfd);
+
+	if (_refused)
+		std::cerr << "Refused " << _refused << " requests with all file "
+			"openers busy." << std::endl;
+}
+
+/**
+ * FileOpener::enter
+ * @job: the job
+ * @stage: the next stage, or OPEN_STAGES once done
+ *
+ * Count the job out of its current stage and into @stage.
+ */
+void FileOpener::enter(OpenJob* job, enum open_stage stage)
+{
+	auto now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lk{_lock};
+
+	if (job->stage != OPEN_STAGES)
+	{
+		Stage& s = _stages[job->stage];
+		double seconds = std::chrono::duration<double>(now - job->since)
+			.count();
+
+		--s.depth;
+		++s.done;
+		s.seconds += seconds;
+		s.max = std::max(s.max, seconds);
+	}
+	if (stage != OPEN_STAGES)
+		++_stages[stage].depth;
+	job->stage = stage;
+	job->since = now;
+}
+
+/**
+ * FileOpener::worker
+ *
+ * The worker thread loop -- run the queued jobs until stopped, and pass
+ * them back to the event loop.
+ */
+void FileOpener::worker()
+{
+	for (;;)
+	{
+		OpenJob* job;
+
+		{
+			std::unique_lock<std::mutex> lk{_lock};
+			_cond.wait(lk, [this] { return _stopping || _queued; });
+			if (_stopping)
+				return;
+			job = _queued;
+			_queued = job->next;
+			if (!_queued)
+				_queued_tail = &_queued;
+		}
+
+		run(job);
+
+		{
+			std::lock_guard<std::mutex> lk{_lock};
+			job->next = _completed;
+			_completed = job;
+		}
+		uint64_t one = 1;
+		if (write(_eventfd, &one, sizeof(one)) == -1)
+		{
+			/* the counter is full, so the loop is going to wake up anyway */
+		}
+	}
+}
+
+/**
+ * FileOpener::run
+ * @job: the job
+ *
+ * Open the file, check that it is still a regular file, and guess its
+ * type. Runs in a worker thread, unless there are none.
+ */
+void FileOpener::run(OpenJob* job)
+{
+	const char* path = job->member ? NULL : _files[job->file_idx];
+
+	enter(job, OPEN_FILE);
+	if (job->member)
+		job->fd = _archives->open(*job->member, job->st);
+	else
+	{
+		job->fd = ::open(path, O_RDONLY | O_CLOEXEC);
+
+		if (job->fd == -1)
+			std::cerr << "open() failed for " << path << ": "
+				<< strerror(errno) << std::endl;
+		/* we need to have a regular file here,
+		 * with static Content-Length */
+		else if (fstat(job->fd, &job->st))
+			std::cerr << "fstat() failed for " << path << ": "
+				<< strerror(errno) << std::endl;
+		else if (!S_ISREG(job->st.st_mode))
+			std::cerr << "fstat() says that " << path
+				<< " is not a regular file" << std::endl;
+		else
+			path = NULL;
+
+		if (path && job->fd != -1)
+		{
+			close(job->fd);
+			job->fd = -1;
+		}
+	}
+
+	if (job->fd != -1)
+	{
+		ArchiveMember* m = job->member;
+
+		enter(job, OPEN_TYPE);
+		job->type = m
+			? _ct.guess(m->name, job->fd, m->offset, m->size, m->type)
+			: _ct.guess(_files[job->file_idx], job->fd, job->file_idx,
+					job->st);
+	}
+	enter(job, OPEN_REPLY);
+}
+
+/**
+ * FileOpener::open
+ * @req: the request object
+ * @file_idx: index of the file in the served list, if not a member
+ * @member: the archive member, or %NULL
+ *
+ * Start opening the file for @req. The callback is called once it is
+ * open (or failed to), or right away if there are no worker threads.
+ * If the client goes away before, the file is closed and the callback
+ * is not called.
+ *
+ * Returns: true if the request is being handled, false if too many are
+ * waiting already
+ */
+bool FileOpener::open(struct evhttp_request* req, ssize_t file_idx,
+		ArchiveMember* member)
+{
+	OpenJob* job = _free;
+
+	if (!job)
+	{
+		++_refused;
+		return false;
+	}
+	_free = job->next;
+
+	job->req = req;
+	job->file_idx = file_idx;
+	job->member = member;
+	job->fd = -1;
+	job->type = NULL;
+	job->cancelled = false;
+	job->next = NULL;
+
+	if (!_pool)
+	{
+		run(job);
+		finish(job);
+		return true;
+	}
+
+	enter(job, OPEN_QUEUED);
+	_conns.set_close_hook(req, close_callback, job);
+	{
+		std::lock_guard<std::mutex> lk{_lock};
+		*_queued_tail = job;
+		_queued_tail = &job->next;
+	}
+	_cond.notify_one();
+	return true;
+}
+
+/**
+ * FileOpener::close_callback
+ * @req: the request object
+ * @data: the job
+ *
+ * Note that the client went away while its file was being opened.
+ */
+void FileOpener::close_callback(struct evhttp_request* req, void* data)
+{
+	static_cast<OpenJob*>(data)->cancelled = true;
+}
+
+/**
+ * FileOpener::done_callback
+ * @fd: the eventfd
+ * @what: unused
+ * @data: the opener
+ *
+ * Finish the requests whose files were opened in the threads.
+ */
+void FileOpener::done_callback(evutil_socket_t fd, short what, void* data)
+{
+	FileOpener* o = static_cast<FileOpener*>(data);
+	OpenJob* completed;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) == -1)
+	{
+		/* woken up for jobs taken already */
+	}
+
+	{
+		std::lock_guard<std::mutex> lk{o->_lock};
+		completed = o->_completed;
+		o->_completed = NULL;
+	}
+	while (completed)
+	{
+		OpenJob* job = completed;
+
+		completed = job->next;
+		o->finish(job);
+	}
+}
+
+/**
+ * FileOpener::finish
+ * @job: the job
+ *
+ * Pass the open file to the callback, or close it if the client is gone,
+ * and put the job back on the free list.
+ */
+void FileOpener::finish(OpenJob* job)
+{
+	enter(job, OPEN_STAGES);
+
+	if (job->cancelled)
+	{
+		if (job->fd != -1)
+			close(job->fd);
+	}
+	else
+	{
+		if (_pool)
+			_conns.set_close_hook(job->req, NULL, NULL);
+		_cb(job, _cb_data);
+	}
+	job->next = _free;
+	_free = job;
+}
+
+/**
+ * FileOpener::status
+ * @st: the status to fill in
+ *
+ * Take a snapshot of the requests in every stage, and how long they
+ * took in there.
+ */
+void FileOpener::status(std::vector<StageStatus>& st) const
+{
+	std::lock_guard<std::mutex> lk{_lock};
+
+	st.clear();
+	for (int i = 0; i < OPEN_STAGES; ++i)
+	{
+		const Stage& s = _stages[i];
+
+		st.push_back(StageStatus{stage_names[i], s.depth, s.done, s.seconds,
+				s.max});
+	}
+}
@@ -0,0 +1,134 @@
+/* pshs -- opening served files off the event loop
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+#ifndef _PSHS_OPENER_H
+#define _PSHS_OPENER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <event2/event.h>
+#include <event2/http.h>
+
+// abstract
+class ArchiveIndex;
+struct ArchiveMember;
+class ConnTracker;
+class ContentType;
+class WorkerPool;
+
+/* what a request waits for before its file can be sent */
+enum open_stage
+{
+	/* for a worker thread */
+	OPEN_QUEUED,
+	/* open() and fstat(), or checking the archive */
+	OPEN_FILE,
+	/* guessing the Content-Type, which may read the file */
+	OPEN_TYPE,
+	/* done, for the event loop to send the response */
+	OPEN_REPLY,
+
+	OPEN_STAGES
+};
+
+struct StageStatus
+{
+	const char* name;
+	/* requests in the stage right now */
+	unsigned int depth;
+	/* requests through the stage since start */
+	unsigned long done;
+	/* seconds spent in the stage by them, in total and at most */
+	double seconds;
+	double max;
+};
+
+/* a served file (or archive member) being opened for a request */
+struct OpenJob
+{
+	struct evhttp_request* req;
+	ssize_t file_idx;
+	ArchiveMember* member;
+
+	/* -1 on failure (reported to stderr), owned by the callback */
+	int fd;
+	struct stat st;
+	const char* type;
+
+	/* set if the client went away in the meantime */
+	bool cancelled;
+	/* OPEN_STAGES while the slot is free */
+	enum open_stage stage;
+	std::chrono::steady_clock::time_point since;
+	/* next job on the free, queued or completed list */
+	OpenJob* next;
+};
+
+typedef void (*open_done)(OpenJob* job, void* data);
+
+class FileOpener
+{
+	struct Stage
+	{
+		unsigned int depth;
+		unsigned long done;
+		double seconds;
+		double max;
+	};
+
+	ConnTracker& _conns;
+	ContentType& _ct;
+	char* const* _files;
+	ArchiveIndex* _archives;
+	open_done _cb;
+	void* _cb_data;
+
+	std::unique_ptr<WorkerPool> _pool;
+	/* all the jobs, allocated upfront, so that requests do not allocate */
+	std::vector<OpenJob> _slots;
+	/* unused slots, on the event loop thread */
+	OpenJob* _free;
+	unsigned long _refused;
+
+	int _eventfd;
+	struct event* _done_ev;
+	/* guards the lists below and the stage counters */
+	mutable std::mutex _lock;
+	std::condition_variable _cond;
+	bool _stopping;
+	OpenJob* _queued;
+	OpenJob** _queued_tail;
+	OpenJob* _completed;
+	Stage _stages[OPEN_STAGES];
+
+	static void done_callback(evutil_socket_t fd, short what, void* data);
+	static void close_callback(struct evhttp_request* req, void* data);
+	void enter(OpenJob* job, enum open_stage stage);
+	void worker();
+	void run(OpenJob* job);
+	void finish(OpenJob* job);
+
+public:
+	FileOpener(struct event_base* evb, ConnTracker& conns, ContentType& ct,
+			char* const* files, ArchiveIndex* archives, unsigned int threads,
+			open_done cb, void* data);
+	~FileOpener();
+
+	bool open(struct evhttp_request* req, ssize_t file_idx,
+			ArchiveMember* member);
+
+	void status(std::vector<StageStatus>& st) const;
+	unsigned long refused() const { return _refused; }
+};
+
+#endif /*_PSHS_OPENER_H*/
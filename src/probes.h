@@ -0,0 +1,33 @@
+/* pshs -- static tracepoints
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+#ifndef _PSHS_PROBES_H
+#define _PSHS_PROBES_H
+
+/* USDT probes in the "pshs" provider, for bpftrace, SystemTap or perf
+ * (see contrib/bpftrace). Each is a single nop until a tracer attaches,
+ * but the arguments are still evaluated, so only pass values at hand.
+ *
+ * request__start(req, uri)            handler called for a request
+ * content__type__start(idx)           file type lookup started
+ * content__type__done(idx, type, hit) lookup done, hit if it was cached
+ * reply__headers(req, code, length)   status and headers being queued
+ * file__segment(req, offset, length)  file part attached to the output;
+ *                                     offset is within the response body
+ * request__done(req)                  response sent completely
+ * conn__open(fd)                      connection accepted
+ * tls__handshake(fd, resumed)         TLS handshake done
+ * conn__close(fd, reason, requests)   connection closed; reason is
+ *                                     a reap_reason, or -1 if not a limit
+ */
+#ifdef HAVE_SYS_SDT_H
+#	include <sys/sdt.h>
+#	define PSHS_PROBE(name, ...) STAP_PROBEV(pshs, name, __VA_ARGS__)
+#else
+#	define PSHS_PROBE(name, ...) do { } while (0)
+#endif
+
+#endif /*_PSHS_PROBES_H*/
@@ -0,0 +1,205 @@
+/* pshs -- PROXY protocol support
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <iostream>
+#include <vector>
+
+#include <string.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+
+#include "proxy.h"
+
+/* PROXY protocol v2 header: signature, version & command, family
+ * & protocol, address length (big endian), followed by the addresses */
+static const unsigned char proxy_signature[12] = {
+	0x0D, 0x0A, 0x0D, 0x0A, 0x00, 0x0D, 0x0A, 0x51, 0x55, 0x49, 0x54, 0x0A,
+};
+static const size_t proxy_header_len = 16;
+
+enum proxy_command
+{
+	PROXY_LOCAL = 0x20,
+	PROXY_PROXY = 0x21,
+};
+
+enum proxy_family
+{
+	PROXY_AF_INET = 0x1,
+	PROXY_AF_INET6 = 0x2,
+};
+
+/* client addresses passed by the proxy, indexed by connection fd;
+ * an entry is rewritten when the header of a new connection is parsed,
+ * before any request on it can be seen */
+struct ProxyPeer
+{
+	/* empty if not provided by the proxy */
+	char addr[INET6_ADDRSTRLEN];
+	ev_uint16_t port;
+};
+
+static std::vector<ProxyPeer> peers;
+
+/**
+ * parse_header
+ * @peer: entry to store the client address in
+ * @p: the complete header
+ * @len: length of the header
+ *
+ * Get the client address from the header.
+ *
+ * Returns: false if the header is invalid, true otherwise
+ */
+static bool parse_header(ProxyPeer& peer, const unsigned char* p, size_t len)
+{
+	const unsigned char* addrs = p + proxy_header_len;
+	size_t addrs_len = len - proxy_header_len;
+
+	peer.addr[0] = '\0';
+	switch (p[12])
+	{
+		case PROXY_LOCAL:
+			/* health checks from the proxy itself */
+			return true;
+		case PROXY_PROXY:
+			break;
+		default:
+			return false;
+	}
+
+	/* source address, destination address, source port, destination port;
+	 * other families (AF_UNIX, unspecified) keep the socket peer */
+	switch (p[13] >> 4)
+	{
+		case PROXY_AF_INET:
+			if (addrs_len < 12)
+				return false;
+			inet_ntop(AF_INET, addrs, peer.addr, sizeof(peer.addr));
+			peer.port = (addrs[8] << 8) | addrs[9];
+			break;
+		case PROXY_AF_INET6:
+			if (addrs_len < 36)
+				return false;
+			inet_ntop(AF_INET6, addrs, peer.addr, sizeof(peer.addr));
+			peer.port = (addrs[32] << 8) | addrs[33];
+			break;
+	}
+
+	return true;
+}
+
+/**
+ * proxy_input_cb
+ * @buf: the input buffer
+ * @info: information about the change
+ * @data: the bufferevent
+ *
+ * Strip the PROXY protocol header from the start of the connection.
+ * This is called as data is read, before the HTTP parser sees it;
+ * until the header is complete, the read low watermark keeps the parser
+ * from being called.
+ */
+static void proxy_input_cb(struct evbuffer* buf,
+		const struct evbuffer_cb_info* info, void* data)
+{
+	struct bufferevent* bev = static_cast<struct bufferevent*>(data);
+	size_t avail = evbuffer_get_length(buf);
+
+	if (!info->n_added || avail < proxy_header_len)
+		return;
+
+	const unsigned char* p = evbuffer_pullup(buf, proxy_header_len);
+	bool valid = !memcmp(p, proxy_signature, sizeof(proxy_signature));
+	size_t len = proxy_header_len + ((p[14] << 8) | p[15]);
+
+	if (valid)
+	{
+		if (avail < len)
+		{
+			bufferevent_setwatermark(bev, EV_READ, len, 0);
+			return;
+		}
+
+		int fd = bufferevent_getfd(bev);
+		if (peers.size() <= static_cast<size_t>(fd))
+			peers.resize(fd + 1);
+		valid = parse_header(peers[fd], evbuffer_pullup(buf, len), len);
+	}
+
+	evbuffer_remove_cb(buf, proxy_input_cb, data);
+	if (!valid)
+	{
+		std::cerr << "Connection without valid PROXY protocol header "
+			"rejected." << std::endl;
+		/* evhttp frees the connection when it reads EOF */
+		evbuffer_drain(buf, avail);
+		shutdown(bufferevent_getfd(bev), SHUT_RDWR);
+		return;
+	}
+
+	evbuffer_drain(buf, len);
+	bufferevent_setwatermark(bev, EV_READ, 0, 0);
+}
+
+/**
+ * proxy_bev_callback
+ * @evb: the event base
+ * @data: unused
+ *
+ * Create the bufferevent for a new connection that starts with a PROXY
+ * protocol v2 header.
+ *
+ * Returns: the new bufferevent, or %NULL on failure
+ */
+struct bufferevent* proxy_bev_callback(struct event_base* evb, void* data)
+{
+	struct bufferevent* bev = bufferevent_socket_new(evb, -1,
+			BEV_OPT_CLOSE_ON_FREE);
+	if (!bev)
+		return NULL;
+
+	/* keep the HTTP parser away until the fixed part is read */
+	bufferevent_setwatermark(bev, EV_READ, proxy_header_len, 0);
+	if (!evbuffer_add_cb(bufferevent_get_input(bev), proxy_input_cb, bev))
+	{
+		bufferevent_free(bev);
+		return NULL;
+	}
+
+	return bev;
+}
+
+/**
+ * proxy_peer
+ * @conn: the connection
+ * @port: location to store the client port in
+ *
+ * Get the client address passed by the proxy.
+ *
+ * Returns: the client address, or %NULL if not known (@port is not
+ * changed then)
+ */
+const char* proxy_peer(struct evhttp_connection* conn, ev_uint16_t& port)
+{
+	if (peers.empty())
+		return NULL;
+
+	int fd = bufferevent_getfd(evhttp_connection_get_bufferevent(conn));
+	if (fd < 0 || static_cast<size_t>(fd) >= peers.size()
+			|| !peers[fd].addr[0])
+		return NULL;
+
+	port = peers[fd].port;
+	return peers[fd].addr;
+}
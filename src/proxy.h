@@ -0,0 +1,16 @@
+/* pshs -- PROXY protocol support
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+#ifndef _PSHS_PROXY_H
+#define _PSHS_PROXY_H
+
+#include <event2/bufferevent.h>
+#include <event2/http.h>
+
+struct bufferevent* proxy_bev_callback(struct event_base* evb, void* data);
+const char* proxy_peer(struct evhttp_connection* conn, ev_uint16_t& port);
+
+#endif /*_PSHS_PROXY_H*/
@@ -0,0 +1,595 @@
+/* pshs -- asynchronous file reads
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#	include <sys/mman.h>
+#	include <sys/syscall.h>
+#	include <sys/uio.h>
+#	include <linux/io_uring.h>
+#endif
+
+#include "reader.h"
+#include "workers.h"
+
+/* size of the pooled buffers, and of the reads */
+static const size_t read_block_size = 64 * 1024;
+
+/* threads doing pread(), when io_uring is not used */
+static const unsigned int read_threads = 4;
+
+#ifdef HAVE_LINUX_IO_URING_H
+/* the rings, mapped from the kernel */
+struct ReadEngine::Uring
+{
+	int fd;
+	/* whether the buffers are registered, for IORING_OP_READ_FIXED */
+	bool fixed;
+
+	void* sq_ptr;
+	size_t sq_size;
+	void* cq_ptr;
+	size_t cq_size;
+	struct io_uring_sqe* sqes;
+	size_t sqes_size;
+
+	unsigned int* sq_tail;
+	unsigned int* sq_mask;
+	unsigned int* sq_array;
+	unsigned int* cq_head;
+	unsigned int* cq_tail;
+	unsigned int* cq_mask;
+	struct io_uring_cqe* cqes;
+
+	~Uring();
+	void reap(ReadEngine* engine);
+};
+
+ReadEngine::Uring::~Uring()
+{
+	if (sqes)
+		munmap(sqes, sqes_size);
+	if (cq_ptr && cq_ptr != sq_ptr)
+		munmap(cq_ptr, cq_size);
+	if (sq_ptr)
+		munmap(sq_ptr, sq_size);
+	close(fd);
+}
+
+/**
+ * ReadEngine::Uring::reap
+ * @engine: the engine
+ *
+ * Process the completions posted so far.
+ */
+void ReadEngine::Uring::reap(ReadEngine* engine)
+{
+	unsigned int head = *cq_head;
+	unsigned int tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; ++head)
+	{
+		const struct io_uring_cqe& cqe = cqes[head & *cq_mask];
+		Read* r = &engine->_reads[cqe.user_data];
+
+		r->result = cqe.res;
+		engine->complete(r);
+	}
+	__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+#else
+struct ReadEngine::Uring
+{
+	void reap(ReadEngine* engine) {}
+};
+#endif /*HAVE_LINUX_IO_URING_H*/
+
+/**
+ * ReadEngine::ReadEngine
+ * @evb: the event base
+ * @engine: READ_URING or READ_THREADS
+ * @buffers: number of buffers to read into, which limits the reads
+ * in flight and the data read but not sent yet
+ *
+ * Set up the buffer pool and the engine. If io_uring is not available,
+ * threads are used instead.
+ */
+ReadEngine::ReadEngine(struct event_base* evb, enum read_engine engine,
+		unsigned int buffers)
+	: _buffers(NULL), _reads(buffers), _eventfd(-1), _done_ev(NULL)
+{
+	void* mem;
+
+	if (posix_memalign(&mem, 4096, buffers * read_block_size))
+		throw std::bad_alloc();
+	_buffers = static_cast<char*>(mem);
+	for (unsigned int i = 0; i < buffers; ++i)
+	{
+		_reads[i].buf = &_buffers[i * read_block_size];
+		_free.push_back(buffers - 1 - i);
+	}
+
+	_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_eventfd == -1)
+		throw std::runtime_error("Unable to create the read completion "
+				"eventfd");
+	_done_ev = event_new(evb, _eventfd, EV_READ | EV_PERSIST, done_callback,
+			this);
+	if (!_done_ev || event_add(_done_ev, NULL))
+		throw std::runtime_error("Unable to watch the read completions");
+
+	if (engine == READ_URING && setup_uring(buffers))
+		return;
+	_pool.reset(new WorkerPool{read_threads});
+}
+
+/**
+ * ReadEngine::~ReadEngine
+ *
+ * Wait for the reads in flight, and free the buffers. None may be queued
+ * in an evbuffer anymore.
+ */
+ReadEngine::~ReadEngine()
+{
+	if (_pool)
+		_pool->stop();
+
+#ifdef HAVE_LINUX_IO_URING_H
+	/* the kernel may still be writing into the buffers */
+	for (;;)
+	{
+		unsigned int busy = 0;
+
+		for (const Read& r : _reads)
+			busy += r.busy;
+		if (!busy || !_uring)
+			break;
+		if (syscall(__NR_io_uring_enter, _uring->fd, 0, 1,
+					IORING_ENTER_GETEVENTS, NULL, 0) == -1 && errno != EINTR)
+			break;
+		_uring->reap(this);
+	}
+	_uring.reset();
+#endif
+
+	if (_done_ev)
+		event_free(_done_ev);
+	if (_eventfd != -1)
+		close(_eventfd);
+	for (Read& r : _reads)
+	{
+		if (r.busy)
+			unref(r.file);
+	}
+	free(_buffers);
+}
+
+/**
+ * ReadEngine::setup_uring
+ * @entries: size of the submission queue
+ *
+ * Set up the io_uring, with the buffers registered if the memory lock
+ * limit allows it, and completions signalled on the eventfd.
+ *
+ * Returns: true on success, false if io_uring can not be used (reported
+ * to stderr)
+ */
+bool ReadEngine::setup_uring(unsigned int entries)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+	struct io_uring_params p = {};
+	int fd = syscall(__NR_io_uring_setup, entries, &p);
+
+	if (fd == -1)
+	{
+		std::cerr << "io_uring is not available (" << strerror(errno)
+			<< "), reading files in threads." << std::endl;
+		return false;
+	}
+
+	std::unique_ptr<Uring> u{new Uring()};
+	u->fd = fd;
+	u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->sq_size = u->cq_size = std::max(u->sq_size, u->cq_size);
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	u->sq_ptr = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (u->sq_ptr == MAP_FAILED)
+		u->sq_ptr = NULL;
+	else if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->cq_ptr = u->sq_ptr;
+	else
+	{
+		u->cq_ptr = mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (u->cq_ptr == MAP_FAILED)
+			u->cq_ptr = NULL;
+	}
+	if (u->cq_ptr)
+	{
+		void* sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (sqes != MAP_FAILED)
+			u->sqes = static_cast<struct io_uring_sqe*>(sqes);
+	}
+	if (!u->sqes)
+	{
+		std::cerr << "Unable to map the io_uring (" << strerror(errno)
+			<< "), reading files in threads." << std::endl;
+		return false;
+	}
+
+	char* sq = static_cast<char*>(u->sq_ptr);
+	char* cq = static_cast<char*>(u->cq_ptr);
+	u->sq_tail = reinterpret_cast<unsigned int*>(sq + p.sq_off.tail);
+	u->sq_mask = reinterpret_cast<unsigned int*>(sq + p.sq_off.ring_mask);
+	u->sq_array = reinterpret_cast<unsigned int*>(sq + p.sq_off.array);
+	u->cq_head = reinterpret_cast<unsigned int*>(cq + p.cq_off.head);
+	u->cq_tail = reinterpret_cast<unsigned int*>(cq + p.cq_off.tail);
+	u->cq_mask = reinterpret_cast<unsigned int*>(cq + p.cq_off.ring_mask);
+	u->cqes = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_EVENTFD,
+				&_eventfd, 1) == -1)
+	{
+		std::cerr << "Unable to register the io_uring eventfd ("
+			<< strerror(errno) << "), reading files in threads."
+			<< std::endl;
+		return false;
+	}
+
+	/* pinning the buffers counts against the memory lock limit, plain
+	 * reads work without it */
+	std::vector<struct iovec> iov(_reads.size());
+	for (size_t i = 0; i < iov.size(); ++i)
+		iov[i] = { _reads[i].buf, read_block_size };
+	u->fixed = syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS,
+			iov.data(), iov.size()) == 0;
+
+	_uring = std::move(u);
+	return true;
+#else
+	std::cerr << "io_uring support is not built in, reading files "
+		"in threads." << std::endl;
+	return false;
+#endif /*HAVE_LINUX_IO_URING_H*/
+}
+
+/**
+ * ReadEngine::block_size
+ *
+ * Returns: size of the buffers, reads are at most that long
+ */
+size_t ReadEngine::block_size()
+{
+	return read_block_size;
+}
+
+/**
+ * ReadEngine::name
+ *
+ * Returns: description of the engine in use
+ */
+const char* ReadEngine::name() const
+{
+#ifdef HAVE_LINUX_IO_URING_H
+	if (_uring)
+		return _uring->fixed ? "io_uring with registered buffers"
+			: "io_uring";
+#endif
+	return "threads";
+}
+
+/**
+ * ReadEngine::open
+ * @fd: open file, owned by the engine from now on
+ *
+ * Returns: the file to read from, with a reference for the caller
+ */
+ReadFile* ReadEngine::open(int fd)
+{
+	return new ReadFile{fd, 1};
+}
+
+/**
+ * ReadEngine::unref
+ * @file: the file
+ *
+ * Drop a reference to the file, closing it if it was the last one.
+ */
+void ReadEngine::unref(ReadFile* file)
+{
+	if (!--file->refs)
+	{
+		close(file->fd);
+		delete file;
+	}
+}
+
+/**
+ * ReadEngine::read
+ * @file: the file
+ * @offset: offset to read at
+ * @len: number of bytes to read, at most block_size()
+ * @cb: function called on the event loop thread once done
+ * @data: argument for @cb
+ *
+ * Start reading into a free buffer. Once @cb is called, the read should be
+ * either passed to add_to() or cancelled.
+ *
+ * Returns: the read, or %NULL if all buffers are in use
+ */
+ReadEngine::Read* ReadEngine::read(ReadFile* file, off_t offset, size_t len,
+		read_done cb, void* data)
+{
+	if (_free.empty())
+		return NULL;
+
+	Read* r = &_reads[_free.back()];
+	_free.pop_back();
+	++file->refs;
+	r->len = len;
+	r->result = 0;
+	r->file = file;
+	r->offset = offset;
+	r->cb = cb;
+	r->data = data;
+	r->busy = true;
+
+	if (_uring)
+		submit_uring(r);
+	else
+		submit_thread(r);
+	return r;
+}
+
+/**
+ * ReadEngine::submit_uring
+ * @r: the read
+ *
+ * Queue the read on the io_uring and submit it. If that fails, the read
+ * completes with the error.
+ */
+void ReadEngine::submit_uring(Read* r)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+	Uring& u = *_uring;
+	uint32_t index = r - _reads.data();
+	unsigned int tail = *u.sq_tail;
+	unsigned int slot = tail & *u.sq_mask;
+	struct io_uring_sqe* sqe = &u.sqes[slot];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = u.fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = r->file->fd;
+	sqe->addr = reinterpret_cast<uintptr_t>(r->buf);
+	sqe->len = r->len;
+	sqe->off = r->offset;
+	sqe->buf_index = u.fixed ? index : 0;
+	sqe->user_data = index;
+	u.sq_array[slot] = slot;
+	__atomic_store_n(u.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	while (syscall(__NR_io_uring_enter, u.fd, 1, 0, 0, NULL, 0) == -1)
+	{
+		if (errno == EINTR)
+			continue;
+
+		/* take it back, and fail it on the loop */
+		r->result = -errno;
+		__atomic_store_n(u.sq_tail, tail, __ATOMIC_RELEASE);
+		{
+			std::lock_guard<std::mutex> lk{_lock};
+			_completed.push_back(index);
+		}
+		event_active(_done_ev, EV_READ, 0);
+		break;
+	}
+#endif /*HAVE_LINUX_IO_URING_H*/
+}
+
+/**
+ * ReadEngine::submit_thread
+ * @r: the read
+ *
+ * Read in one of the threads, and signal the loop through the eventfd.
+ */
+void ReadEngine::submit_thread(Read* r)
+{
+	_pool->submit([this, r] {
+		size_t done = 0;
+		ssize_t rd = 0;
+
+		while (done < r->len)
+		{
+			rd = pread(r->file->fd, r->buf + done, r->len - done,
+					r->offset + done);
+			if (rd > 0)
+				done += rd;
+			else if (rd == 0 || errno != EINTR)
+				break;
+		}
+		r->result = rd == -1 ? -errno : done;
+
+		{
+			std::lock_guard<std::mutex> lk{_lock};
+			_completed.push_back(r - _reads.data());
+		}
+		uint64_t one = 1;
+		if (::write(_eventfd, &one, sizeof(one)) == -1)
+		{
+			/* the counter is full, so the loop is going to wake up anyway */
+		}
+	});
+}
+
+/**
+ * ReadEngine::done_callback
+ * @fd: the eventfd
+ * @what: unused
+ * @data: the engine
+ *
+ * Process the completed reads, and then let the transfers waiting for
+ * buffers have the free ones.
+ */
+void ReadEngine::done_callback(evutil_socket_t fd, short what, void* data)
+{
+	ReadEngine* e = static_cast<ReadEngine*>(data);
+	std::vector<uint32_t> completed;
+	uint64_t count;
+
+	if (::read(fd, &count, sizeof(count)) == -1)
+	{
+		/* activated by hand, nothing to reset */
+	}
+
+	if (e->_uring)
+		e->_uring->reap(e);
+	{
+		std::lock_guard<std::mutex> lk{e->_lock};
+		completed.swap(e->_completed);
+	}
+	for (uint32_t index : completed)
+		e->complete(&e->_reads[index]);
+
+	std::vector<std::pair<buffer_wait, void*>> waiters;
+	waiters.swap(e->_waiters);
+	for (size_t i = 0; i < waiters.size(); ++i)
+	{
+		/* the rest waits for the next buffer freed */
+		if (e->_free.empty())
+		{
+			e->_waiters.insert(e->_waiters.end(), waiters.begin() + i,
+					waiters.end());
+			break;
+		}
+		waiters[i].first(waiters[i].second);
+	}
+}
+
+/**
+ * ReadEngine::complete
+ * @r: the read
+ *
+ * Pass the finished read to its owner, or free it if it was cancelled.
+ */
+void ReadEngine::complete(Read* r)
+{
+	read_done cb = r->cb;
+
+	r->busy = false;
+	unref(r->file);
+	r->file = NULL;
+	r->cb = NULL;
+	if (cb)
+		cb(r, r->data);
+	else
+		free_read(r);
+}
+
+/**
+ * ReadEngine::free_read
+ * @r: the read
+ *
+ * Put the buffer back in the pool, and wake the transfers waiting for
+ * one.
+ */
+void ReadEngine::free_read(Read* r)
+{
+	_free.push_back(r - _reads.data());
+	if (!_waiters.empty())
+		event_active(_done_ev, EV_READ, 0);
+}
+
+/**
+ * ReadEngine::cancel
+ * @r: the read
+ *
+ * Drop the read, whether it is done or not. Its callback is not called.
+ */
+void ReadEngine::cancel(Read* r)
+{
+	r->cb = NULL;
+	if (!r->busy)
+		free_read(r);
+}
+
+/**
+ * ReadEngine::release_buffer
+ * @data: the buffer
+ * @len: unused
+ * @extra: the engine
+ *
+ * Free the buffer once evbuffer is done with it.
+ */
+void ReadEngine::release_buffer(const void* data, size_t len, void* extra)
+{
+	ReadEngine* e = static_cast<ReadEngine*>(extra);
+	size_t index = (static_cast<const char*>(data) - e->_buffers)
+		/ read_block_size;
+
+	e->free_read(&e->_reads[index]);
+}
+
+/**
+ * ReadEngine::add_to
+ * @buf: the buffer
+ * @r: a read that is done
+ *
+ * Add the data read to @buf, without copying. The buffer returns to the
+ * pool once the data is drained.
+ *
+ * Returns: 0 on success, -1 on failure
+ */
+int ReadEngine::add_to(struct evbuffer* buf, Read* r)
+{
+	return evbuffer_add_reference(buf, r->buf, r->result, release_buffer,
+			this);
+}
+
+/**
+ * ReadEngine::wait
+ * @cb: function to call
+ * @data: argument for @cb
+ *
+ * Call @cb on the event loop thread once a buffer is free.
+ */
+void ReadEngine::wait(buffer_wait cb, void* data)
+{
+	_waiters.emplace_back(cb, data);
+}
+
+/**
+ * ReadEngine::unwait
+ * @data: argument passed to wait()
+ *
+ * Stop waiting for a buffer.
+ */
+void ReadEngine::unwait(void* data)
+{
+	for (size_t i = 0; i < _waiters.size(); )
+	{
+		if (_waiters[i].second == data)
+			_waiters.erase(_waiters.begin() + i);
+		else
+			++i;
+	}
+}
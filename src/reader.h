@@ -0,0 +1,111 @@
+/* pshs -- asynchronous file reads
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+#ifndef _PSHS_READER_H
+#define _PSHS_READER_H
+
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <event2/buffer.h>
+#include <event2/event.h>
+
+// abstract
+class WorkerPool;
+
+/* how file contents get into userspace, when they have to */
+enum read_engine
+{
+	/* libevent maps the file, and the event loop faults the pages in */
+	READ_MMAP,
+	/* io_uring reads, or READ_THREADS if it is not available */
+	READ_URING,
+	/* pread() in a few threads */
+	READ_THREADS,
+};
+
+/* an open file, closed once the transfer and all reads are done with it */
+struct ReadFile
+{
+	int fd;
+	unsigned int refs;
+};
+
+class ReadEngine
+{
+public:
+	struct Read;
+	typedef void (*read_done)(Read* r, void* data);
+	typedef void (*buffer_wait)(void* data);
+
+	/* a read into one of the pooled buffers */
+	struct Read
+	{
+		char* buf;
+		size_t len;
+		/* bytes read, or -errno, once done */
+		ssize_t result;
+		ReadFile* file;
+		off_t offset;
+		/* %NULL once called, or if cancelled */
+		read_done cb;
+		void* data;
+		/* whether it is in flight */
+		bool busy;
+	};
+
+private:
+	struct Uring;
+
+	std::unique_ptr<Uring> _uring;
+	std::unique_ptr<WorkerPool> _pool;
+	char* _buffers;
+	/* one per buffer */
+	std::vector<Read> _reads;
+	std::vector<uint32_t> _free;
+	int _eventfd;
+	struct event* _done_ev;
+	/* reads done by the threads (or failed to submit), by index */
+	std::mutex _lock;
+	std::vector<uint32_t> _completed;
+	std::vector<std::pair<buffer_wait, void*>> _waiters;
+
+	static void done_callback(evutil_socket_t fd, short what, void* data);
+	static void release_buffer(const void* data, size_t len, void* extra);
+	bool setup_uring(unsigned int entries);
+	void submit_uring(Read* r);
+	void submit_thread(Read* r);
+	void complete(Read* r);
+	void free_read(Read* r);
+
+public:
+	ReadEngine(struct event_base* evb, enum read_engine engine,
+			unsigned int buffers);
+	~ReadEngine();
+
+	static size_t block_size();
+	const char* name() const;
+	size_t buffers() const { return _reads.size(); }
+
+	static ReadFile* open(int fd);
+	static void unref(ReadFile* file);
+
+	Read* read(ReadFile* file, off_t offset, size_t len, read_done cb,
+			void* data);
+	void cancel(Read* r);
+	int add_to(struct evbuffer* buf, Read* r);
+
+	void wait(buffer_wait cb, void* data);
+	void unwait(void* data);
+};
+
+#endif /*_PSHS_READER_H*/
@@ -0,0 +1,304 @@
+/* pshs -- request parsing helpers
+ * (c) 2011-2026 Michał Górny and pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "request.h"
+
+/**
+ * hex_value
+ * @c: character
+ *
+ * Returns: value of hex digit @c, or -1 if it is not one
+ */
+static int hex_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/**
+ * decode_path
+ * @path: percent-encoded path
+ *
+ * Decode @path in place. Like evhttp_decode_uri(), only valid %XX
+ * sequences are decoded and '+' is left as-is.
+ *
+ * Returns: false if the path contains an encoded NUL, true otherwise
+ */
+bool decode_path(char* path)
+{
+	char* out = strchr(path, '%');
+
+	if (!out)
+		return true;
+
+	for (const char* in = out; *in; ++in)
+	{
+		int hi, lo;
+
+		if (*in == '%' && (hi = hex_value(in[1])) != -1
+				&& (lo = hex_value(in[2])) != -1)
+		{
+			*out = static_cast<char>(hi << 4 | lo);
+			if (!*out++)
+				return false;
+			in += 2;
+		}
+		else
+			*out++ = *in;
+	}
+
+	*out = '\0';
+	return true;
+}
+
+/**
+ * resolve_path
+ * @uri: requested URI, with the leading slash removed
+ * @prefix: path prefix the files are served under, or %NULL
+ * @prefix_len: length of @prefix
+ * @buf: buffer to decode the path into
+ *
+ * Decode the requested path into @buf and strip the prefix. The buffer
+ * is reused between requests, so no memory is allocated once it has grown
+ * to fit the longest path.
+ *
+ * Returns: the decoded path (pointing into @buf), or %NULL if it can not
+ * refer to a served file
+ */
+char* resolve_path(const char* uri, const char* prefix, size_t prefix_len,
+		std::vector<char>& buf)
+{
+	buf.assign(uri, uri + strlen(uri) + 1);
+
+	char* path = buf.data();
+	if (!decode_path(path))
+		return NULL;
+
+	if (prefix)
+	{
+		if (strncmp(path, prefix, prefix_len) || path[prefix_len] != '/')
+			return NULL;
+		path += prefix_len + 1;
+	}
+
+	return path;
+}
+
+/**
+ * parse_range
+ * @range: value of the Range header, or %NULL
+ * @size: file size
+ * @first: location to store the first byte to send
+ * @last: location to store the last byte to send
+ *
+ * Parse the Range header and compute the byte range to send. Only a single
+ * byte range is supported, including suffix (negative) ranges. The range
+ * is clamped to the file.
+ *
+ * Returns: parse result
+ */
+enum range_result parse_range(const char* range, off_t size,
+		intmax_t& first, intmax_t& last)
+{
+	first = 0;
+	last = -1;
+
+	if (range)
+	{
+		/* We support only single byte range,
+		 * so fail on ',' or invalid bytes=%d-%d */
+		if (strchr(range, ',') || sscanf(range,
+					"bytes = %" SCNdMAX " - %" SCNdMAX,
+					&first, &last) < 1)
+			return RANGE_INVALID;
+	}
+
+	if (first < 0)
+		first += size;
+	if (last < 0)
+		last += size;
+
+	if (!range)
+		return RANGE_NONE;
+	/* a suffix longer than the file, or an end past it, means
+	 * the whole rest of it */
+	if (first < 0)
+		first = 0;
+	if (last >= size)
+		last = size - 1;
+	if (first >= size || first > last)
+		return RANGE_UNSATISFIABLE;
+	return RANGE_OK;
+}
+
+/* HTTP dates are always in English, whatever the locale */
+static const char day_names[][4] = {
+	"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
+static const char month_names[][4] = {
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+	"Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+/**
+ * format_http_date
+ * @buf: target buffer, at least 30 bytes
+ * @len: size of @buf
+ * @t: the time
+ *
+ * Format @t as an HTTP date (IMF-fixdate).
+ */
+void format_http_date(char* buf, size_t len, time_t t)
+{
+	struct tm tm;
+
+	gmtime_r(&t, &tm);
+	snprintf(buf, len, "%s, %02d %s %04d %02d:%02d:%02d GMT",
+			day_names[tm.tm_wday], tm.tm_mday, month_names[tm.tm_mon],
+			tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+/**
+ * parse_http_date
+ * @date: HTTP date
+ * @t: location to store the time
+ *
+ * Parse an HTTP date. Only IMF-fixdate is supported, the obsolete formats
+ * are not sent by any current client.
+ *
+ * Returns: true on success, false if @date is not a valid IMF-fixdate
+ */
+bool parse_http_date(const char* date, time_t& t)
+{
+	struct tm tm = {};
+	char month[4];
+	int end = 0;
+
+	if (sscanf(date, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT%n", &tm.tm_mday,
+				month, &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec,
+				&end) != 6 || date[end])
+		return false;
+
+	for (tm.tm_mon = 0; tm.tm_mon < 12; ++tm.tm_mon)
+	{
+		if (!strcmp(month, month_names[tm.tm_mon]))
+			break;
+	}
+	if (tm.tm_mon == 12)
+		return false;
+
+	tm.tm_year -= 1900;
+	t = timegm(&tm);
+	return t != -1;
+}
+
+/**
+ * make_validators
+ * @v: validators to fill
+ * @st: stat of the file the contents are sent from
+ * @offset: offset of the contents in the file
+ * @size: size of the contents
+ * @mtime: modification time of the contents
+ *
+ * Compute the validators of the file contents (or a part of the file,
+ * such as an archive member). The ETag changes whenever the file does.
+ */
+void make_validators(Validators& v, const struct stat& st, off_t offset,
+		off_t size, time_t mtime)
+{
+	snprintf(v.etag, sizeof(v.etag),
+			"\"%" PRIxMAX "-%" PRIxMAX ".%lx-%" PRIxMAX "-%" PRIxMAX "\"",
+			static_cast<uintmax_t>(st.st_ino),
+			static_cast<uintmax_t>(st.st_mtim.tv_sec), st.st_mtim.tv_nsec,
+			static_cast<uintmax_t>(offset), static_cast<uintmax_t>(size));
+	format_http_date(v.last_modified, sizeof(v.last_modified), mtime);
+	v.mtime = mtime;
+}
+
+/**
+ * etag_listed
+ * @list: value of If-None-Match, a comma-separated list of entity tags
+ * @etag: our (strong) entity tag
+ *
+ * Returns: true if @etag matches any tag on @list, using weak comparison
+ */
+static bool etag_listed(const char* list, const char* etag)
+{
+	size_t etag_len = strlen(etag);
+
+	for (const char* p = list; *p; )
+	{
+		p += strspn(p, " \t,");
+		if (*p == '*')
+			return true;
+		if (!strncmp(p, "W/", 2))
+			p += 2;
+
+		size_t len = strcspn(p, ",");
+		while (len && (p[len - 1] == ' ' || p[len - 1] == '\t'))
+			--len;
+		if (len == etag_len && !strncmp(p, etag, len))
+			return true;
+		p += len;
+	}
+
+	return false;
+}
+
+/**
+ * not_modified
+ * @if_none_match: value of If-None-Match, or %NULL
+ * @if_modified_since: value of If-Modified-Since, or %NULL
+ * @v: validators of the file
+ *
+ * Evaluate the conditional GET headers. If-Modified-Since is used only
+ * without If-None-Match, and ignored if it is not a valid date.
+ *
+ * Returns: true if 304 Not Modified should be sent back
+ */
+bool not_modified(const char* if_none_match, const char* if_modified_since,
+		const Validators& v)
+{
+	time_t since;
+
+	if (if_none_match)
+		return etag_listed(if_none_match, v.etag);
+	return if_modified_since && parse_http_date(if_modified_since, since)
+		&& v.mtime <= since;
+}
+
+/**
+ * range_allowed
+ * @if_range: value of If-Range, or %NULL
+ * @v: validators of the file
+ *
+ * Check whether the Range header applies, i.e. the client still has
+ * the same version of the file the range is to be added to. Entity tags
+ * are compared strongly, and dates need to match exactly.
+ *
+ * Returns: true if the range should be sent, false to send the whole file
+ */
+bool range_allowed(const char* if_range, const Validators& v)
+{
+	time_t t;
+
+	if (!if_range)
+		return true;
+	if (if_range[0] == '"')
+		return !strcmp(if_range, v.etag);
+	return parse_http_date(if_range, t) && t == v.mtime;
+}
@@ -0,0 +1,47 @@
+/* pshs -- request parsing helpers
+ * (c) 2011-2026 Michał Górny and pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+#ifndef _PSHS_REQUEST_H
+#define _PSHS_REQUEST_H
+
+#include <vector>
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+enum range_result
+{
+	RANGE_NONE, /* no Range header, send the whole file */
+	RANGE_OK,
+	RANGE_INVALID, /* unsupported or malformed */
+	RANGE_UNSATISFIABLE,
+};
+
+/* validators of a served file, sent as ETag and Last-Modified */
+struct Validators
+{
+	char etag[80];
+	char last_modified[32];
+	time_t mtime;
+};
+
+bool decode_path(char* path);
+char* resolve_path(const char* uri, const char* prefix, size_t prefix_len,
+		std::vector<char>& buf);
+enum range_result parse_range(const char* range, off_t size,
+		intmax_t& first, intmax_t& last);
+
+void format_http_date(char* buf, size_t len, time_t t);
+bool parse_http_date(const char* date, time_t& t);
+void make_validators(Validators& v, const struct stat& st, off_t offset,
+		off_t size, time_t mtime);
+bool not_modified(const char* if_none_match, const char* if_modified_since,
+		const Validators& v);
+bool range_allowed(const char* if_range, const Validators& v);
+
+#endif /*_PSHS_REQUEST_H*/
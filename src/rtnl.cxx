@@ -5,25 +5,33 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <iostream>
 
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 
-#ifdef HAVE_GETIFADDRS
-#	include <sys/types.h>
-#	include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
-#	include <netinet/in.h>
-#	include <netinet/ip.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <arpa/inet.h>
 
+#ifdef HAVE_GETIFADDRS
 #	include <ifaddrs.h>
 #	include <netdb.h>
-#	include <string.h>
+#endif
+
+#ifdef HAVE_LINUX_RTNETLINK_H
+#	include <linux/netlink.h>
+#	include <linux/rtnetlink.h>
 #endif
 
 #include "network.h"
 
-#ifdef HAVE_GETIFADDRS
 enum is_local { /* most preferred first */
 	ISLOCAL_NO, /* global address */
 	ISLOCAL_NET, /* address reserved for local network */
@@ -31,13 +39,51 @@ enum is_local { /* most preferred first */
 	ISLOCAL_HOST, /* localhost address */
 	ISLOCAL_MAX,
 };
-#endif
+
+/**
+ * classify_address
+ * @family: address family, AF_INET or AF_INET6
+ * @binaddr: the address, in network byte order
+ *
+ * Returns: how local the address is
+ */
+static enum is_local classify_address(int family, const unsigned char* binaddr)
+{
+	if (family == AF_INET)
+	{
+		if (binaddr[0] == 127) /* localhost */
+			return ISLOCAL_HOST;
+		else if (binaddr[0] == 10)
+			return ISLOCAL_NET;
+		else if (binaddr[0] == 192 && binaddr[1] == 168)
+			return ISLOCAL_NET;
+		else if (binaddr[0] == 169 && binaddr[1] == 254)
+			return ISLOCAL_APIPA;
+		else if (binaddr[0] == 172 && binaddr[1] >= 16 && binaddr[1] < 32)
+			return ISLOCAL_NET;
+		return ISLOCAL_NO;
+	}
+
+	// check for ::1
+	bool host = binaddr[15] == 1;
+	for (int i = 0; i < 15 && host; ++i)
+	{
+		if (binaddr[i] != 0)
+			host = false;
+	}
+	if (host)
+		return ISLOCAL_HOST;
+	if (binaddr[0] == 0xFE && (binaddr[1] & 0xC0) == 0x80)
+		return ISLOCAL_APIPA;
+	return ISLOCAL_NO;
+}
 
 /**
  * get_rtnl_external_ip
  * @bindip: IP the server is bound to
  *
- * Try to get external IP from local network interfaces using netlink.
+ * Try to get external IP from local network interfaces using getifaddrs().
+ * Used where AddressMonitor is not supported.
  *
  * Returns: best IP address found on the system, in a static buffer
  */
@@ -65,26 +111,14 @@ const char* get_rtnl_external_ip(const char* bindip)
 			continue;
 
 		int family = addr->ifa_addr->sa_family;
-		enum is_local islocal;
+		const unsigned char* binaddr;
 		if (family == AF_INET)
 		{
 			struct sockaddr_in* in = static_cast<sockaddr_in*>(
 					static_cast<void*>(addr->ifa_addr));
 			/* using char[4] allows us to ignore endianness */
-			unsigned char* binaddr = static_cast<unsigned char*>(
+			binaddr = static_cast<unsigned char*>(
 					static_cast<void*>(&(in->sin_addr.s_addr)));
-
-			islocal = ISLOCAL_NO;
-			if (binaddr[0] == 127) /* localhost */
-				islocal = ISLOCAL_HOST;
-			else if (binaddr[0] == 10)
-				islocal = ISLOCAL_NET;
-			else if (binaddr[0] == 192 && binaddr[1] == 168)
-				islocal = ISLOCAL_NET;
-			else if (binaddr[0] == 169 && binaddr[1] == 254)
-				islocal = ISLOCAL_APIPA;
-			else if (binaddr[0] == 172 && binaddr[1] >= 16 && binaddr[1] < 32)
-				islocal = ISLOCAL_NET;
 		}
 		else if (family == AF_INET6)
 		{
@@ -93,27 +127,13 @@ const char* get_rtnl_external_ip(const char* bindip)
 
 			struct sockaddr_in6* in = static_cast<sockaddr_in6*>(
 					static_cast<void*>(addr->ifa_addr));
-			unsigned char* binaddr = in->sin6_addr.s6_addr;
-
-			islocal = ISLOCAL_HOST;
-			// check for ::1
-			for (int i = 0; i < 15; ++i)
-			{
-				if (binaddr[i] != 0)
-				{
-					islocal = ISLOCAL_NO;
-					break;
-				}
-			}
-			if (binaddr[15] != 1)
-				islocal = ISLOCAL_NO;
-			if (islocal != ISLOCAL_HOST && binaddr[0] == 0xFE
-					&& (binaddr[1] & 0xC0) == 0x80)
-				islocal = ISLOCAL_APIPA;
+			binaddr = in->sin6_addr.s6_addr;
 		}
 		else
 			continue;
 
+		enum is_local islocal = classify_address(family, binaddr);
+
 		/* prefer global addresses, and arbitrarily prefer IPv6 */
 		bool update = false;
 		if (islocal < curr_islocal)
@@ -148,3 +168,289 @@ const char* get_rtnl_external_ip(const char* bindip)
 
 	return out;
 }
+
+/**
+ * AddressMonitor::AddressMonitor
+ * @evb: the event base to watch for changes on
+ * @bindip: IP the server is bound to (a wildcard address)
+ * @changed: function called with the new best address (or %NULL if there
+ * is none) when it changes
+ *
+ * Open a rtnetlink socket subscribed to address changes and fill
+ * the address table from the initial dump. If rtnetlink is not supported,
+ * enabled() returns false.
+ */
+AddressMonitor::AddressMonitor(struct event_base* evb, const char* bindip,
+		std::function<void(const char*)> changed)
+	: _fd(-1), _want_ipv6(!!strchr(bindip, ':')), _dumping(false),
+	_changed(changed), _best{}
+{
+#ifdef HAVE_LINUX_RTNETLINK_H
+	_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (_fd == -1)
+	{
+		std::cerr << "Unable to open rtnetlink socket: " << strerror(errno)
+			<< std::endl;
+		return;
+	}
+
+	struct sockaddr_nl sa = {};
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = RTMGRP_IPV4_IFADDR;
+	if (_want_ipv6)
+		sa.nl_groups |= RTMGRP_IPV6_IFADDR;
+
+	if (bind(_fd, reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa))
+			|| !request_dump())
+	{
+		std::cerr << "Unable to set up rtnetlink socket: " << strerror(errno)
+			<< std::endl;
+		close(_fd);
+		_fd = -1;
+		return;
+	}
+
+	/* read the initial dump synchronously, so that the address is known
+	 * before the server is announced */
+	char buf[8192];
+	while (_dumping)
+	{
+		ssize_t rd = recv(_fd, buf, sizeof(buf), 0);
+		if (rd == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			std::cerr << "Unable to read from rtnetlink socket: "
+				<< strerror(errno) << std::endl;
+			close(_fd);
+			_fd = -1;
+			return;
+		}
+		process(buf, rd);
+	}
+	update_best();
+
+	_event = {event_new(evb, _fd, EV_READ | EV_PERSIST, read_cb, this),
+		event_free};
+	if (!_event)
+		throw std::bad_alloc();
+	event_add(_event.get(), NULL);
+#endif
+}
+
+/**
+ * AddressMonitor::~AddressMonitor
+ *
+ * Stop monitoring and close the rtnetlink socket.
+ */
+AddressMonitor::~AddressMonitor()
+{
+	_event.reset(nullptr);
+	if (_fd != -1)
+		close(_fd);
+}
+
+/**
+ * AddressMonitor::request_dump
+ *
+ * Request the dump of all addresses. The table is refilled as the dump
+ * is processed.
+ *
+ * Returns: true on success, false on error (errno is set)
+ */
+bool AddressMonitor::request_dump()
+{
+#ifdef HAVE_LINUX_RTNETLINK_H
+	struct
+	{
+		struct nlmsghdr nh;
+		struct ifaddrmsg ifa;
+	} req = {};
+
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifa));
+	req.nh.nlmsg_type = RTM_GETADDR;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.ifa.ifa_family = _want_ipv6 ? AF_UNSPEC : AF_INET;
+
+	if (send(_fd, &req, req.nh.nlmsg_len, 0) == -1)
+		return false;
+
+	_table.clear();
+	_dumping = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ * AddressMonitor::process
+ * @buf: messages read from the socket
+ * @len: length of @buf
+ *
+ * Apply address messages to the table.
+ *
+ * Returns: false if the socket reported an error, true otherwise
+ */
+bool AddressMonitor::process(const void* buf, size_t len)
+{
+#ifdef HAVE_LINUX_RTNETLINK_H
+	for (const struct nlmsghdr* nh = static_cast<const struct nlmsghdr*>(buf);
+			NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len))
+	{
+		if (nh->nlmsg_type == NLMSG_DONE)
+		{
+			_dumping = false;
+			continue;
+		}
+		if (nh->nlmsg_type == NLMSG_ERROR)
+		{
+			_dumping = false;
+			return false;
+		}
+		if (nh->nlmsg_type != RTM_NEWADDR && nh->nlmsg_type != RTM_DELADDR)
+			continue;
+
+		const struct ifaddrmsg* ifa = static_cast<const struct ifaddrmsg*>(
+				NLMSG_DATA(nh));
+		if (ifa->ifa_family != AF_INET
+				&& (ifa->ifa_family != AF_INET6 || !_want_ipv6))
+			continue;
+
+		/* IFA_LOCAL is the local end of point-to-point links,
+		 * IFA_ADDRESS otherwise */
+		const unsigned char* addr = NULL;
+		const unsigned char* local = NULL;
+		unsigned int flags = ifa->ifa_flags;
+		int attrlen = IFA_PAYLOAD(nh);
+		for (const struct rtattr* rta = IFA_RTA(ifa); RTA_OK(rta, attrlen);
+				rta = RTA_NEXT(rta, attrlen))
+		{
+			const unsigned char* data = static_cast<const unsigned char*>(
+					RTA_DATA(rta));
+			if (rta->rta_type == IFA_ADDRESS)
+				addr = data;
+			else if (rta->rta_type == IFA_LOCAL)
+				local = data;
+			else if (rta->rta_type == IFA_FLAGS
+					&& RTA_PAYLOAD(rta) >= sizeof(uint32_t))
+				memcpy(&flags, data, sizeof(uint32_t));
+		}
+		if (local)
+			addr = local;
+		if (!addr)
+			continue;
+
+		/* addresses still undergoing (or failing) DAD are not usable,
+		 * the kernel sends RTM_NEWADDR again when that changes */
+		bool usable = !(flags & (IFA_F_TENTATIVE | IFA_F_DADFAILED));
+		update(nh->nlmsg_type == RTM_NEWADDR && usable, ifa->ifa_family,
+				ifa->ifa_index, addr);
+	}
+#endif
+
+	return true;
+}
+
+/**
+ * AddressMonitor::update
+ * @add: whether to add or remove the address
+ * @family: address family
+ * @ifindex: interface index
+ * @addr: the address, in network byte order
+ *
+ * Add the address to the table at its rank, or remove it.
+ */
+void AddressMonitor::update(bool add, int family, unsigned int ifindex,
+		const unsigned char* addr)
+{
+	size_t addr_len = family == AF_INET ? 4 : 16;
+
+	auto it = std::find_if(_table.begin(), _table.end(),
+		[&](const Entry& e) {
+			return e.family == family && e.ifindex == ifindex
+				&& !memcmp(e.addr, addr, addr_len);
+		});
+	if (it != _table.end())
+	{
+		if (add)
+			return;
+		_table.erase(it);
+	}
+	else if (add)
+	{
+		Entry e{family, ifindex, {}, 0};
+		memcpy(e.addr, addr, addr_len);
+		/* prefer global addresses, and arbitrarily prefer IPv6 */
+		e.rank = classify_address(family, addr) * 2 + (family == AF_INET);
+
+		/* keep the order of equally ranked addresses stable */
+		auto pos = std::upper_bound(_table.begin(), _table.end(), e,
+			[](const Entry& a, const Entry& b) {
+				return a.rank < b.rank;
+			});
+		_table.insert(pos, e);
+	}
+}
+
+/**
+ * AddressMonitor::update_best
+ *
+ * Update the best address from the table.
+ *
+ * Returns: true if it has changed
+ */
+bool AddressMonitor::update_best()
+{
+	char best[sizeof(_best)] = "";
+
+	if (!_table.empty())
+	{
+		const Entry& e = _table.front();
+		if (!inet_ntop(e.family, e.addr, best, sizeof(best)))
+			best[0] = '\0';
+	}
+
+	if (!strcmp(best, _best))
+		return false;
+	memcpy(_best, best, sizeof(_best));
+	return true;
+}
+
+/**
+ * AddressMonitor::read_cb
+ * @fd: the rtnetlink socket
+ * @what: unused
+ * @data: the AddressMonitor instance
+ *
+ * Process address change notifications.
+ */
+void AddressMonitor::read_cb(evutil_socket_t fd, short what, void* data)
+{
+	AddressMonitor* self = static_cast<AddressMonitor*>(data);
+	char buf[8192];
+
+	for (;;)
+	{
+		ssize_t rd = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (rd == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			/* notifications were lost, start over */
+			if (errno == ENOBUFS && self->request_dump())
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				std::cerr << "Unable to read from rtnetlink socket: "
+					<< strerror(errno) << std::endl;
+			break;
+		}
+		if (!self->process(buf, rd))
+			std::cerr << "rtnetlink dump failed, address table may be stale."
+				<< std::endl;
+	}
+
+	/* do not report the partial table while a dump is in progress */
+	if (!self->_dumping && self->update_best() && self->_changed)
+		self->_changed(self->best());
+}
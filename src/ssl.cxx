@@ -6,30 +6,50 @@
 #include "config.h"
 
 #include "ssl.h"
+#include "probes.h"
 
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <string>
+#include <unordered_map>
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
 #ifdef HAVE_LIBSSL
 #	include <event2/bufferevent.h>
 #	include <event2/bufferevent_ssl.h>
 
 #	include <openssl/asn1.h>
 #	include <openssl/bn.h>
+#	include <openssl/ec.h>
 #	include <openssl/evp.h>
+#	include <openssl/pem.h>
+#	include <openssl/rand.h>
 #	include <openssl/rsa.h>
 #	include <openssl/ssl.h>
 #	include <openssl/x509.h>
 
 #	if OPENSSL_VERSION_NUMBER >= 0x30000000L
 #		define HAVE_OPENSSL3
+#		include <openssl/core_names.h>
+#	else
+#		include <openssl/hmac.h>
 #	endif
 #endif
 
@@ -59,42 +79,73 @@ static int key_progress_cb(int p, int n, BN_GENCB* cb)
 }
 #endif
 
-static struct bufferevent* https_bev_callback(struct event_base* evb, void* data)
+/* dynamic record sizing: records fitting a single TCP segment (assuming
+ * 1500-byte MTU, IPv6, TCP timestamps and TLS overhead) are used until
+ * record_boost_bytes are sent, and again after record_idle without writes */
+static const long record_small_size = 1369;
+static const long record_large_size = SSL3_RT_MAX_PLAIN_LENGTH;
+static const unsigned long record_boost_bytes = 1024 * 1024;
+static const std::chrono::seconds record_idle{1};
+
+struct RecordState
 {
-	SSL_CTX* ctx = static_cast<SSL_CTX*>(data);
+	std::chrono::steady_clock::time_point last_write;
+	unsigned long sent;
+	bool boosted;
+};
 
-	return bufferevent_openssl_socket_new(evb, -1, SSL_new(ctx),
-			BUFFEREVENT_SSL_ACCEPTING, BEV_OPT_CLOSE_ON_FREE);
-}
-#endif
+/* SSL ex_data index holding RecordState, -1 if dynamic sizing is off */
+static int record_state_index = -1;
 
-SSLMod::SSLMod(evhttp* http, const char* extip, bool enable)
-	: enabled(false)
+static void free_record_state(void* parent, void* ptr, CRYPTO_EX_DATA* ad,
+		int idx, long argl, void* argp)
 {
-	if (!enable)
-		return;
-
-#ifdef HAVE_LIBSSL
+	delete static_cast<RecordState*>(ptr);
+}
 
-	X509_NAME* name;
-	unsigned char sha256_buf[32];
-	unsigned int i;
+static struct bufferevent* https_bev_callback(struct event_base* evb, void* data)
+{
+	SSL_CTX* ctx = static_cast<SSL_CTX*>(data);
+	SSL* s = SSL_new(ctx);
 
-	std::unique_ptr<X509, std::function<void(X509*)>>
-		x509{X509_new(), X509_free};
+	if (s && record_state_index != -1)
+		SSL_set_ex_data(s, record_state_index, new RecordState{});
 
-	if (!x509)
-		throw std::bad_alloc();
+	return bufferevent_openssl_socket_new(evb, -1, s,
+			BUFFEREVENT_SSL_ACCEPTING, BEV_OPT_CLOSE_ON_FREE);
+}
 
+typedef std::unique_ptr<EVP_PKEY, std::function<void(EVP_PKEY*)>> pkey_ptr;
+typedef std::unique_ptr<X509, std::function<void(X509*)>> x509_ptr;
+
+/* generated certificates are valid for 24 hours, cached ones for 30 days */
+static const long cert_validity = 60*60*24;
+static const long cached_cert_validity = 60*60*24*30;
+/* regenerate the cached certificate if it expires within an hour */
+static const long cert_min_validity = 60*60;
+
+static const int key_type_ids[] = {
+	EVP_PKEY_RSA,
+	EVP_PKEY_EC,
+	EVP_PKEY_ED25519,
+};
+
+/**
+ * generate_rsa_key
+ *
+ * Generate a 2048-bit RSA key.
+ *
+ * Returns: the new key
+ */
+static pkey_ptr generate_rsa_key()
+{
 #ifdef HAVE_OPENSSL3
-	std::unique_ptr<EVP_PKEY, std::function<void(EVP_PKEY*)>>
-		pkey{EVP_RSA_gen(2048), EVP_PKEY_free};
+	pkey_ptr pkey{EVP_RSA_gen(2048), EVP_PKEY_free};
 
 	if (!pkey)
 		throw std::bad_alloc();
 #else
-	std::unique_ptr<EVP_PKEY, std::function<void(EVP_PKEY*)>>
-		pkey{EVP_PKEY_new(), EVP_PKEY_free};
+	pkey_ptr pkey{EVP_PKEY_new(), EVP_PKEY_free};
 	std::unique_ptr<RSA, std::function<void(RSA*)>>
 		rsa{RSA_new(), RSA_free};
 	std::unique_ptr<BIGNUM, std::function<void(BIGNUM*)>>
@@ -117,16 +168,70 @@ SSLMod::SSLMod(evhttp* http, const char* extip, bool enable)
 		throw std::runtime_error("EVP_PKEY_set1_RSA() failed");
 #endif
 
-	if (!X509_set_pubkey(x509.get(), pkey.get()))
+	return pkey;
+}
+
+/**
+ * generate_key
+ * @keytype: requested key type
+ *
+ * Generate a new private key of type @keytype.
+ *
+ * Returns: the new key
+ */
+static pkey_ptr generate_key(enum key_type keytype)
+{
+	if (keytype == KEYTYPE_RSA)
+		return generate_rsa_key();
+
+	std::unique_ptr<EVP_PKEY_CTX, std::function<void(EVP_PKEY_CTX*)>>
+		ctx{EVP_PKEY_CTX_new_id(key_type_ids[keytype], NULL),
+			EVP_PKEY_CTX_free};
+	EVP_PKEY* raw_pkey = NULL;
+
+	if (!ctx)
+		throw std::bad_alloc();
+
+	if (EVP_PKEY_keygen_init(ctx.get()) <= 0)
+		throw std::runtime_error("EVP_PKEY_keygen_init() failed");
+	if (keytype == KEYTYPE_ECDSA && EVP_PKEY_CTX_set_ec_paramgen_curve_nid(
+				ctx.get(), NID_X9_62_prime256v1) <= 0)
+		throw std::runtime_error("EVP_PKEY_CTX_set_ec_paramgen_curve_nid() failed");
+	if (EVP_PKEY_keygen(ctx.get(), &raw_pkey) <= 0)
+		throw std::runtime_error("EVP_PKEY_keygen() failed");
+
+	return {raw_pkey, EVP_PKEY_free};
+}
+
+/**
+ * generate_certificate
+ * @pkey: private key
+ * @extip: IP the certificate is issued for
+ * @validity: validity period [s]
+ *
+ * Create a self-signed certificate for @pkey.
+ *
+ * Returns: the new certificate
+ */
+static x509_ptr generate_certificate(EVP_PKEY* pkey, const char* extip,
+		long validity)
+{
+	X509_NAME* name;
+
+	x509_ptr x509{X509_new(), X509_free};
+
+	if (!x509)
+		throw std::bad_alloc();
+
+	if (!X509_set_pubkey(x509.get(), pkey))
 		throw std::runtime_error("X509_set_pubkey() failed");
 
 	/* X509v3 */
 	X509_set_version(x509.get(), 2);
 	/* Semi-random serial number to avoid repetitions */
 	ASN1_INTEGER_set(X509_get_serialNumber(x509.get()), time(NULL));
-	/* Valid for 24 hours */
 	X509_gmtime_adj(X509_getm_notBefore(x509.get()), 0);
-	X509_gmtime_adj(X509_getm_notAfter(x509.get()), 60*60*24);
+	X509_gmtime_adj(X509_getm_notAfter(x509.get()), validity);
 
 	/* Set subject & issuer */
 	name = X509_get_subject_name(x509.get());
@@ -141,9 +246,578 @@ SSLMod::SSLMod(evhttp* http, const char* extip, bool enable)
 	/* Self-signed => issuer = subject */
 	X509_set_issuer_name(x509.get(), name);
 
-	if (!X509_sign(x509.get(), pkey.get(), EVP_sha512()))
+	/* Ed25519 has a built-in digest */
+	if (!X509_sign(x509.get(), pkey,
+				EVP_PKEY_base_id(pkey) == EVP_PKEY_ED25519
+				? NULL : EVP_sha512()))
 		throw std::runtime_error("X509_sign() failed");
 
+	return x509;
+}
+
+/**
+ * load_cached_certificate
+ * @cache_path: path to the cache file
+ * @keytype: requested key type
+ * @pkey: location to store the key
+ * @x509: location to store the certificate
+ *
+ * Load the key and certificate from the cache file, if the key is
+ * of @keytype and matches the certificate.
+ *
+ * Returns: true if the key and certificate were loaded
+ */
+static bool load_cached_certificate(const char* cache_path,
+		enum key_type keytype, pkey_ptr& pkey, x509_ptr& x509)
+{
+	std::unique_ptr<FILE, std::function<int(FILE*)>>
+		f{fopen(cache_path, "r"), fclose};
+
+	if (!f)
+	{
+		if (errno != ENOENT)
+			std::cerr << "Unable to open certificate cache " << cache_path
+				<< ": " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	pkey = {PEM_read_PrivateKey(f.get(), NULL, NULL, NULL), EVP_PKEY_free};
+	x509 = {PEM_read_X509(f.get(), NULL, NULL, NULL), X509_free};
+	if (!pkey || !x509)
+	{
+		std::cerr << "Invalid certificate cache " << cache_path
+			<< ", regenerating" << std::endl;
+		return false;
+	}
+
+	return EVP_PKEY_base_id(pkey.get()) == key_type_ids[keytype]
+		&& X509_check_private_key(x509.get(), pkey.get()) == 1;
+}
+
+/**
+ * cached_certificate_valid
+ * @x509: certificate loaded from the cache
+ * @extip: IP the certificate must be issued for
+ *
+ * Returns: true if @x509 is issued for @extip and is not about to expire
+ */
+static bool cached_certificate_valid(X509* x509, const char* extip)
+{
+	char cn[256];
+	if (X509_NAME_get_text_by_NID(X509_get_subject_name(x509),
+				NID_commonName, cn, sizeof(cn)) < 0 || strcmp(cn, extip))
+		return false;
+
+	time_t min_expiry = time(NULL) + cert_min_validity;
+	return X509_cmp_time(X509_get0_notAfter(x509), &min_expiry) > 0;
+}
+
+/**
+ * save_cached_certificate
+ * @cache_path: path to the cache file
+ * @pkey: private key
+ * @x509: certificate
+ *
+ * Write the key and certificate to the cache file. The file is replaced
+ * atomically, and is readable only by the owner.
+ */
+static void save_cached_certificate(const char* cache_path, EVP_PKEY* pkey,
+		X509* x509)
+{
+	std::string tmp_path{cache_path};
+	tmp_path += ".tmp";
+
+	int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			0600);
+	std::unique_ptr<FILE, std::function<int(FILE*)>>
+		f{fd != -1 ? fdopen(fd, "w") : NULL, fclose};
+
+	if (!f)
+	{
+		std::cerr << "Unable to write certificate cache " << cache_path
+			<< ": " << strerror(errno) << std::endl;
+		if (fd != -1)
+			close(fd);
+		return;
+	}
+
+	bool ok = PEM_write_PrivateKey(f.get(), pkey, NULL, NULL, 0, NULL, NULL)
+		&& PEM_write_X509(f.get(), x509);
+	ok = !fclose(f.release()) && ok;
+
+	if (!ok || rename(tmp_path.c_str(), cache_path))
+	{
+		std::cerr << "Unable to write certificate cache " << cache_path
+			<< std::endl;
+		unlink(tmp_path.c_str());
+	}
+}
+
+/* session resumption */
+
+static const unsigned char session_id_context[] = PACKAGE_NAME;
+
+struct TicketKey
+{
+	unsigned char name[16];
+	unsigned char aes_key[32];
+	unsigned char hmac_key[32];
+};
+
+/* the current key encrypts new tickets, the previous one is still
+ * accepted so that rotation does not invalidate all tickets at once */
+static struct
+{
+	std::mutex lock;
+	TicketKey current;
+	TicketKey previous;
+	bool have_previous;
+	time_t next_rotation;
+	long lifetime;
+} tickets;
+
+/* bounded LRU session cache, holding serialized sessions; OpenSSL's
+ * internal cache drops (and marks unresumable) sessions of connections
+ * freed without SSL_shutdown(), which is how libevent closes them */
+static struct
+{
+	std::mutex lock;
+	/* most recently used first */
+	std::list<std::string> lru;
+	std::unordered_map<std::string,
+		std::pair<std::string, std::list<std::string>::iterator>> map;
+	size_t max_size;
+} sessions;
+
+static std::atomic<unsigned long> full_handshakes{0};
+static std::atomic<unsigned long> resumed_handshakes{0};
+
+/**
+ * new_ticket_key
+ * @key: key to fill
+ *
+ * Generate a random session ticket key.
+ */
+static void new_ticket_key(TicketKey& key)
+{
+	if (RAND_bytes(key.name, sizeof(key.name)) <= 0
+			|| RAND_bytes(key.aes_key, sizeof(key.aes_key)) <= 0
+			|| RAND_bytes(key.hmac_key, sizeof(key.hmac_key)) <= 0)
+		throw std::runtime_error("RAND_bytes() failed");
+}
+
+/**
+ * find_ticket_key
+ * @key_name: key name from the ticket, or %NULL to get the encryption key
+ * @is_current: location to store whether the key is the current one
+ *
+ * Get the ticket key to use, rotating keys if the current one expired.
+ * Must be called with tickets.lock held.
+ *
+ * Returns: the key, or %NULL if @key_name is unknown
+ */
+static const TicketKey* find_ticket_key(const unsigned char* key_name,
+		bool& is_current)
+{
+	time_t now = time(NULL);
+
+	if (now >= tickets.next_rotation)
+	{
+		tickets.previous = tickets.current;
+		tickets.have_previous = true;
+		new_ticket_key(tickets.current);
+		tickets.next_rotation = now + tickets.lifetime;
+	}
+
+	is_current = true;
+	if (!key_name || !memcmp(key_name, tickets.current.name, 16))
+		return &tickets.current;
+
+	is_current = false;
+	if (tickets.have_previous && !memcmp(key_name, tickets.previous.name, 16))
+		return &tickets.previous;
+	return NULL;
+}
+
+#ifdef HAVE_OPENSSL3
+static int ticket_key_cb(SSL* s, unsigned char key_name[16],
+		unsigned char* iv, EVP_CIPHER_CTX* ctx, EVP_MAC_CTX* hctx, int enc)
+#else
+static int ticket_key_cb(SSL* s, unsigned char key_name[16],
+		unsigned char* iv, EVP_CIPHER_CTX* ctx, HMAC_CTX* hctx, int enc)
+#endif
+{
+	std::lock_guard<std::mutex> lk{tickets.lock};
+	bool is_current;
+	const TicketKey* key = find_ticket_key(enc ? NULL : key_name, is_current);
+
+	/* unknown key => full handshake */
+	if (!key)
+		return 0;
+
+	if (enc)
+	{
+		memcpy(key_name, key->name, 16);
+		if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) <= 0)
+			return -1;
+	}
+
+#ifdef HAVE_OPENSSL3
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+				const_cast<unsigned char*>(key->hmac_key),
+				sizeof(key->hmac_key)),
+		OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+				const_cast<char*>("sha256"), 0),
+		OSSL_PARAM_construct_end(),
+	};
+	if (!EVP_MAC_CTX_set_params(hctx, params))
+		return -1;
+#else
+	if (!HMAC_Init_ex(hctx, key->hmac_key, sizeof(key->hmac_key),
+				EVP_sha256(), NULL))
+		return -1;
+#endif
+
+	if (enc)
+		return EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL,
+				key->aes_key, iv) ? 1 : -1;
+	if (!EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key->aes_key, iv))
+		return -1;
+	/* ask for a new ticket if the old key was used */
+	return is_current ? 1 : 2;
+}
+
+static int new_session_cb(SSL* s, SSL_SESSION* sess)
+{
+	unsigned int len;
+	const unsigned char* id = SSL_SESSION_get_id(sess, &len);
+	std::string key{id, id + len};
+
+	int der_len = i2d_SSL_SESSION(sess, NULL);
+	if (der_len <= 0)
+		return 0;
+	std::string der(der_len, '\0');
+	unsigned char* p = reinterpret_cast<unsigned char*>(&der[0]);
+	i2d_SSL_SESSION(sess, &p);
+
+	std::lock_guard<std::mutex> lk{sessions.lock};
+
+	auto it = sessions.map.find(key);
+	if (it != sessions.map.end())
+	{
+		sessions.lru.erase(it->second.second);
+		sessions.map.erase(it);
+	}
+
+	sessions.lru.push_front(key);
+	sessions.map[key] = {std::move(der), sessions.lru.begin()};
+
+	while (sessions.map.size() > sessions.max_size)
+	{
+		sessions.map.erase(sessions.lru.back());
+		sessions.lru.pop_back();
+	}
+
+	/* we did not keep the reference */
+	return 0;
+}
+
+static SSL_SESSION* get_session_cb(SSL* s, const unsigned char* id, int len,
+		int* copy)
+{
+	std::string key{id, id + len};
+	std::lock_guard<std::mutex> lk{sessions.lock};
+
+	auto it = sessions.map.find(key);
+	if (it == sessions.map.end())
+		return NULL;
+
+	sessions.lru.splice(sessions.lru.begin(), sessions.lru, it->second.second);
+
+	/* OpenSSL checks the expiry itself */
+	const std::string& der = it->second.first;
+	const unsigned char* p = reinterpret_cast<const unsigned char*>(der.data());
+	*copy = 0;
+	return d2i_SSL_SESSION(NULL, &p, der.size());
+}
+
+/**
+ * clear_sessions
+ *
+ * Remove all sessions from the session cache.
+ */
+static void clear_sessions()
+{
+	std::lock_guard<std::mutex> lk{sessions.lock};
+
+	sessions.map.clear();
+	sessions.lru.clear();
+}
+
+/**
+ * reset_record_size
+ * @s: the connection
+ * @st: its record sizing state
+ *
+ * Switch @s back to small records.
+ */
+static void reset_record_size(SSL* s, RecordState* st)
+{
+	st->sent = 0;
+	if (st->boosted)
+	{
+		/* lowers the split fragment as well */
+		SSL_set_max_send_fragment(s, record_small_size);
+		st->boosted = false;
+	}
+}
+
+static void info_cb(const SSL* s, int where, int ret)
+{
+	if (where & SSL_CB_HANDSHAKE_DONE)
+	{
+		SSL* ms = const_cast<SSL*>(s);
+
+		if (SSL_session_reused(ms))
+			++resumed_handshakes;
+		else
+			++full_handshakes;
+		PSHS_PROBE(tls__handshake, SSL_get_fd(ms), SSL_session_reused(ms));
+
+		/* the write buffer is already allocated for full-size records
+		 * at this point, so the fragment can be changed freely */
+		if (record_state_index != -1)
+		{
+			void* data = SSL_get_ex_data(ms, record_state_index);
+			RecordState* st = static_cast<RecordState*>(data);
+
+			if (st && st->last_write == decltype(st->last_write){})
+			{
+				SSL_set_max_send_fragment(ms, record_small_size);
+				st->last_write = std::chrono::steady_clock::now();
+			}
+		}
+	}
+}
+
+static void record_msg_cb(int write_p, int version, int content_type,
+		const void* buf, size_t len, SSL* s, void* arg)
+{
+	if (content_type != SSL3_RT_HEADER || len < SSL3_RT_HEADER_LENGTH)
+		return;
+
+	void* data = SSL_get_ex_data(s, record_state_index);
+	RecordState* st = static_cast<RecordState*>(data);
+	/* not past the handshake yet */
+	if (!st || st->last_write == decltype(st->last_write){})
+		return;
+
+	auto now = std::chrono::steady_clock::now();
+	bool idle = now - st->last_write > record_idle;
+
+	if (!write_p)
+	{
+		/* new request after idle, respond with small records */
+		if (idle)
+			reset_record_size(s, st);
+		return;
+	}
+
+	if (idle)
+		reset_record_size(s, st);
+	st->last_write = now;
+
+	const unsigned char* hdr = static_cast<const unsigned char*>(buf);
+	st->sent += (hdr[3] << 8) | hdr[4];
+	/* takes effect on the next SSL_write() (or its retry) */
+	if (!st->boosted && st->sent >= record_boost_bytes)
+	{
+		SSL_set_max_send_fragment(s, record_large_size);
+		SSL_set_split_send_fragment(s, record_large_size);
+		st->boosted = true;
+	}
+}
+
+/**
+ * setup_record_size
+ * @ctx: the TLS context
+ * @record_size: fixed TLS record size, 0 for dynamic sizing
+ *
+ * Configure the size of TLS records sent.
+ */
+static void setup_record_size(SSL_CTX* ctx, long record_size)
+{
+	if (record_size)
+	{
+		if (!SSL_CTX_set_max_send_fragment(ctx, record_size))
+			throw std::runtime_error("SSL_CTX_set_max_send_fragment() failed");
+		return;
+	}
+
+	record_state_index = SSL_get_ex_new_index(0, NULL, NULL, NULL,
+			free_record_state);
+	if (record_state_index == -1)
+		throw std::runtime_error("SSL_get_ex_new_index() failed");
+	SSL_CTX_set_msg_callback(ctx, record_msg_cb);
+}
+
+/**
+ * setup_session_resumption
+ * @ctx: the TLS context
+ * @cache_size: maximum number of sessions in the server-side cache,
+ * 0 to disable it
+ * @ticket_lifetime: session ticket key rotation interval [s], 0 to disable
+ * tickets
+ *
+ * Configure the session cache and session tickets.
+ */
+static void setup_session_resumption(SSL_CTX* ctx, long cache_size,
+		long ticket_lifetime)
+{
+	if (!SSL_CTX_set_session_id_context(ctx, session_id_context,
+				sizeof(session_id_context) - 1))
+		throw std::runtime_error("SSL_CTX_set_session_id_context() failed");
+
+	if (cache_size)
+	{
+		sessions.max_size = cache_size;
+		SSL_CTX_set_session_cache_mode(ctx,
+				SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+		SSL_CTX_sess_set_new_cb(ctx, new_session_cb);
+		SSL_CTX_sess_set_get_cb(ctx, get_session_cb);
+	}
+	else
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+
+	if (ticket_lifetime)
+	{
+		tickets.lifetime = ticket_lifetime;
+		tickets.have_previous = false;
+		new_ticket_key(tickets.current);
+		tickets.next_rotation = time(NULL) + ticket_lifetime;
+		SSL_CTX_set_timeout(ctx, ticket_lifetime);
+
+#ifdef HAVE_OPENSSL3
+		if (!SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket_key_cb))
+#else
+		if (!SSL_CTX_set_tlsext_ticket_key_cb(ctx, ticket_key_cb))
+#endif
+			throw std::runtime_error("SSL_CTX_set_tlsext_ticket_key_cb() failed");
+	}
+	else
+		SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+
+	SSL_CTX_set_info_callback(ctx, info_cb);
+}
+
+struct SSLKey
+{
+	pkey_ptr pkey;
+	/* certificate loaded from the cache with the key, %NULL if none */
+	x509_ptr x509;
+	std::chrono::duration<double, std::milli> elapsed;
+};
+#else
+struct SSLKey
+{
+};
+#endif
+
+/**
+ * ssl_prepare_key
+ * @keytype: type of key to generate
+ * @cache_path: path to the key & certificate cache file, or %NULL
+ *
+ * Load the key and certificate from @cache_path, or generate a new key.
+ * This does not depend on the address the certificate is issued for,
+ * so it can run in a separate thread while the address is found.
+ *
+ * Returns: the key for SSLMod, %NULL if TLS is disabled at build time
+ */
+std::shared_ptr<SSLKey> ssl_prepare_key(enum key_type keytype,
+		const char* cache_path)
+{
+#ifdef HAVE_LIBSSL
+	auto start_time = std::chrono::steady_clock::now();
+	std::shared_ptr<SSLKey> key = std::make_shared<SSLKey>();
+
+	if (!cache_path || !load_cached_certificate(cache_path, keytype,
+				key->pkey, key->x509))
+	{
+		key->x509.reset();
+		key->pkey = generate_key(keytype);
+	}
+
+	key->elapsed = std::chrono::steady_clock::now() - start_time;
+	return key;
+#else
+	return nullptr;
+#endif
+}
+
+/**
+ * SSLMod::SSLMod
+ * @extip: external IP the certificate is issued for
+ * @enable: whether SSL/TLS was requested via config
+ * @keytype: type of key to generate
+ * @cache_path: path to the key & certificate cache file, or %NULL
+ * @key: result of ssl_prepare_key(), or %NULL to call it now
+ * @session_cache_size: size of the server-side session cache, 0 to disable
+ * @ticket_lifetime: session ticket key rotation interval [s], 0 to disable
+ * @record_size: fixed TLS record size, 0 for dynamic sizing
+ *
+ * Set up TLS for the connections created by bevcb. If @cache_path is given
+ * and contains a still valid certificate for @extip, it is reused;
+ * otherwise a new key and self-signed certificate are generated (and saved
+ * to the cache).
+ */
+SSLMod::SSLMod(const char* extip, bool enable,
+		enum key_type keytype, const char* cache_path,
+		std::shared_ptr<SSLKey> key, long session_cache_size,
+		long ticket_lifetime, long record_size)
+	: enabled(false), record_boost(0), bevcb(NULL), bevcb_arg(NULL)
+{
+	if (!enable)
+		return;
+
+#ifdef HAVE_LIBSSL
+
+	unsigned char sha256_buf[32];
+	unsigned int i;
+	pkey_ptr pkey;
+	x509_ptr x509;
+	auto start_time = std::chrono::steady_clock::now();
+
+	if (!extip)
+		extip = "localhost";
+
+	if (!key)
+		key = ssl_prepare_key(keytype, cache_path);
+	bool cached = key->x509 && cached_certificate_valid(key->x509.get(),
+			extip);
+	if (cached)
+	{
+		pkey = std::move(key->pkey);
+		x509 = std::move(key->x509);
+	}
+	else
+	{
+		/* the cached key is replaced along with the certificate */
+		pkey = key->x509 ? generate_key(keytype) : std::move(key->pkey);
+		x509 = generate_certificate(pkey.get(), extip,
+				cache_path ? cached_cert_validity : cert_validity);
+		if (cache_path)
+			save_cached_certificate(cache_path, pkey.get(), x509.get());
+	}
+
+	std::chrono::duration<double, std::milli> elapsed{key->elapsed
+		+ (std::chrono::steady_clock::now() - start_time)};
+	std::cerr << "TLS key setup took " << std::fixed << std::setprecision(1)
+		<< elapsed.count() << " ms ("
+		<< (cached ? "loaded from cache" : "generated") << ").\n"
+		<< std::defaultfloat;
+
 	ssl = {SSL_CTX_new(TLS_server_method()), SSL_CTX_free};
 	if (!ssl)
 		throw std::bad_alloc();
@@ -154,7 +828,13 @@ SSLMod::SSLMod(evhttp* http, const char* extip, bool enable)
 	if (!SSL_CTX_use_PrivateKey(ssl.get(), pkey.get()))
 		throw std::runtime_error("SSL_CTX_use_PrivateKey() failed");
 
-	evhttp_set_bevcb(http, https_bev_callback, ssl.get());
+	setup_session_resumption(ssl.get(), session_cache_size, ticket_lifetime);
+	setup_record_size(ssl.get(), record_size);
+	if (!record_size)
+		record_boost = record_boost_bytes;
+
+	bevcb = https_bev_callback;
+	bevcb_arg = ssl.get();
 
 	/* print fingerprint */
 	if (!X509_digest(x509.get(), EVP_sha256(), sha256_buf, &i))
@@ -179,12 +859,37 @@ SSLMod::SSLMod(evhttp* http, const char* extip, bool enable)
 #endif
 }
 
+/**
+ * SSLMod::~SSLMod
+ *
+ * Free the TLS context.
+ */
 SSLMod::~SSLMod()
 {
 	if (!enabled)
 		return;
 
 #ifdef HAVE_LIBSSL
+	std::cerr << "TLS handshakes: " << full_handshakes << " full, "
+		<< resumed_handshakes << " resumed." << std::endl;
 	ssl.reset(nullptr);
+	clear_sessions();
+#endif
+}
+
+/**
+ * SSLMod::handshakes
+ * @full: location to store the number of full handshakes
+ * @resumed: location to store the number of resumed handshakes
+ *
+ * Get the handshake counters.
+ */
+void SSLMod::handshakes(unsigned long& full, unsigned long& resumed) const
+{
+#ifdef HAVE_LIBSSL
+	full = full_handshakes;
+	resumed = resumed_handshakes;
+#else
+	full = resumed = 0;
 #endif
 }
@@ -8,15 +8,42 @@
 #ifndef _PSHS_CONTENT_SSL_H
 #define _PSHS_CONTENT_SSL_H 1
 
-#include <event2/http.h>
+#include <memory>
+
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+
+enum key_type
+{
+	KEYTYPE_RSA,
+	KEYTYPE_ECDSA, /* P-256 */
+	KEYTYPE_ED25519,
+};
+
+/* key (and cached certificate) prepared ahead of SSLMod */
+struct SSLKey;
+
+std::shared_ptr<SSLKey> ssl_prepare_key(enum key_type keytype,
+		const char* cache_path);
 
 class SSLMod
 {
 public:
-	SSLMod(evhttp* http, const char* extip, bool enable);
+	SSLMod(const char* extip, bool enable,
+			enum key_type keytype, const char* cache_path,
+			std::shared_ptr<SSLKey> key, long session_cache_size,
+			long ticket_lifetime, long record_size);
 	~SSLMod();
 
+	void handshakes(unsigned long& full, unsigned long& resumed) const;
+
 	bool enabled;
+	/* bytes sent in small TLS records before growing them,
+	 * 0 if record size is fixed */
+	unsigned long record_boost;
+	/* creates bufferevents for incoming connections, %NULL if disabled */
+	struct bufferevent* (*bevcb)(struct event_base* evb, void* data);
+	void* bevcb_arg;
 };
 
 #endif /*_PSHS_CONTENT_SSL_H*/
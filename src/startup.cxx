@@ -0,0 +1,106 @@
+/* pshs -- startup profiling
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <iomanip>
+
+#include "startup.h"
+
+/**
+ * StartupReport::StartupReport
+ *
+ * Start counting time from now. The thread creating the report is
+ * the main one.
+ */
+StartupReport::StartupReport()
+	: _start(clock::now()), _last(_start), _ready(_start),
+	_main_thread(std::this_thread::get_id())
+{
+}
+
+/**
+ * StartupReport::since_start
+ * @t: point in time
+ *
+ * Returns: milliseconds from the start to @t
+ */
+double StartupReport::since_start(clock::time_point t) const
+{
+	return std::chrono::duration<double, std::milli>{t - _start}.count();
+}
+
+StartupReport::Timer::Timer(StartupReport& report, const char* name)
+	: _report(report), _name(name), _start(clock::now())
+{
+}
+
+StartupReport::Timer::~Timer()
+{
+	clock::time_point end = clock::now();
+	std::lock_guard<std::mutex> lk{_report._lock};
+
+	_report._phases.push_back(Phase{_name,
+			std::this_thread::get_id() != _report._main_thread,
+			_report.since_start(_start),
+			std::chrono::duration<double, std::milli>{end - _start}.count()});
+}
+
+/**
+ * StartupReport::done
+ * @name: name of the phase, a string literal
+ *
+ * Record a phase of the main thread, from the end of the previous one
+ * till now.
+ */
+void StartupReport::done(const char* name)
+{
+	clock::time_point end = clock::now();
+	std::lock_guard<std::mutex> lk{_lock};
+
+	_phases.push_back(Phase{name, false, since_start(_last),
+			std::chrono::duration<double, std::milli>{end - _last}.count()});
+	_last = end;
+}
+
+/**
+ * StartupReport::ready
+ *
+ * Note that the server is ready to handle connections.
+ */
+void StartupReport::ready()
+{
+	_ready = clock::now();
+}
+
+/**
+ * StartupReport::print
+ * @out: the stream
+ *
+ * Print the phases recorded so far in the order they started, and
+ * the time till the server was ready, to be compared with the sum of
+ * the phases.
+ */
+void StartupReport::print(std::ostream& out)
+{
+	double total = 0;
+	std::lock_guard<std::mutex> lk{_lock};
+
+	std::sort(_phases.begin(), _phases.end(),
+			[](const Phase& a, const Phase& b) { return a.start < b.start; });
+
+	out << "Startup phases (ms):\n" << std::fixed << std::setprecision(1)
+		<< std::setfill(' ');
+	for (const Phase& p : _phases)
+	{
+		out << std::setw(8) << p.start << std::setw(8) << p.duration
+			<< "  " << p.name << (p.background ? " (background)" : "")
+			<< '\n';
+		total += p.duration;
+	}
+	out << "Ready after " << since_start(_ready) << " ms, phases took "
+		<< total << " ms in total." << std::defaultfloat << std::endl;
+}
@@ -0,0 +1,76 @@
+/* pshs -- startup profiling
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+#ifndef _PSHS_STARTUP_H
+#define _PSHS_STARTUP_H
+
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class StartupReport
+{
+	typedef std::chrono::steady_clock clock;
+
+	struct Phase
+	{
+		const char* name;
+		/* whether it ran outside of the main thread */
+		bool background;
+		/* milliseconds since the start */
+		double start;
+		double duration;
+	};
+
+	/* records a phase when it goes out of scope */
+	class Timer
+	{
+		StartupReport& _report;
+		const char* _name;
+		clock::time_point _start;
+
+	public:
+		Timer(StartupReport& report, const char* name);
+		~Timer();
+	};
+
+	clock::time_point _start;
+	/* end of the last phase in the main thread */
+	clock::time_point _last;
+	clock::time_point _ready;
+	std::thread::id _main_thread;
+	std::vector<Phase> _phases;
+	std::mutex _lock;
+
+	double since_start(clock::time_point t) const;
+
+public:
+	StartupReport();
+
+	/**
+	 * StartupReport::time
+	 * @name: name of the phase, a string literal
+	 * @fn: function running the phase
+	 *
+	 * Run @fn, and record how long it took. Can be called from any thread.
+	 *
+	 * Returns: the result of @fn
+	 */
+	template <typename F>
+	auto time(const char* name, F&& fn) -> decltype(fn())
+	{
+		Timer t{*this, name};
+		return fn();
+	}
+
+	void done(const char* name);
+	void ready();
+	void print(std::ostream& out);
+};
+
+#endif /*_PSHS_STARTUP_H*/
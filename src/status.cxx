@@ -0,0 +1,265 @@
+/* pshs -- live transfer status
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "status.h"
+#include "escape.h"
+#include "opener.h"
+
+/**
+ * format_size
+ * @buf: output buffer
+ * @size: size of @buf
+ * @bytes: number of bytes
+ *
+ * Format @bytes using binary units, e.g. "1.5 GiB".
+ *
+ * Returns: @buf
+ */
+static const char* format_size(char* buf, size_t size, double bytes)
+{
+	static const char* const units[] = { "KiB", "MiB", "GiB", "TiB" };
+	int unit = -1;
+
+	while (bytes >= 1024 && unit < 3)
+	{
+		bytes /= 1024;
+		++unit;
+	}
+
+	if (unit == -1)
+		snprintf(buf, size, "%.0f B", bytes);
+	else
+		snprintf(buf, size, "%.1f %s", bytes, units[unit]);
+	return buf;
+}
+
+/**
+ * format_eta
+ * @buf: output buffer
+ * @size: size of @buf
+ * @t: the transfer
+ *
+ * Format the time left to finish @t, as [H:]MM:SS.
+ *
+ * Returns: @buf
+ */
+static const char* format_eta(char* buf, size_t size, const TransferStatus& t)
+{
+	if (t.rate < 1)
+		snprintf(buf, size, "--:--");
+	else
+	{
+		unsigned long secs = (t.total - t.sent) / t.rate;
+
+		if (secs >= 3600)
+			snprintf(buf, size, "%lu:%02lu:%02lu", secs / 3600,
+					secs / 60 % 60, secs % 60);
+		else
+			snprintf(buf, size, "%02lu:%02lu", secs / 60, secs % 60);
+	}
+	return buf;
+}
+
+/**
+ * StatusView::StatusView
+ * @evb: the event base
+ * @conns: the connection tracker to report on
+ *
+ * Start redrawing the status of the transfers on stderr every second.
+ * Nothing else should write to the terminal meanwhile.
+ */
+StatusView::StatusView(struct event_base* evb, const ConnTracker& conns)
+	: _conns(conns), _lines(0)
+{
+	const struct timeval interval = { 1, 0 };
+
+	_timer = event_new(evb, -1, EV_PERSIST, redraw_callback, this);
+	if (!_timer || event_add(_timer, &interval))
+		throw std::runtime_error("Unable to set up the status timer");
+}
+
+/**
+ * StatusView::~StatusView
+ *
+ * Stop redrawing. The last view is left on the terminal, since the exit
+ * messages are printed below it already.
+ */
+StatusView::~StatusView()
+{
+	event_free(_timer);
+}
+
+/**
+ * StatusView::redraw_callback
+ * @fd: unused
+ * @what: unused
+ * @data: the view
+ */
+void StatusView::redraw_callback(evutil_socket_t fd, short what, void* data)
+{
+	static_cast<StatusView*>(data)->redraw();
+}
+
+/**
+ * add_line
+ * @out: the output
+ * @line: line to add
+ * @width: terminal width
+ *
+ * Add @line to @out, cut to fit in @width columns so that it does not
+ * wrap (which would break the redraw), and with control characters
+ * replaced.
+ */
+static void add_line(std::string& out, std::string line, size_t width)
+{
+	if (line.size() >= width)
+	{
+		size_t cut = width - 1;
+		/* do not split a UTF-8 sequence */
+		while (cut && (line[cut] & 0xc0) == 0x80)
+			--cut;
+		line.resize(cut);
+	}
+
+	for (char& c : line)
+		if (static_cast<unsigned char>(c) < 0x20 || c == 0x7f)
+			c = '?';
+	out += line;
+	out += '\n';
+}
+
+/**
+ * StatusView::redraw
+ *
+ * Replace the view with the current status: a summary line and one
+ * line per file being sent, as many as fit in half the terminal.
+ */
+void StatusView::redraw()
+{
+	ServerStatus st;
+	struct winsize ws;
+	size_t width = 80;
+	size_t rows = 24;
+	char line[256], sent[16], total[16], rate[16], eta[24];
+	std::string out;
+
+	if (!ioctl(STDERR_FILENO, TIOCGWINSZ, &ws) && ws.ws_col && ws.ws_row)
+	{
+		width = ws.ws_col;
+		rows = ws.ws_row;
+	}
+	size_t max_transfers = rows > 4 ? rows / 2 - 1 : 1;
+
+	_conns.status(st);
+
+	if (_lines)
+		out = "\033[" + std::to_string(_lines) + "A";
+	out += "\r\033[J";
+	_lines = 0;
+
+	snprintf(line, sizeof(line),
+			"%u connections, %zu transfers, %s/s, %s sent", st.connections,
+			st.transfers.size(), format_size(rate, sizeof(rate), st.rate),
+			format_size(sent, sizeof(sent), st.sent));
+	add_line(out, line, width);
+	++_lines;
+
+	for (const TransferStatus& t : st.transfers)
+	{
+		if (_lines > static_cast<int>(max_transfers))
+		{
+			snprintf(line, sizeof(line), "  ... and %zu more",
+					st.transfers.size() - max_transfers);
+			add_line(out, line, width);
+			++_lines;
+			break;
+		}
+
+		snprintf(line, sizeof(line), "  %3d%%  %s / %s  %s/s  ETA %s  [",
+				static_cast<int>(t.sent * 100 / t.total),
+				format_size(sent, sizeof(sent), t.sent),
+				format_size(total, sizeof(total), t.total),
+				format_size(rate, sizeof(rate), t.rate),
+				format_eta(eta, sizeof(eta), t));
+		add_line(out, line + t.peer + "] " + t.file, width);
+		++_lines;
+	}
+
+	std::cerr << out << std::flush;
+}
+
+/**
+ * status_json
+ * @buf: target buffer
+ * @conns: the connection tracker to report on
+ *
+ * Append the status of the server as a JSON object to @buf: the number
+ * of open connections, bytes sent and the current rate (bytes per second),
+ * and the same for every file being sent, with the estimated seconds
+ * left (null if not known yet). If @opener is given, add the requests
+ * waiting for their files in every stage, and the time spent there.
+ */
+void status_json(struct evbuffer* buf, const ConnTracker& conns,
+		const FileOpener* opener)
+{
+	ServerStatus st;
+	const char* sep = "";
+
+	conns.status(st);
+	if (evbuffer_add_printf(buf, "{\"connections\":%u,\"sent\":%" PRIu64
+				",\"rate\":%.0f,\"transfers\":[", st.connections, st.sent,
+				st.rate) == -1)
+		throw std::bad_alloc();
+
+	for (const TransferStatus& t : st.transfers)
+	{
+		evbuffer_add_printf(buf, "%s{\"peer\":\"", sep);
+		add_json_escaped(buf, t.peer.c_str());
+		evbuffer_add_printf(buf, "\",\"file\":\"");
+		add_json_escaped(buf, t.file);
+		evbuffer_add_printf(buf, "\",\"sent\":%" PRIdMAX ",\"total\":%" PRIdMAX
+				",\"rate\":%.0f,\"eta\":", static_cast<intmax_t>(t.sent),
+				static_cast<intmax_t>(t.total), t.rate);
+		if (t.rate >= 1)
+			evbuffer_add_printf(buf, "%.0f", (t.total - t.sent) / t.rate);
+		else
+			evbuffer_add_printf(buf, "null");
+		evbuffer_add_printf(buf, "}");
+		sep = ",";
+	}
+	evbuffer_add_printf(buf, "]");
+
+	if (opener)
+	{
+		std::vector<StageStatus> stages;
+
+		opener->status(stages);
+		evbuffer_add_printf(buf, ",\"open\":{\"refused\":%lu",
+				opener->refused());
+		for (const StageStatus& s : stages)
+			evbuffer_add_printf(buf, ",\"%s\":{\"depth\":%u,\"done\":%lu"
+					",\"seconds\":%.6f,\"max\":%.6f}", s.name, s.depth, s.done,
+					s.seconds, s.max);
+		evbuffer_add_printf(buf, "}");
+	}
+
+	if (evbuffer_add_printf(buf, "}\n") == -1)
+		throw std::bad_alloc();
+}
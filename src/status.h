@@ -0,0 +1,39 @@
+/* pshs -- live transfer status
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+#ifndef _PSHS_STATUS_H
+#define _PSHS_STATUS_H
+
+#include <event2/buffer.h>
+#include <event2/event.h>
+
+#include "conn.h"
+
+// abstract
+class FileOpener;
+
+/* path of the JSON status, under the prefix */
+static const char status_path[] = ".pshs/status";
+
+class StatusView
+{
+	const ConnTracker& _conns;
+	struct event* _timer;
+	/* lines drawn last time, to be overwritten */
+	int _lines;
+
+	static void redraw_callback(evutil_socket_t fd, short what, void* data);
+	void redraw();
+
+public:
+	StatusView(struct event_base* evb, const ConnTracker& conns);
+	~StatusView();
+};
+
+void status_json(struct evbuffer* buf, const ConnTracker& conns,
+		const FileOpener* opener);
+
+#endif /*_PSHS_STATUS_H*/
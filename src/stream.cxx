@@ -0,0 +1,415 @@
+/* pshs -- live stream fan-out
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+
+#include <string.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <event2/bufferevent.h>
+#include <event2/keyvalq_struct.h>
+
+#include "content-type.h"
+#include "stream.h"
+
+/* the ring is made of blocks of this size; a block still referenced
+ * by some client's output when its turn comes is replaced, not reused */
+static const size_t block_size = 64 * 1024;
+
+/* reads per wakeup, so that a fast producer does not starve the clients */
+static const size_t max_reads = 16;
+
+/**
+ * StreamShare::StreamShare
+ * @evb: the event base
+ * @conns: the connection tracker
+ * @fd: nonblocking input, owned by the stream from now on
+ * @name: path the stream is served at
+ * @buffer_size: bytes of the stream kept for the clients, rounded down
+ * to whole blocks
+ * @policy: what to do with clients that fell behind the buffer
+ *
+ * Start reading @fd. The input is read as soon as it is available
+ * whether there are any clients or not, so the producer never waits
+ * for them; only the last @buffer_size bytes are kept.
+ */
+StreamShare::StreamShare(struct event_base* evb, ConnTracker* conns, int fd,
+		const char* name, size_t buffer_size, enum stream_policy policy)
+	: _fd(fd), _name(name), _policy(policy), _conns(conns),
+	_budget(conns->limits().output_high ? conns->limits().output_high
+			: 1024 * 1024),
+	_ring(std::max(buffer_size / block_size, static_cast<size_t>(2))),
+	_burst(std::min(max_reads, _ring.size() / 2)), _head(0), _eof(false)
+{
+	_scratch = evbuffer_new();
+	if (!_scratch)
+		throw std::bad_alloc();
+	_read_ev = event_new(evb, fd, EV_READ | EV_PERSIST, read_callback, this);
+	if (!_read_ev || event_add(_read_ev, NULL))
+	{
+		evbuffer_free(_scratch);
+		throw std::runtime_error("Unable to watch the stream input");
+	}
+}
+
+/**
+ * StreamShare::~StreamShare
+ *
+ * Stop reading and forget the clients. Their unfinished responses are
+ * freed along with the connections; the blocks still queued on them
+ * are freed once sent or dropped.
+ */
+StreamShare::~StreamShare()
+{
+	for (Client* c : _clients)
+	{
+		_conns->set_close_hook(c->req, NULL, NULL);
+		delete c;
+	}
+	for (Block* b : _ring)
+	{
+		if (b)
+			unref_block(NULL, 0, b);
+	}
+	event_free(_read_ev);
+	evbuffer_free(_scratch);
+	close(_fd);
+}
+
+/**
+ * StreamShare::unref_block
+ * @data: unused
+ * @len: unused
+ * @extra: the block
+ *
+ * Drop a reference to the block, freeing it if it was the last one.
+ */
+void StreamShare::unref_block(const void* data, size_t len, void* extra)
+{
+	Block* b = static_cast<Block*>(extra);
+
+	if (!--b->refs)
+	{
+		delete[] b->data;
+		delete b;
+	}
+}
+
+/**
+ * StreamShare::oldest
+ *
+ * Returns: stream offset of the oldest byte still in the ring
+ */
+uint64_t StreamShare::oldest() const
+{
+	uint64_t first = _head / block_size;
+
+	/* the block being filled is the newest one */
+	first = first >= _ring.size() - 1 ? first - (_ring.size() - 1) : 0;
+	return first * block_size;
+}
+
+/**
+ * StreamShare::read_input
+ *
+ * Read what is available into the ring, overwriting the oldest data.
+ * At most half of the ring is filled at once, so that the clients that
+ * keep up get to queue it before it is overwritten.
+ */
+void StreamShare::read_input()
+{
+	for (size_t i = 0; i < _burst; ++i)
+	{
+		size_t off = _head % block_size;
+		Block*& b = _ring[(_head / block_size) % _ring.size()];
+
+		if (!off)
+		{
+			/* leave the old block to the clients still sending it */
+			if (b && b->refs > 1)
+			{
+				--b->refs;
+				b = NULL;
+			}
+			if (!b)
+				b = new Block{new char[block_size], 1};
+		}
+
+		ssize_t rd = read(_fd, b->data + off, block_size - off);
+		if (rd > 0)
+		{
+			_head += rd;
+			continue;
+		}
+		if (rd == -1 && (errno == EAGAIN || errno == EINTR))
+			break;
+
+		if (rd == -1)
+			std::cerr << "read() failed for stream " << _name << ": "
+				<< strerror(errno) << std::endl;
+		std::cerr << "Stream " << _name << " ended after " << _head
+			<< " bytes." << std::endl;
+		_eof = true;
+		event_del(_read_ev);
+		break;
+	}
+}
+
+/**
+ * StreamShare::read_callback
+ * @fd: the input
+ * @what: unused
+ * @data: the stream
+ *
+ * Read the new data, and pass it on to the clients.
+ */
+void StreamShare::read_callback(evutil_socket_t fd, short what, void* data)
+{
+	StreamShare* s = static_cast<StreamShare*>(data);
+
+	s->read_input();
+	s->fan_out();
+}
+
+/**
+ * StreamShare::fan_out
+ *
+ * Queue the new data for every client that has room for it.
+ */
+void StreamShare::fan_out()
+{
+	for (size_t i = 0; i < _clients.size(); )
+	{
+		Client* c = _clients[i];
+
+		push(c);
+		/* unless it was removed, and replaced by the last one */
+		if (i < _clients.size() && _clients[i] == c)
+			++i;
+	}
+}
+
+/**
+ * StreamShare::push
+ * @c: the client
+ *
+ * Add references to the buffered data the client has not got yet to its
+ * output, up to the budget. A client whose next byte was overwritten
+ * already is dropped, or skips ahead to the oldest data, depending on
+ * the policy. Once the input ended and the client got all of it, finish
+ * the response.
+ */
+void StreamShare::push(Client* c)
+{
+	struct bufferevent* bev = evhttp_connection_get_bufferevent(
+			evhttp_request_get_connection(c->req));
+	size_t queued = evbuffer_get_length(bufferevent_get_output(bev));
+	size_t room = queued < _budget ? _budget - queued : 0;
+	uint64_t first = oldest();
+
+	if (c->pos < first)
+	{
+		if (_policy == STREAM_DROP)
+		{
+			struct evhttp_request* req = c->req;
+
+			remove(c);
+			_conns->drop(req, REAP_LAG);
+			return;
+		}
+		c->pos = first;
+	}
+
+	while (room && c->pos < _head)
+	{
+		Block* b = _ring[(c->pos / block_size) % _ring.size()];
+		size_t off = c->pos % block_size;
+		size_t len = std::min(block_size - off, room);
+
+		if (len > _head - c->pos)
+			len = _head - c->pos;
+		++b->refs;
+		if (evbuffer_add_reference(_scratch, b->data + off, len, unref_block,
+					b))
+		{
+			--b->refs;
+			throw std::bad_alloc();
+		}
+		c->pos += len;
+		room -= len;
+	}
+
+	if (_eof && c->pos == _head)
+	{
+		struct evhttp_request* req = c->req;
+
+		remove(c);
+		_conns->finish(req, _scratch);
+	}
+	else if (evbuffer_get_length(_scratch))
+		evhttp_send_reply_chunk_with_cb(c->req, _scratch, drained_callback,
+				this);
+}
+
+/**
+ * StreamShare::drained_callback
+ * @evcon: the connection
+ * @data: the stream
+ *
+ * Queue more of the buffered data once the output drained to the low
+ * watermark.
+ */
+void StreamShare::drained_callback(struct evhttp_connection* evcon,
+		void* data)
+{
+	StreamShare* s = static_cast<StreamShare*>(data);
+
+	for (Client* c : s->_clients)
+	{
+		if (evhttp_request_get_connection(c->req) == evcon)
+		{
+			s->push(c);
+			break;
+		}
+	}
+}
+
+/**
+ * StreamShare::close_callback
+ * @req: the request object
+ * @data: the stream
+ *
+ * Forget the client whose connection closed.
+ */
+void StreamShare::close_callback(struct evhttp_request* req, void* data)
+{
+	StreamShare* s = static_cast<StreamShare*>(data);
+
+	for (Client* c : s->_clients)
+	{
+		if (c->req == req)
+		{
+			s->remove(c);
+			break;
+		}
+	}
+}
+
+/**
+ * StreamShare::remove
+ * @c: the client
+ *
+ * Stop sending the stream to the client, and free it.
+ */
+void StreamShare::remove(Client* c)
+{
+	auto it = std::find(_clients.begin(), _clients.end(), c);
+
+	_conns->set_close_hook(c->req, NULL, NULL);
+	*it = _clients.back();
+	_clients.pop_back();
+	delete c;
+}
+
+/**
+ * StreamShare::serve
+ * @req: the request object
+ *
+ * Send the stream as the response, with chunked encoding (or till the
+ * connection closes for HTTP/1.0 clients), starting at the oldest data
+ * still buffered.
+ */
+void StreamShare::serve(struct evhttp_request* req)
+{
+	struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
+	const char* type = ContentType::by_extension(_name);
+
+	evhttp_add_header(headers, "Server", PACKAGE_NAME "/" PACKAGE_VERSION);
+	evhttp_add_header(headers, "Content-Type",
+			type ? type : "application/octet-stream");
+	evhttp_add_header(headers, "Cache-Control", "no-store");
+
+	if (evhttp_request_get_command(req) == EVHTTP_REQ_HEAD)
+	{
+		evhttp_send_reply(req, 200, "OK", NULL);
+		return;
+	}
+
+	Client* c = new Client{req, oldest()};
+	_clients.push_back(c);
+	_conns->set_close_hook(req, close_callback, this);
+
+	struct bufferevent* bev = evhttp_connection_get_bufferevent(
+			evhttp_request_get_connection(req));
+	/* a client that keeps up needs to send as much per wakeup as is read */
+	bufferevent_set_max_single_write(bev, block_size * _burst);
+	bufferevent_setwatermark(bev, EV_WRITE, _conns->limits().output_low, 0);
+	evhttp_send_reply_start(req, 200, "OK");
+	push(c);
+}
+
+/**
+ * open_stream
+ * @path: FIFO or character device, or %NULL for stdin
+ *
+ * Open the input of a stream in nonblocking mode. A FIFO is opened
+ * for writing too, so that it does not end when a writer goes away
+ * and the next one can carry on.
+ *
+ * Returns: the file descriptor, or -1 on error (reported to stderr)
+ */
+int open_stream(const char* path)
+{
+	struct stat st;
+	int fd = STDIN_FILENO;
+
+	if (path)
+	{
+		if (stat(path, &st))
+		{
+			std::cerr << "stat() failed for " << path << ": "
+				<< strerror(errno) << "\n";
+			return -1;
+		}
+		fd = open(path, (S_ISFIFO(st.st_mode) ? O_RDWR : O_RDONLY)
+				| O_NONBLOCK | O_CLOEXEC);
+		if (fd == -1)
+		{
+			std::cerr << "open() failed for " << path << ": "
+				<< strerror(errno) << "\n";
+			return -1;
+		}
+	}
+	else
+		path = "stdin";
+
+	int flags;
+	if (fstat(fd, &st))
+		std::cerr << "fstat() failed for " << path << ": "
+			<< strerror(errno) << "\n";
+	else if (!S_ISFIFO(st.st_mode) && !S_ISCHR(st.st_mode)
+			&& !S_ISSOCK(st.st_mode))
+		std::cerr << path << " is not a pipe or a character device, "
+			"share it as a file instead.\n";
+	else if ((flags = fcntl(fd, F_GETFL)) == -1
+			|| fcntl(fd, F_SETFL, flags | O_NONBLOCK))
+		std::cerr << "Unable to make " << path << " nonblocking: "
+			<< strerror(errno) << "\n";
+	else
+		return fd;
+
+	if (fd != STDIN_FILENO)
+		close(fd);
+	return -1;
+}
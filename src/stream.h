@@ -0,0 +1,88 @@
+/* pshs -- live stream fan-out
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+#ifndef _PSHS_STREAM_H
+#define _PSHS_STREAM_H
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <event2/buffer.h>
+#include <event2/event.h>
+#include <event2/http.h>
+
+#include "conn.h"
+
+/* what to do with a client that fell behind the buffer */
+enum stream_policy
+{
+	/* close the connection */
+	STREAM_DROP,
+	/* skip to the oldest data still buffered */
+	STREAM_SKIP
+};
+
+class StreamShare
+{
+	/* part of the ring, referenced by the ring and by the output
+	 * buffers it was added to */
+	struct Block
+	{
+		char* data;
+		unsigned int refs;
+	};
+
+	struct Client
+	{
+		struct evhttp_request* req;
+		/* stream offset of the next byte to send */
+		uint64_t pos;
+	};
+
+	struct event* _read_ev;
+	int _fd;
+	const char* _name;
+	enum stream_policy _policy;
+	ConnTracker* _conns;
+	/* bytes queued per client at most */
+	size_t _budget;
+
+	std::vector<Block*> _ring;
+	/* reads per wakeup, at most half of the ring */
+	size_t _burst;
+	/* bytes read so far */
+	uint64_t _head;
+	bool _eof;
+
+	std::vector<Client*> _clients;
+	struct evbuffer* _scratch;
+
+	static void read_callback(evutil_socket_t fd, short what, void* data);
+	static void drained_callback(struct evhttp_connection* evcon,
+			void* data);
+	static void close_callback(struct evhttp_request* req, void* data);
+	static void unref_block(const void* data, size_t len, void* extra);
+
+	uint64_t oldest() const;
+	void read_input();
+	void fan_out();
+	void push(Client* c);
+	void remove(Client* c);
+
+public:
+	StreamShare(struct event_base* evb, ConnTracker* conns, int fd,
+			const char* name, size_t buffer_size, enum stream_policy policy);
+	~StreamShare();
+
+	const char* name() const { return _name; }
+	void serve(struct evhttp_request* req);
+};
+
+int open_stream(const char* path);
+
+#endif /*_PSHS_STREAM_H*/
@@ -0,0 +1,380 @@
+/* pshs -- TCP socket tuning
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include <iostream>
+#include <vector>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+
+#include <event2/buffer.h>
+
+#include "tcp.h"
+
+TcpProfile::TcpProfile()
+	: name("default"), sndbuf(0), notsent_lowat(0), nodelay(false),
+	cork(false), backlog(0), defer_accept(0)
+{
+}
+
+/**
+ * parse_size
+ * @value: size with optional K or M suffix
+ * @out: location to store the size in
+ *
+ * Returns: true on success, false if @value is invalid
+ */
+static bool parse_size(const char* value, int& out)
+{
+	char* end;
+	long ret = strtol(value, &end, 0);
+
+	if (*end == 'K' || *end == 'k')
+	{
+		ret *= 1024;
+		++end;
+	}
+	else if (*end == 'M' || *end == 'm')
+	{
+		ret *= 1024 * 1024;
+		++end;
+	}
+
+	if (*end || end == value || ret < 0 || ret > 1024 * 1024 * 1024)
+		return false;
+	out = ret;
+	return true;
+}
+
+/**
+ * TcpProfile::parse
+ * @spec: profile name, optionally followed by comma-separated
+ * key=value overrides
+ *
+ * Set the profile from @spec, e.g. "bulk,congestion=cubic". The presets
+ * are:
+ * - default: leave everything to the kernel,
+ * - bulk: large transfers over long paths; BBR, cork, deep backlog,
+ * - lan: large transfers over short paths; CUBIC, cork, fixed 1 MiB
+ *   send buffer (autotuning grows slowly at low RTT),
+ * - latency: small files and interactive use; no Nagle, small unsent
+ *   queue so that data is not stuck behind a full buffer.
+ *
+ * Returns: true on success, false if @spec is invalid (reported to stderr)
+ */
+bool TcpProfile::parse(const char* spec)
+{
+	std::string s{spec};
+	size_t pos = s.find(',');
+
+	name = s.substr(0, pos);
+	if (name == "default")
+		*this = TcpProfile();
+	else if (name == "bulk")
+	{
+		sndbuf = 0;
+		notsent_lowat = 0;
+		nodelay = false;
+		cork = true;
+		congestion = "bbr";
+		backlog = 1024;
+		defer_accept = 5;
+	}
+	else if (name == "lan")
+	{
+		sndbuf = 1024 * 1024;
+		notsent_lowat = 0;
+		nodelay = false;
+		cork = true;
+		congestion = "cubic";
+		backlog = 256;
+		defer_accept = 1;
+	}
+	else if (name == "latency")
+	{
+		sndbuf = 0;
+		notsent_lowat = 16 * 1024;
+		nodelay = true;
+		cork = false;
+		congestion.clear();
+		backlog = 128;
+		defer_accept = 0;
+	}
+	else
+	{
+		std::cerr << "Unknown TCP profile: " << name
+			<< " (valid: default, bulk, lan, latency)\n";
+		return false;
+	}
+
+	while (pos != std::string::npos)
+	{
+		size_t next = s.find(',', pos + 1);
+		std::string opt = s.substr(pos + 1, next == std::string::npos
+				? std::string::npos : next - pos - 1);
+		size_t eq = opt.find('=');
+		std::string key = opt.substr(0, eq);
+		const char* value = eq == std::string::npos ? ""
+			: opt.c_str() + eq + 1;
+		bool ok = true;
+		int num = 0;
+
+		pos = next;
+		if (eq == std::string::npos)
+			ok = false;
+		else if (key == "congestion")
+			congestion = value;
+		else if (!parse_size(value, num))
+			ok = false;
+		else if (key == "sndbuf")
+			sndbuf = num;
+		else if (key == "notsent_lowat")
+			notsent_lowat = num;
+		else if (key == "nodelay")
+			nodelay = num;
+		else if (key == "cork")
+			cork = num;
+		else if (key == "backlog")
+			backlog = num;
+		else if (key == "defer_accept")
+			defer_accept = num;
+		else
+			ok = false;
+
+		if (!ok)
+		{
+			std::cerr << "Invalid TCP profile option: " << opt << "\n";
+			return false;
+		}
+	}
+
+	if (nodelay && cork)
+	{
+		std::cerr << "TCP profile can not use both nodelay and cork.\n";
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * set_option
+ * @fd: the socket
+ * @level: option level
+ * @opt: option
+ * @value: new value
+ * @name: option name, for the warning
+ *
+ * Set an integer socket option, warning on failure.
+ */
+static void set_option(int fd, int level, int opt, int value, const char* name)
+{
+	if (setsockopt(fd, level, opt, &value, sizeof(value)))
+		std::cerr << "Unable to set " << name << " to " << value << ": "
+			<< strerror(errno) << std::endl;
+}
+
+/**
+ * is_tcp
+ * @fd: the socket
+ *
+ * Returns: true if @fd is an IPv4 or IPv6 socket
+ */
+static bool is_tcp(int fd)
+{
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof(addr);
+
+	if (getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len))
+		return false;
+	return addr.ss_family == AF_INET || addr.ss_family == AF_INET6;
+}
+
+/**
+ * TcpProfile::apply
+ * @fd: listening socket
+ *
+ * Apply the profile to the listening socket. Linux copies the buffer
+ * sizes, Nagle and unsent data settings and the congestion control
+ * algorithm to every accepted connection, so they need not be set again
+ * per connection. Options that can not be set are reported and skipped.
+ */
+void TcpProfile::apply(int fd) const
+{
+	if (sndbuf)
+		set_option(fd, SOL_SOCKET, SO_SNDBUF, sndbuf, "SO_SNDBUF");
+
+	if (is_tcp(fd))
+	{
+		if (nodelay)
+			set_option(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+#ifdef TCP_NOTSENT_LOWAT
+		if (notsent_lowat)
+			set_option(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, notsent_lowat,
+					"TCP_NOTSENT_LOWAT");
+#endif
+#ifdef TCP_DEFER_ACCEPT
+		if (defer_accept)
+			set_option(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, defer_accept,
+					"TCP_DEFER_ACCEPT");
+#endif
+#ifdef TCP_CONGESTION
+		if (!congestion.empty() && setsockopt(fd, IPPROTO_TCP,
+					TCP_CONGESTION, congestion.c_str(), congestion.size()))
+			std::cerr << "Unable to use congestion control "
+				<< congestion << ": " << strerror(errno)
+				<< " (see net.ipv4.tcp_available_congestion_control)"
+				<< std::endl;
+#endif
+	}
+
+	/* listen() again just updates the backlog */
+	if (backlog && listen(fd, backlog))
+		std::cerr << "Unable to set listen backlog to " << backlog << ": "
+			<< strerror(errno) << std::endl;
+}
+
+/**
+ * get_option
+ * @fd: the socket
+ * @level: option level
+ * @opt: option
+ *
+ * Returns: current value of an integer socket option, or -1 on error
+ */
+static int get_option(int fd, int level, int opt)
+{
+	int value;
+	socklen_t len = sizeof(value);
+
+	if (getsockopt(fd, level, opt, &value, &len))
+		return -1;
+	return value;
+}
+
+/**
+ * TcpProfile::report
+ * @fd: listening socket the profile was applied to
+ *
+ * Print the effective option values, as reported by the kernel, to stderr.
+ */
+void TcpProfile::report(int fd) const
+{
+	std::cerr << "TCP profile " << name << ": sndbuf "
+		<< get_option(fd, SOL_SOCKET, SO_SNDBUF)
+		<< (sndbuf ? "" : " (autotuned)");
+
+	if (is_tcp(fd))
+	{
+		std::cerr << ", nodelay " << get_option(fd, IPPROTO_TCP, TCP_NODELAY)
+			<< ", cork " << (cork ? "per response" : "off");
+#ifdef TCP_NOTSENT_LOWAT
+		int lowat = get_option(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT);
+		std::cerr << ", notsent_lowat ";
+		if (lowat > 0)
+			std::cerr << lowat;
+		else
+			std::cerr << "default";
+#endif
+#ifdef TCP_DEFER_ACCEPT
+		std::cerr << ", defer_accept "
+			<< get_option(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT) << " s";
+#endif
+#ifdef TCP_CONGESTION
+		char cc[16];
+		socklen_t cc_len = sizeof(cc);
+		if (!getsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, cc, &cc_len))
+			std::cerr << ", congestion " << std::string(cc,
+					strnlen(cc, cc_len));
+#endif
+	}
+
+	if (backlog)
+	{
+		std::cerr << ", backlog " << backlog;
+
+		/* the kernel silently caps it */
+		FILE* f = fopen("/proc/sys/net/core/somaxconn", "re");
+		int somaxconn;
+		if (f)
+		{
+			if (fscanf(f, "%d", &somaxconn) == 1 && somaxconn < backlog)
+				std::cerr << " (capped to somaxconn " << somaxconn << ')';
+			fclose(f);
+		}
+	}
+
+	std::cerr << '.' << std::endl;
+}
+
+/* body bytes queued behind the headers when the connection was corked,
+ * indexed by fd; rewritten on every cork */
+static std::vector<size_t> cork_body;
+
+/**
+ * uncork_cb
+ * @buf: output buffer of the connection
+ * @info: information about the change
+ * @data: the bufferevent
+ *
+ * Uncork the connection once the headers and the start of the body have
+ * been passed to the kernel.
+ */
+static void uncork_cb(struct evbuffer* buf, const struct evbuffer_cb_info* info,
+		void* data)
+{
+	struct bufferevent* bev = static_cast<struct bufferevent*>(data);
+	int fd = bufferevent_getfd(bev);
+	size_t left = evbuffer_get_length(buf);
+
+	if (!info->n_deleted || (left && left >= cork_body[fd]))
+		return;
+
+#ifdef TCP_CORK
+	set_option(fd, IPPROTO_TCP, TCP_CORK, 0, "TCP_CORK");
+#endif
+	evbuffer_remove_cb(buf, uncork_cb, data);
+}
+
+/**
+ * cork_response
+ * @bev: bufferevent of the connection
+ * @body: length of the response body that follows the headers
+ *
+ * Cork the connection before a response is queued, so that the headers
+ * (written with writev()) and the start of the body (usually sent with
+ * sendfile()) share packets instead of the headers going out alone.
+ * Unix sockets are left as they are.
+ */
+void cork_response(struct bufferevent* bev, size_t body)
+{
+#ifdef TCP_CORK
+	int fd = bufferevent_getfd(bev);
+	struct evbuffer* out = bufferevent_get_output(bev);
+	int on = 1;
+
+	if (fd < 0 || !body
+			|| setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)))
+		return;
+
+	if (cork_body.size() <= static_cast<size_t>(fd))
+		cork_body.resize(fd + 1);
+	cork_body[fd] = body;
+
+	/* a previous response may still be corked */
+	evbuffer_remove_cb(out, uncork_cb, bev);
+	if (!evbuffer_add_cb(out, uncork_cb, bev))
+		set_option(fd, IPPROTO_TCP, TCP_CORK, 0, "TCP_CORK");
+#endif
+}
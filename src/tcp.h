@@ -0,0 +1,43 @@
+/* pshs -- TCP socket tuning
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+#ifndef _PSHS_TCP_H
+#define _PSHS_TCP_H
+
+#include <string>
+
+#include <stddef.h>
+
+#include <event2/bufferevent.h>
+
+struct TcpProfile
+{
+	std::string name;
+	/* send buffer size, 0 to leave autotuning on */
+	int sndbuf;
+	/* limit of unsent data queued in the kernel, 0 for default */
+	int notsent_lowat;
+	/* disable Nagle's algorithm */
+	bool nodelay;
+	/* cork the socket while the headers and the first part of the body
+	 * are written, so that they share packets */
+	bool cork;
+	/* congestion control algorithm, empty for system default */
+	std::string congestion;
+	int backlog;
+	/* wake up the listener only once data arrives (seconds), 0 to disable */
+	int defer_accept;
+
+	TcpProfile();
+
+	bool parse(const char* spec);
+	void apply(int fd) const;
+	void report(int fd) const;
+};
+
+void cork_response(struct bufferevent* bev, size_t body);
+
+#endif /*_PSHS_TCP_H*/
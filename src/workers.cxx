@@ -0,0 +1,109 @@
+/* pshs -- background worker pool
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "config.h"
+
+#include "workers.h"
+
+/**
+ * WorkerPool::WorkerPool
+ * @threads: number of threads to start, 0 to use the number of CPUs
+ *
+ * Start a pool of worker threads processing the job queue.
+ */
+WorkerPool::WorkerPool(unsigned int threads)
+	: _stopping(false)
+{
+	if (!threads)
+		threads = std::thread::hardware_concurrency();
+	if (!threads)
+		threads = 1;
+
+	for (unsigned int i = 0; i < threads; ++i)
+		_threads.emplace_back(&WorkerPool::run, this);
+}
+
+/**
+ * WorkerPool::~WorkerPool
+ *
+ * Stop the pool, dropping queued jobs, and wait for the running ones.
+ */
+WorkerPool::~WorkerPool()
+{
+	stop();
+}
+
+/**
+ * WorkerPool::run
+ *
+ * The worker thread loop -- take jobs from the queue until stopped.
+ */
+void WorkerPool::run()
+{
+	for (;;)
+	{
+		std::function<void()> job;
+
+		{
+			std::unique_lock<std::mutex> lk{_lock};
+			_cond.wait(lk, [this] { return _stopping || !_queue.empty(); });
+			if (_stopping)
+				return;
+			job = std::move(_queue.front());
+			_queue.pop_front();
+		}
+
+		job();
+	}
+}
+
+/**
+ * WorkerPool::submit
+ * @job: function to call
+ *
+ * Queue @job for execution in one of the worker threads.
+ */
+void WorkerPool::submit(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lk{_lock};
+		_queue.push_back(std::move(job));
+	}
+	_cond.notify_one();
+}
+
+/**
+ * WorkerPool::stop
+ *
+ * Drop the pending jobs and join all threads. Long-running jobs are expected
+ * to poll stopping() and return early.
+ */
+void WorkerPool::stop()
+{
+	{
+		std::lock_guard<std::mutex> lk{_lock};
+		_stopping = true;
+		_queue.clear();
+	}
+	_cond.notify_all();
+
+	for (std::thread& t : _threads)
+	{
+		if (t.joinable())
+			t.join();
+	}
+	_threads.clear();
+}
+
+/**
+ * WorkerPool::stopping
+ *
+ * Returns: true if the pool is being shut down
+ */
+bool WorkerPool::stopping()
+{
+	std::lock_guard<std::mutex> lk{_lock};
+	return _stopping;
+}
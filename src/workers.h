@@ -0,0 +1,38 @@
+/* pshs -- background worker pool
+ * (c) 2026 pshs contributors
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#pragma once
+#ifndef _PSHS_WORKERS_H
+#define _PSHS_WORKERS_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool
+{
+	std::vector<std::thread> _threads;
+	std::deque<std::function<void()>> _queue;
+	std::mutex _lock;
+	std::condition_variable _cond;
+	bool _stopping;
+
+	void run();
+
+public:
+	WorkerPool(unsigned int threads = 0);
+	~WorkerPool();
+
+	void submit(std::function<void()> job);
+	void stop();
+
+	bool stopping();
+	size_t size() const { return _threads.size(); }
+};
+
+#endif /*_PSHS_WORKERS_H*/